@@ -0,0 +1,381 @@
+#include "adv_filter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "esp_log.h"
+
+#define ADV_FILTER_VERSION 1
+
+static const char *TAG = "ADV_FILTER";
+
+/**
+ * @brief FNV-1a over the pattern bytes
+ */
+static uint32_t pattern_hash(const uint8_t *key, uint8_t len)
+{
+    uint32_t h = 2166136261u;
+    for (uint8_t i = 0; i < len; i++) {
+        h ^= key[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief find a key in a set
+ * @param keys pattern storage, stride bytes per pattern
+ * @param lens pattern lengths, NULL for fixed size patterns of stride bytes
+ * @return pattern index or -1
+ */
+static int set_find(const adv_pattern_set_t *set, const uint8_t *keys, size_t stride, const uint8_t *lens,
+                    const uint8_t *key, uint8_t len)
+{
+    if (set->count == 0) return -1;
+
+    uint32_t pos = pattern_hash(key, len) & (ADV_FILTER_SLOTS - 1);
+    for (int n = 0; n < ADV_FILTER_SLOTS; n++) {
+        uint8_t slot = set->slots[pos];
+        if (slot == 0) return -1;
+
+        int index = slot - 1;
+        uint8_t key_len = lens ? lens[index] : (uint8_t)stride;
+        if (key_len == len && memcmp(&keys[index * stride], key, len) == 0) return index;
+        pos = (pos + 1) & (ADV_FILTER_SLOTS - 1);
+    }
+    return -1;
+}
+
+/**
+ * @brief add a key already copied to keys[set->count], duplicates are ignored
+ * @return ESP_ERR_NO_MEM when the set is full
+ */
+static esp_err_t set_add(adv_pattern_set_t *set, const uint8_t *keys, size_t stride, const uint8_t *lens)
+{
+    if (set->count >= ADV_FILTER_MAX_PATTERNS) return ESP_ERR_NO_MEM;
+
+    const uint8_t *key = &keys[set->count * stride];
+    uint8_t len = lens ? lens[set->count] : (uint8_t)stride;
+    if (set_find(set, keys, stride, lens, key, len) >= 0) return ESP_OK;
+
+    uint32_t pos = pattern_hash(key, len) & (ADV_FILTER_SLOTS - 1);
+    while (set->slots[pos] != 0) {
+        pos = (pos + 1) & (ADV_FILTER_SLOTS - 1);
+    }
+    set->slots[pos] = ++set->count;
+    return ESP_OK;
+}
+
+/**
+ * @brief split the next comma separated token, surrounding blanks are trimmed
+ * @return pointer after the token, NULL at the end of the text
+ */
+static const char *next_token(const char *text, const char **token, size_t *token_len)
+{
+    if (!text || *text == '\0') return NULL;
+
+    const char *end = strchr(text, ',');
+    const char *next = end ? end + 1 : text + strlen(text);
+    if (!end) end = next;
+
+    while (text < end && isspace((unsigned char)*text)) text++;
+    while (end > text && isspace((unsigned char)end[-1])) end--;
+
+    *token = text;
+    *token_len = (size_t)(end - text);
+    return next;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * @brief parse hex digits (dashes and a 0x prefix are skipped) into big endian bytes
+ * @return number of bytes, 0 on invalid input
+ */
+static size_t parse_hex(const char *token, size_t len, uint8_t *out, size_t out_len)
+{
+    if (len >= 2 && token[0] == '0' && (token[1] == 'x' || token[1] == 'X')) {
+        token += 2;
+        len -= 2;
+    }
+
+    size_t digits = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (token[i] == '-') continue;
+        int v = hex_value(token[i]);
+        if (v < 0 || digits / 2 >= out_len) return 0;
+
+        if (digits % 2 == 0) {
+            out[digits / 2] = (uint8_t)(v << 4);
+        } else {
+            out[digits / 2] |= (uint8_t)v;
+        }
+        digits++;
+    }
+    return (digits % 2 == 0) ? digits / 2 : 0;
+}
+
+void adv_filter_clear(adv_filter_t *filter)
+{
+    bool by_name = filter->by_name;
+    bool by_uuid = filter->by_uuid;
+    memset(filter, 0, sizeof(*filter));
+    filter->by_name = by_name;
+    filter->by_uuid = by_uuid;
+}
+
+esp_err_t adv_filter_set_names(adv_filter_t *filter, const char *text)
+{
+    memset(&filter->name_set, 0, sizeof(filter->name_set));
+    filter->name_len_mask = 0;
+
+    const char *token;
+    size_t token_len;
+    while ((text = next_token(text, &token, &token_len)) != NULL) {
+        if (token_len == 0) continue;
+        if (token_len > ADV_NAME_MAX) {
+            ESP_LOGE(TAG, "Name too long: %.*s", (int)token_len, token);
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (filter->name_set.count >= ADV_FILTER_MAX_PATTERNS) return ESP_ERR_NO_MEM;
+
+        uint8_t index = filter->name_set.count;
+        memset(filter->names[index], 0, sizeof(filter->names[index]));
+        memcpy(filter->names[index], token, token_len);
+        filter->name_lens[index] = (uint8_t)token_len;
+        filter->name_len_mask |= 1u << token_len;
+
+        esp_err_t err = set_add(&filter->name_set, (const uint8_t *)filter->names,
+                                sizeof(filter->names[0]), filter->name_lens);
+        if (err != ESP_OK) return err;
+    }
+    return ESP_OK;
+}
+
+esp_err_t adv_filter_set_uuids(adv_filter_t *filter, const char *text)
+{
+    memset(&filter->uuid16_set, 0, sizeof(filter->uuid16_set));
+
+    const char *token;
+    size_t token_len;
+    while ((text = next_token(text, &token, &token_len)) != NULL) {
+        if (token_len == 0) continue;
+
+        uint8_t be[16];
+        size_t n = parse_hex(token, token_len, be, sizeof(be));
+        if (n == 16) {
+            // the lamp's characteristics are found from a 16-bit service UUID
+            ESP_LOGE(TAG, "128-bit UUID not supported, lamps are driven by their 16-bit service UUID: %.*s",
+                     (int)token_len, token);
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+        if (n != 2) {
+            ESP_LOGE(TAG, "Invalid UUID: %.*s", (int)token_len, token);
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (filter->uuid16_set.count >= ADV_FILTER_MAX_PATTERNS) return ESP_ERR_NO_MEM;
+
+        // UUIDs are written big endian but advertised little endian
+        uint8_t *key = filter->uuid16[filter->uuid16_set.count];
+        key[0] = be[1];
+        key[1] = be[0];
+        esp_err_t err = set_add(&filter->uuid16_set, (uint8_t *)filter->uuid16, 2, NULL);
+        if (err != ESP_OK) return err;
+    }
+    return ESP_OK;
+}
+
+esp_err_t adv_filter_set_companies(adv_filter_t *filter, const char *text)
+{
+    memset(&filter->company_set, 0, sizeof(filter->company_set));
+
+    const char *token;
+    size_t token_len;
+    while ((text = next_token(text, &token, &token_len)) != NULL) {
+        if (token_len == 0) continue;
+
+        uint8_t be[2];
+        if (parse_hex(token, token_len, be, sizeof(be)) != 2) {
+            ESP_LOGE(TAG, "Invalid company id: %.*s", (int)token_len, token);
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (filter->company_set.count >= ADV_FILTER_MAX_PATTERNS) return ESP_ERR_NO_MEM;
+
+        uint8_t *key = filter->company[filter->company_set.count];
+        key[0] = be[1];
+        key[1] = be[0];
+        esp_err_t err = set_add(&filter->company_set, (uint8_t *)filter->company, 2, NULL);
+        if (err != ESP_OK) return err;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief append to a comma separated list, stops silently when buf is full
+ */
+static void append_token(char *buf, size_t len, size_t *pos, const char *token)
+{
+    int n = snprintf(buf + *pos, len - *pos, "%s%s", *pos ? "," : "", token);
+    if (n > 0 && *pos + (size_t)n < len) {
+        *pos += (size_t)n;
+    } else {
+        buf[*pos] = '\0'; // drop the truncated token
+    }
+}
+
+void adv_filter_get_names(const adv_filter_t *filter, char *buf, size_t len)
+{
+    size_t pos = 0;
+    buf[0] = '\0';
+    for (uint8_t i = 0; i < filter->name_set.count; i++) {
+        append_token(buf, len, &pos, filter->names[i]);
+    }
+}
+
+void adv_filter_get_uuids(const adv_filter_t *filter, char *buf, size_t len)
+{
+    size_t pos = 0;
+    char token[8];
+    buf[0] = '\0';
+    for (uint8_t i = 0; i < filter->uuid16_set.count; i++) {
+        snprintf(token, sizeof(token), "%02X%02X", filter->uuid16[i][1], filter->uuid16[i][0]);
+        append_token(buf, len, &pos, token);
+    }
+}
+
+void adv_filter_get_companies(const adv_filter_t *filter, char *buf, size_t len)
+{
+    size_t pos = 0;
+    char token[8];
+    buf[0] = '\0';
+    for (uint8_t i = 0; i < filter->company_set.count; i++) {
+        snprintf(token, sizeof(token), "%02X%02X", filter->company[i][1], filter->company[i][0]);
+        append_token(buf, len, &pos, token);
+    }
+}
+
+/**
+ * @param uuid16 set to the matching 16-bit UUID
+ */
+static bool match_uuids(const adv_filter_t *filter, const adv_fields_t *fields, uint16_t *uuid16)
+{
+    for (uint8_t i = 0; i + 2 <= fields->uuid16_len; i += 2) {
+        if (set_find(&filter->uuid16_set, (const uint8_t *)filter->uuid16, 2, NULL, &fields->uuid16[i], 2) >= 0) {
+            *uuid16 = fields->uuid16[i] | (fields->uuid16[i + 1] << 8);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool adv_filter_match(const adv_filter_t *filter, const adv_fields_t *fields, uint16_t *uuid16)
+{
+    uint16_t matched = 0;
+
+    if (filter->by_name) {
+        // most names around have a length no pattern has, no need to hash them
+        if (fields->name_len > ADV_NAME_MAX || !(filter->name_len_mask & (1u << fields->name_len))) return false;
+        if (set_find(&filter->name_set, (const uint8_t *)filter->names, sizeof(filter->names[0]),
+                     filter->name_lens, fields->name, fields->name_len) < 0) return false;
+    }
+
+    if (filter->by_uuid && !match_uuids(filter, fields, &matched)) return false;
+
+    if (filter->company_set.count) {
+        if (fields->mfg_len < 2) return false;
+        if (set_find(&filter->company_set, (const uint8_t *)filter->company, 2, NULL, fields->mfg_data, 2) < 0) {
+            return false;
+        }
+    }
+    if (uuid16) *uuid16 = matched ? matched : adv_first_uuid16(fields);
+    return true;
+}
+
+/* blob: version, 4 counts, then names as [len][bytes], uuid16, uuid128, company ids.
+ * The uuid128 count is always 0 now, blobs of older firmware may have some. */
+size_t adv_filter_serialize(const adv_filter_t *filter, uint8_t *buf, size_t len)
+{
+    size_t need = 5 + (size_t)filter->uuid16_set.count * 2 + (size_t)filter->company_set.count * 2;
+    for (uint8_t i = 0; i < filter->name_set.count; i++) {
+        need += 1 + filter->name_lens[i];
+    }
+    if (need > len) return 0;
+
+    size_t pos = 0;
+    buf[pos++] = ADV_FILTER_VERSION;
+    buf[pos++] = filter->name_set.count;
+    buf[pos++] = filter->uuid16_set.count;
+    buf[pos++] = 0;
+    buf[pos++] = filter->company_set.count;
+    for (uint8_t i = 0; i < filter->name_set.count; i++) {
+        buf[pos++] = filter->name_lens[i];
+        memcpy(&buf[pos], filter->names[i], filter->name_lens[i]);
+        pos += filter->name_lens[i];
+    }
+    memcpy(&buf[pos], filter->uuid16, filter->uuid16_set.count * 2);
+    pos += filter->uuid16_set.count * 2;
+    memcpy(&buf[pos], filter->company, filter->company_set.count * 2);
+    pos += filter->company_set.count * 2;
+    return pos;
+}
+
+esp_err_t adv_filter_deserialize(adv_filter_t *filter, const uint8_t *buf, size_t len)
+{
+    if (len < 5 || buf[0] != ADV_FILTER_VERSION) return ESP_ERR_INVALID_VERSION;
+
+    uint8_t names = buf[1], uuid16 = buf[2], uuid128 = buf[3], companies = buf[4];
+    if (names > ADV_FILTER_MAX_PATTERNS || uuid16 > ADV_FILTER_MAX_PATTERNS ||
+        uuid128 > ADV_FILTER_MAX_PATTERNS || companies > ADV_FILTER_MAX_PATTERNS) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    adv_filter_clear(filter);
+    size_t pos = 5;
+    for (uint8_t i = 0; i < names; i++) {
+        if (pos >= len || buf[pos] > ADV_NAME_MAX || pos + 1 + buf[pos] > len) goto corrupt;
+        uint8_t index = filter->name_set.count;
+        filter->name_lens[index] = buf[pos];
+        filter->name_len_mask |= 1u << buf[pos];
+        memcpy(filter->names[index], &buf[pos + 1], buf[pos]);
+        pos += 1 + buf[pos];
+        set_add(&filter->name_set, (const uint8_t *)filter->names, sizeof(filter->names[0]), filter->name_lens);
+    }
+    if (pos + uuid16 * 2 + uuid128 * 16 + companies * 2 != len) goto corrupt;
+
+    for (uint8_t i = 0; i < uuid16; i++, pos += 2) {
+        memcpy(filter->uuid16[filter->uuid16_set.count], &buf[pos], 2);
+        set_add(&filter->uuid16_set, (const uint8_t *)filter->uuid16, 2, NULL);
+    }
+    if (uuid128) {
+        ESP_LOGW(TAG, "%d stored 128-bit UUID(s) dropped, only 16-bit service UUIDs are supported", uuid128);
+        pos += uuid128 * 16;
+    }
+    for (uint8_t i = 0; i < companies; i++, pos += 2) {
+        memcpy(filter->company[filter->company_set.count], &buf[pos], 2);
+        set_add(&filter->company_set, (const uint8_t *)filter->company, 2, NULL);
+    }
+    return ESP_OK;
+
+corrupt:
+    adv_filter_clear(filter);
+    return ESP_ERR_INVALID_SIZE;
+}
+
+bool adv_filter_same_patterns(const adv_filter_t *a, const adv_filter_t *b)
+{
+    if (a->name_set.count != b->name_set.count || a->uuid16_set.count != b->uuid16_set.count ||
+        a->company_set.count != b->company_set.count) {
+        return false;
+    }
+    // unused name bytes are always zero, so whole entries can be compared
+    return memcmp(a->names, b->names, a->name_set.count * sizeof(a->names[0])) == 0 &&
+           memcmp(a->uuid16, b->uuid16, a->uuid16_set.count * sizeof(a->uuid16[0])) == 0 &&
+           memcmp(a->company, b->company, a->company_set.count * sizeof(a->company[0])) == 0;
+}
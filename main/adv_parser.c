@@ -0,0 +1,77 @@
+#include "adv_parser.h"
+
+#include <string.h>
+
+bool adv_parse(const uint8_t *data, uint16_t len, adv_fields_t *fields)
+{
+    memset(fields, 0, sizeof(*fields));
+    bool short_name = false;
+
+    uint16_t pos = 0;
+    while (pos < len) {
+        uint8_t field_len = data[pos];
+        if (field_len == 0) {
+            // zero length ends the significant part (padding), scan response may follow
+            pos++;
+            continue;
+        }
+        if (pos + 1U + field_len > len) return false;
+
+        uint8_t type = data[pos + 1];
+        const uint8_t *value = &data[pos + 2];
+        uint8_t value_len = field_len - 1;
+
+        switch (type) {
+        case ADV_TYPE_FLAGS:
+            if (value_len >= 1) {
+                fields->flags = value[0];
+                fields->has_flags = true;
+            }
+            break;
+        case ADV_TYPE_UUID16_INCMPL:
+        case ADV_TYPE_UUID16_CMPL:
+            if (!fields->uuid16 || type == ADV_TYPE_UUID16_CMPL) {
+                fields->uuid16 = value;
+                fields->uuid16_len = value_len;
+            }
+            break;
+        case ADV_TYPE_UUID128_INCMPL:
+        case ADV_TYPE_UUID128_CMPL:
+            if (!fields->uuid128 || type == ADV_TYPE_UUID128_CMPL) {
+                fields->uuid128 = value;
+                fields->uuid128_len = value_len;
+            }
+            break;
+        case ADV_TYPE_NAME_SHORT:
+            if (!fields->name) {
+                fields->name = value;
+                fields->name_len = value_len;
+                short_name = true;
+            }
+            break;
+        case ADV_TYPE_NAME_CMPL:
+            if (!fields->name || short_name) {
+                fields->name = value;
+                fields->name_len = value_len;
+                short_name = false;
+            }
+            break;
+        case ADV_TYPE_MANUFACTURER:
+            if (!fields->mfg_data) {
+                fields->mfg_data = value;
+                fields->mfg_len = value_len;
+            }
+            break;
+        default:
+            break;
+        }
+        pos += 1U + field_len;
+    }
+    return true;
+}
+
+uint16_t adv_first_uuid16(const adv_fields_t *fields)
+{
+    if (fields->uuid16_len < 2) return 0;
+    return fields->uuid16[0] | (fields->uuid16[1] << 8);
+}
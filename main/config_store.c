@@ -0,0 +1,325 @@
+#include "config_store.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#define CONFIG_STORE_KEY "config"
+#define CONFIG_STORE_SLOTS 2    // one per subsystem (gatt, mqtt)
+#define CONFIG_STORE_QUIET_US ((int64_t)CONFIG_BTHUB_CONFIG_FLUSH_QUIET_MS * 1000)
+#define CONFIG_STORE_MAX_DELAY_US ((int64_t)CONFIG_BTHUB_CONFIG_FLUSH_MAX_MS * 1000)
+#define CONFIG_STORE_RETRIES 3  // failed writes of one copy before it is given up
+#define CONFIG_STORE_RETRY_US ((int64_t)2000 * 1000) // times the attempt number
+#define CONFIG_STORE_STACK_SIZE 3072
+#define CONFIG_STORE_PRIORITY 2 // below the device actor, flash writes can wait
+
+static const char *TAG = "CONFIG";
+
+/* latest unwritten copy of one namespace */
+typedef struct {
+    char ns[NVS_KEY_NAME_MAX_SIZE]; // empty while the slot is unused
+    uint8_t version;
+    bool dirty;
+    uint8_t failures;   // failed writes of the current copy
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+} config_slot_t;
+
+static struct {
+    SemaphoreHandle_t lock;     // held across the NVS writes as well
+    esp_timer_handle_t timer;   // wakes the writer task
+    TaskHandle_t task;          // runs the timed flushes
+    int64_t first_pending_us;   // when the oldest unwritten change came in, 0 if none
+    config_slot_t slots[CONFIG_STORE_SLOTS];
+    config_store_stats_t stats;
+} store;
+
+/* on-flash header, the payload follows */
+typedef struct {
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t len;   // payload size
+} __attribute__((packed)) config_blob_header_t;
+
+/**
+ * @brief run the migration hook and keep its result
+ */
+static esp_err_t config_store_migrate(const char *ns, uint8_t from, uint8_t version, const uint8_t *old,
+                                      size_t old_len, void *data, size_t *len,
+                                      config_store_migrate_cb_t migrate)
+{
+    if (!migrate) return from ? ESP_ERR_INVALID_VERSION : ESP_ERR_NVS_NOT_FOUND;
+
+    esp_err_t err = migrate(from, old, old_len, data, len);
+    if (err != ESP_OK) return err;
+
+    ESP_LOGI(TAG, "%s: config migrated from schema %d to %d", ns, from, version);
+    esp_err_t save_err = config_store_save(ns, version, data, *len);
+    if (save_err != ESP_OK) {
+        // still usable, migration runs again on next boot
+        ESP_LOGW(TAG, "%s: failed to save migrated config (%s)", ns, esp_err_to_name(save_err));
+    }
+    return ESP_OK;
+}
+
+esp_err_t config_store_load(const char *ns, uint8_t version, void *data, size_t *len,
+                            config_store_migrate_cb_t migrate)
+{
+    nvs_handle_t handle;
+    size_t blob_len = 0;
+    esp_err_t err = nvs_open(ns, NVS_READONLY, &handle);
+    if (err == ESP_OK) {
+        err = nvs_get_blob(handle, CONFIG_STORE_KEY, NULL, &blob_len);
+        if (err != ESP_OK) nvs_close(handle);
+    }
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return config_store_migrate(ns, 0, version, NULL, 0, data, len, migrate);
+    }
+    if (err != ESP_OK) return err;
+
+    uint8_t *blob = malloc(blob_len);
+    if (!blob) {
+        nvs_close(handle);
+        return ESP_ERR_NO_MEM;
+    }
+    err = nvs_get_blob(handle, CONFIG_STORE_KEY, blob, &blob_len);
+    nvs_close(handle);
+
+    config_blob_header_t header = {0};
+    if (err == ESP_OK) {
+        if (blob_len >= sizeof(header)) {
+            memcpy(&header, blob, sizeof(header));
+        }
+        if (blob_len < sizeof(header) || header.len != blob_len - sizeof(header)) {
+            err = ESP_ERR_INVALID_SIZE;
+        }
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "%s: stored config unreadable (%s)", ns, esp_err_to_name(err));
+        free(blob);
+        return err;
+    }
+
+    const uint8_t *payload = blob + sizeof(header);
+    if (header.version == version) {
+        if (header.len > *len) {
+            err = ESP_ERR_INVALID_SIZE;
+        } else {
+            memcpy(data, payload, header.len);
+            *len = header.len;
+        }
+    } else if (header.version > version) {
+        ESP_LOGW(TAG, "%s: config schema %d is newer than %d", ns, header.version, version);
+        err = ESP_ERR_INVALID_VERSION;
+    } else {
+        err = config_store_migrate(ns, header.version, version, payload, header.len, data, len, migrate);
+    }
+    free(blob);
+    return err;
+}
+
+esp_err_t config_store_save(const char *ns, uint8_t version, const void *data, size_t len)
+{
+    if (len > UINT16_MAX) return ESP_ERR_INVALID_SIZE;
+
+    uint8_t *blob = malloc(sizeof(config_blob_header_t) + len);
+    if (!blob) return ESP_ERR_NO_MEM;
+
+    config_blob_header_t header = {
+        .version = version,
+        .len = (uint16_t)len,
+    };
+    memcpy(blob, &header, sizeof(header));
+    memcpy(blob + sizeof(header), data, len);
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(ns, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, CONFIG_STORE_KEY, blob, sizeof(header) + len);
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    free(blob);
+    return err;
+}
+
+/**
+ * @brief slot holding the namespace, a free one if it has none yet
+ */
+static config_slot_t *config_store_slot(const char *ns)
+{
+    config_slot_t *free_slot = NULL;
+    for (int i = 0; i < CONFIG_STORE_SLOTS; i++) {
+        config_slot_t *slot = &store.slots[i];
+        if (strcmp(slot->ns, ns) == 0) return slot;
+        if (!free_slot && slot->ns[0] == '\0') free_slot = slot;
+    }
+    if (free_slot) {
+        strncpy(free_slot->ns, ns, sizeof(free_slot->ns) - 1);
+    }
+    return free_slot;
+}
+
+/**
+ * @brief the quiet period or a retry delay ended. Only wakes the writer: an
+ * NVS commit can take tens of ms erasing a page and would hold up every
+ * other esp_timer callback.
+ */
+static void config_store_timer_cb(void *arg)
+{
+    xTaskNotifyGive(store.task);
+}
+
+static void config_store_task(void *arg)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        config_store_flush();
+    }
+}
+
+esp_err_t config_store_init(void)
+{
+    if (store.lock) return ESP_OK;
+
+    store.lock = xSemaphoreCreateMutex();
+    if (!store.lock) return ESP_ERR_NO_MEM;
+
+    const esp_timer_create_args_t args = {
+        .callback = config_store_timer_cb,
+        .name = "config_flush",
+    };
+    esp_err_t err = esp_timer_create(&args, &store.timer);
+    if (err != ESP_OK) {
+        vSemaphoreDelete(store.lock);
+        store.lock = NULL;
+        return err;
+    }
+    if (xTaskCreate(config_store_task, "config_flush", CONFIG_STORE_STACK_SIZE, NULL,
+                    CONFIG_STORE_PRIORITY, &store.task) != pdPASS) {
+        esp_timer_delete(store.timer);
+        vSemaphoreDelete(store.lock);
+        store.lock = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    // esp_restart runs the handlers, a pending change survives a reboot from the UI
+    err = esp_register_shutdown_handler(config_store_flush);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Pending config is lost on restart (%s)", esp_err_to_name(err));
+    }
+    return ESP_OK;
+}
+
+esp_err_t config_store_save_deferred(const char *ns, uint8_t version, const void *data, size_t len)
+{
+    if (!store.lock) return config_store_save(ns, version, data, len);
+    if (len > UINT16_MAX || strlen(ns) >= NVS_KEY_NAME_MAX_SIZE) return ESP_ERR_INVALID_ARG;
+
+    xSemaphoreTake(store.lock, portMAX_DELAY);
+    config_slot_t *slot = config_store_slot(ns);
+    if (!slot) {
+        xSemaphoreGive(store.lock);
+        ESP_LOGW(TAG, "%s: no deferred slot left, writing now", ns);
+        return config_store_save(ns, version, data, len);
+    }
+    if (slot->cap < len) {
+        uint8_t *buf = realloc(slot->data, len);
+        if (!buf) {
+            xSemaphoreGive(store.lock);
+            return ESP_ERR_NO_MEM;
+        }
+        slot->data = buf;
+        slot->cap = len;
+    }
+    memcpy(slot->data, data, len);
+    slot->len = len;
+    slot->version = version;
+    slot->failures = 0;
+
+    store.stats.requests++;
+    if (slot->dirty) {
+        store.stats.avoided++;
+    } else {
+        slot->dirty = true;
+        store.stats.pending++;
+    }
+
+    // restart the quiet period, but don't let a stream of edits hold the write back forever
+    int64_t now = esp_timer_get_time();
+    if (store.first_pending_us == 0) store.first_pending_us = now;
+    int64_t deadline = now + CONFIG_STORE_QUIET_US;
+    if (deadline > store.first_pending_us + CONFIG_STORE_MAX_DELAY_US) {
+        deadline = store.first_pending_us + CONFIG_STORE_MAX_DELAY_US;
+    }
+    esp_timer_stop(store.timer); // not running is fine
+    esp_err_t err = esp_timer_start_once(store.timer, deadline > now ? (uint64_t)(deadline - now) : 1);
+    xSemaphoreGive(store.lock);
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "%s: flush timer not armed (%s), writing now", ns, esp_err_to_name(err));
+        config_store_flush();
+    }
+    return ESP_OK;
+}
+
+void config_store_flush(void)
+{
+    if (!store.lock) return;
+
+    xSemaphoreTake(store.lock, portMAX_DELAY);
+    esp_timer_stop(store.timer);
+    store.first_pending_us = 0;
+    uint8_t retry = 0;
+    for (int i = 0; i < CONFIG_STORE_SLOTS; i++) {
+        config_slot_t *slot = &store.slots[i];
+        if (!slot->dirty) continue;
+
+        esp_err_t err = config_store_save(slot->ns, slot->version, slot->data, slot->len);
+        if (err == ESP_OK) {
+            store.stats.commits++;
+        } else {
+            store.stats.failures++;
+            if (++slot->failures < CONFIG_STORE_RETRIES) {
+                // keep the copy, the timer writes it again
+                ESP_LOGW(TAG, "%s: failed to save config (%s), retrying", slot->ns, esp_err_to_name(err));
+                if (slot->failures > retry) retry = slot->failures;
+                continue;
+            }
+            // runtime state keeps the change, the next save retries
+            ESP_LOGE(TAG, "%s: failed to save config (%s), giving up", slot->ns, esp_err_to_name(err));
+        }
+        slot->dirty = false;
+        slot->failures = 0;
+        store.stats.pending--;
+    }
+    if (retry) {
+        store.first_pending_us = esp_timer_get_time();
+        esp_err_t err = esp_timer_start_once(store.timer, (uint64_t)(CONFIG_STORE_RETRY_US * retry));
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Retry timer not armed (%s)", esp_err_to_name(err));
+        }
+    }
+    xSemaphoreGive(store.lock);
+}
+
+void config_store_get_stats(config_store_stats_t *stats)
+{
+    if (!store.lock) {
+        *stats = (config_store_stats_t){0};
+        return;
+    }
+    xSemaphoreTake(store.lock, portMAX_DELAY);
+    *stats = store.stats;
+    xSemaphoreGive(store.lock);
+}
@@ -0,0 +1,120 @@
+#include "conn_params.h"
+
+#include "sdkconfig.h"
+
+#define CONN_PARAMS_RETRY_MS 30000 // a refused update isn't requested again before
+#define IDLE_AFTER_US       ((int64_t)CONFIG_BTHUB_CONN_IDLE_AFTER_MS * 1000)
+#define RETRY_US            ((int64_t)CONN_PARAMS_RETRY_MS * 1000)
+
+/* intervals in 1.25 ms units, supervision timeout in 10 ms units */
+#define FAST_INTERVAL_MIN   6       // 7.5 ms, the lowest BLE allows
+#define FAST_INTERVAL_MAX   (CONFIG_BTHUB_CONN_FAST_INTERVAL_MS * 4 / 5)
+#define FAST_TIMEOUT        200     // 2 s
+#define IDLE_INTERVAL_MAX   (CONFIG_BTHUB_CONN_IDLE_INTERVAL_MS * 4 / 5)
+#define IDLE_INTERVAL_MIN   (IDLE_INTERVAL_MAX * 3 / 4)
+#define IDLE_LATENCY        CONFIG_BTHUB_CONN_IDLE_LATENCY
+#define TIMEOUT_MAX         3200    // 32 s, the highest BLE allows
+
+static const char *const mode_names[CONN_PARAMS_MODE_COUNT] = {
+    [CONN_PARAMS_DEFAULT] = "default",
+    [CONN_PARAMS_FAST] = "fast",
+    [CONN_PARAMS_IDLE] = "idle",
+};
+
+/**
+ * @brief may the mode the traffic asks for be requested now
+ */
+static bool change_due(const conn_params_t *cp, int64_t now_us)
+{
+    if (cp->requested != cp->mode || cp->wanted == cp->mode) return false;
+    return cp->refused_us == 0 || now_us - cp->refused_us >= RETRY_US;
+}
+
+const char *conn_params_mode_name(conn_params_mode_t mode)
+{
+    return mode < CONN_PARAMS_MODE_COUNT ? mode_names[mode] : "?";
+}
+
+void conn_params_opened(conn_params_t *cp, uint16_t interval, uint16_t latency, uint16_t timeout, int64_t now_us)
+{
+    cp->mode = CONN_PARAMS_DEFAULT;
+    cp->requested = CONN_PARAMS_DEFAULT;
+    cp->wanted = CONN_PARAMS_DEFAULT;
+    cp->interval = interval;
+    cp->latency = latency;
+    cp->timeout = timeout;
+    cp->active_us = now_us; // a link opened without commands goes idle too
+    cp->refused_us = 0;
+}
+
+conn_params_mode_t conn_params_activity(conn_params_t *cp, int64_t now_us)
+{
+    if (IDLE_AFTER_US == 0) return CONN_PARAMS_MODE_COUNT;
+
+    cp->active_us = now_us;
+    cp->wanted = CONN_PARAMS_FAST;
+    return change_due(cp, now_us) ? CONN_PARAMS_FAST : CONN_PARAMS_MODE_COUNT;
+}
+
+int64_t conn_params_due_us(const conn_params_t *cp)
+{
+    if (IDLE_AFTER_US == 0 || cp->requested != cp->mode) return 0;
+
+    if (cp->wanted != cp->mode) {
+        // activity during an update or after a refusal, retry when allowed
+        int64_t retry_us = cp->refused_us ? cp->refused_us + RETRY_US : 0;
+        return retry_us > cp->active_us ? retry_us : cp->active_us;
+    }
+    if (cp->wanted != CONN_PARAMS_IDLE) return cp->active_us + IDLE_AFTER_US;
+    return 0;
+}
+
+conn_params_mode_t conn_params_service(conn_params_t *cp, int64_t now_us)
+{
+    if (IDLE_AFTER_US == 0) return CONN_PARAMS_MODE_COUNT;
+
+    if (cp->wanted != CONN_PARAMS_IDLE && now_us - cp->active_us >= IDLE_AFTER_US) {
+        cp->wanted = CONN_PARAMS_IDLE;
+    }
+    return change_due(cp, now_us) ? (conn_params_mode_t)cp->wanted : CONN_PARAMS_MODE_COUNT;
+}
+
+void conn_params_requested(conn_params_t *cp, conn_params_mode_t mode)
+{
+    cp->requested = (uint8_t)mode;
+}
+
+void conn_params_updated(conn_params_t *cp, bool ok, uint16_t interval, uint16_t latency, uint16_t timeout,
+                         int64_t now_us)
+{
+    if (!ok) {
+        cp->requested = cp->mode;
+        cp->refused_us = now_us;
+        cp->refusals++;
+        return;
+    }
+    // an update the lamp started itself keeps the mode, only the values change
+    cp->mode = cp->requested;
+    cp->interval = interval;
+    cp->latency = latency;
+    cp->timeout = timeout;
+    cp->refused_us = 0;
+    cp->updates++;
+}
+
+void conn_params_fill(conn_params_mode_t mode, esp_ble_conn_update_params_t *params)
+{
+    if (mode == CONN_PARAMS_FAST) {
+        params->min_int = FAST_INTERVAL_MIN;
+        params->max_int = FAST_INTERVAL_MAX > FAST_INTERVAL_MIN ? FAST_INTERVAL_MAX : FAST_INTERVAL_MIN;
+        params->latency = 0;
+        params->timeout = FAST_TIMEOUT;
+        return;
+    }
+    params->min_int = IDLE_INTERVAL_MIN > FAST_INTERVAL_MIN ? IDLE_INTERVAL_MIN : FAST_INTERVAL_MIN;
+    params->max_int = IDLE_INTERVAL_MAX;
+    params->latency = IDLE_LATENCY;
+    // the link has to survive a few skipped events: timeout > 2 * (1 + latency) * interval
+    uint32_t timeout = (uint32_t)(1 + IDLE_LATENCY) * IDLE_INTERVAL_MAX * 125 * 3 / 1000 + 100;
+    params->timeout = (uint16_t)(timeout < TIMEOUT_MAX ? timeout : TIMEOUT_MAX);
+}
@@ -0,0 +1,94 @@
+#include "conn_sched.h"
+
+#include <string.h>
+
+void conn_sched_init(conn_sched_t *sched)
+{
+    memset(sched, 0, sizeof(*sched));
+    memset(sched->prio, CONN_PRIO_NONE, sizeof(sched->prio));
+    sched->opening = -1;
+}
+
+void conn_sched_request(conn_sched_t *sched, int device, conn_prio_t prio)
+{
+    if (device < 0 || device >= CONN_SCHED_MAX_DEVICES || prio >= CONN_PRIO_COUNT) return;
+
+    if (sched->prio[device] == CONN_PRIO_NONE) {
+        sched->order[device] = sched->seq++;
+        sched->queued++;
+        if (sched->queued > sched->queued_peak) sched->queued_peak = sched->queued;
+    } else if (sched->prio[device] <= prio) {
+        return; // already queued as urgent or more
+    }
+    sched->prio[device] = (uint8_t)prio;
+}
+
+void conn_sched_cancel(conn_sched_t *sched, int device)
+{
+    if (device < 0 || device >= CONN_SCHED_MAX_DEVICES) return;
+    if (sched->prio[device] == CONN_PRIO_NONE) return;
+    sched->prio[device] = CONN_PRIO_NONE;
+    sched->queued--;
+}
+
+conn_prio_t conn_sched_priority(const conn_sched_t *sched, int device)
+{
+    if (device < 0 || device >= CONN_SCHED_MAX_DEVICES) return CONN_PRIO_NONE;
+    return (conn_prio_t)sched->prio[device];
+}
+
+bool conn_sched_busy(const conn_sched_t *sched)
+{
+    return sched->opening != -1;
+}
+
+int conn_sched_next(const conn_sched_t *sched, int count, conn_sched_ready_fn ready, void *ctx)
+{
+    if (sched->opening != -1 || sched->queued == 0) return -1;
+    if (count > CONN_SCHED_MAX_DEVICES) count = CONN_SCHED_MAX_DEVICES;
+
+    for (int prio = 0; prio < CONN_PRIO_COUNT; prio++) {
+        int best = -1;
+        for (int i = 0; i < count; i++) {
+            if (sched->prio[i] != prio) continue;
+            // sequence numbers wrap, compare by distance
+            if (best >= 0 && (int32_t)(sched->order[i] - sched->order[best]) >= 0) continue;
+            if (ready && !ready(i, (conn_prio_t)prio, ctx)) continue;
+            best = i;
+        }
+        if (best >= 0) return best;
+    }
+    return -1;
+}
+
+void conn_sched_opening(conn_sched_t *sched, int device)
+{
+    conn_prio_t prio = conn_sched_priority(sched, device);
+    if (prio < CONN_PRIO_COUNT) sched->opens[prio]++;
+    conn_sched_cancel(sched, device);
+    sched->opening = (int16_t)device;
+}
+
+void conn_sched_opened(conn_sched_t *sched, int device)
+{
+    if (sched->opening == device) sched->opening = -1;
+}
+
+void conn_sched_drop(conn_sched_t *sched, int device)
+{
+    conn_sched_cancel(sched, device);
+    if (device >= 0 && sched->opening == device) sched->opening = CONN_SCHED_DROPPED;
+}
+
+void conn_sched_move(conn_sched_t *sched, int from, int to)
+{
+    if (from == to || from < 0 || to < 0 || from >= CONN_SCHED_MAX_DEVICES || to >= CONN_SCHED_MAX_DEVICES) return;
+
+    conn_sched_cancel(sched, to);
+    if (sched->prio[from] != CONN_PRIO_NONE) {
+        sched->prio[to] = sched->prio[from];
+        sched->order[to] = sched->order[from];
+        sched->prio[from] = CONN_PRIO_NONE; // queued count is unchanged
+    }
+    if (sched->opening == from) sched->opening = (int16_t)to;
+}
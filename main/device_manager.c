@@ -1,4 +1,18 @@
 #include "device_manager.h"
+#include "device_registry.h"
+#include "light_cmd.h"
+#include "gatt_cache.h"
+#include "scan_scheduler.h"
+#include "adv_parser.h"
+#include "adv_filter.h"
+#include "reject_cache.h"
+#include "config_store.h"
+#include "latency.h"
+#include "trace.h"
+#include "reconnect.h"
+#include "conn_params.h"
+#include "conn_sched.h"
+#include "write_pipe.h"
 
 #include "esp_log.h"
 #include "nvs.h"
@@ -10,36 +24,78 @@
 #include "esp_gap_ble_api.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_gatt_defs.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
 
-#define MAX_DEVICES 8  // max number of devices
-#define CMD_MAX_LEN 12 //  max length of w_cmd
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define MAX_DEVICES CONFIG_BTHUB_MAX_DEVICES  // max number of devices
+#define MAX_CONNECTIONS CONFIG_BTHUB_MAX_CONNECTIONS // connection pool size
+#define CMD_QUEUE_LEN 4 // pending ops per device (one per opcode + spare)
 #define INVALID_HANDLE   0
 
+#define ACTOR_QUEUE_LEN 32
+#define ACTOR_QUEUE_RESERVE 8 // slots adverts and notifications may not take, link events always fit
+#define ACTOR_STACK_SIZE 4096
+#define ACTOR_PRIORITY 5
+#define ACTOR_POST_TIMEOUT_MS 100 // how long API callers wait for queue space
+#define ACTOR_PUBLISH_EVERY 8 // republish the reader snapshot at least every N messages under load
+#ifdef CONFIG_BT_BLUEDROID_PINNED_TO_CORE
+#define ACTOR_CORE CONFIG_BT_BLUEDROID_PINNED_TO_CORE // same core as the Bluedroid host
+#else
+#define ACTOR_CORE 0
+#endif
+#define SEQ_READ_SPINS 16 // snapshot reader spins before it yields to the writer
+#define NOTIFY_COPY_MAX 32 // notification bytes kept, lamp state reports are shorter
+#define PENDING_SEND_DELAY_MS 300 // lamps ignore writes sent right after discovery
+#define NOTIFY_REG_NONE -1  // no register_for_notify outstanding
+#define NOTIFY_REG_ORPHAN -2 // the outstanding registration's device was dropped
+#define SCAN_PAUSE_RETRY_MS 1000 // recheck interval while scanning is paused for GATT traffic
+#define LATENCY_TRACE_TIMEOUT_US (5 * 1000 * 1000) // a command without notification stops being traced
+#define RESET_TIMEOUT_US (2 * 1000 * 1000) // links a device list reset closes are given up on after
+#define DISCOVERY_TIMEOUT_US (10 * 1000 * 1000) // link open to write handle, the link is closed after
+#ifdef CONFIG_BTHUB_SCAN_WHITELIST
+#define OPEN_SCAN_EVERY CONFIG_BTHUB_OPEN_SCAN_EVERY // one open scan per N scans while devices are missing
+#endif
+
 static const char *NVS = "gatt";
 
 static const char *TAG = "GATT";
 
-static uint8_t w_cmd[CMD_MAX_LEN]; // default write cmd
-
 /* Single structure for each device - combines device and profile */
 typedef struct {
     // Device identification
     esp_bd_addr_t mac_address;
     char name[32];
     uint16_t service_uuid;
+    uint8_t adv[ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX]; // adv data + scan response,
+    uint8_t adv_len;                                                        // re-checked on filter changes
     
     // Connection state
     bool connected;
+    bool connecting;        // open requested, waiting for ESP_GATTC_OPEN_EVT
+    bool evicting;          // close requested by the connection pool
+    bool open_abandoned;    // connect timed out, its late ESP_GATTC_OPEN_EVT failure is not counted
+    bool offline;           // reported unavailable, the breaker opened
+    reconnect_t reconnect;  // connect deadline, backoff and breaker
+    conn_params_t conn_params; // interval in effect, fast while commanded
+    TickType_t last_used;   // last command, LRU order for eviction
 
     // State reporting
     bool power_state;
     int8_t rssi;
+    ble_link_stats_t link;      // published with the device record
+    uint32_t connect_ms_total;  // for link.connect_avg_ms
 
-    // Command queue 
-    uint8_t pending_cmd[CMD_MAX_LEN];
-    uint8_t pending_cmd_len;
-    bool has_pending;
+    // Command queue (ring, newest op per opcode wins)
+    light_op_t pending_ops[CMD_QUEUE_LEN];
+    uint8_t pending_head;
+    uint8_t pending_count;
+    write_pipe_t write_pipe;    // framed writes of the open link, credit based
 
     // GATT profile state
     uint16_t conn_id;
@@ -47,27 +103,57 @@ typedef struct {
     uint16_t service_end_handle;
     uint16_t char_handle;
     uint16_t write_char_handle;  
+    uint16_t cccd_handle;
+    bool handles_cached; // handles known from gatt_cache, discovery can be skipped
+    int64_t discovery_due_us; // discovery running, handles expected until then, 0 if not
+    bool discovery_failed;  // no usable handles on this link, it is being closed
+    bool notify_reg_waiting; // waits for the outstanding notify registration of another lamp
 
     // App ID (index-based)
     uint8_t app_id;
+
+    // latency trace of the oldest unanswered command, stage start times in us
+    int8_t lat_slot;        // per-device histograms, -1 if none
+    int64_t lat_rx_us;      // MQTT receive, 0 while nothing is traced
+    int64_t lat_picked_us;  // picked up by the actor
+    int64_t lat_write_us;   // first write issued
+    int64_t lat_connect_us; // connect started
+    int64_t lat_open_us;    // link opened
 } flood_light_device_t;
 
 static struct {
     bool by_name; //filter by name?
-    char remote_device_name[32];
     bool by_uuid;
-    uint16_t remote_service_uuid;
+    adv_filter_t filter;    // name/uuid/company patterns, flags mirrored from by_name/by_uuid
     bool scanning;
+    bool scan_paused;       // scan postponed until GATT traffic settles
     uint8_t scan_interval;
     uint8_t scan_duration;
+    uint8_t scan_run_s;     // duration of the scan being started
+    uint8_t scan_left_s;    // rest of a yielded scan, 0 to start a new one
+    int64_t scan_started_us;
+    uint8_t tx_power;       // esp_power_level_t value applied to the controller
+    uint16_t mtu;           // local MTU offered to the lamps
     TimerHandle_t scan_timer;  
+    scan_profile_id_t scan_profile_applied; // profile loaded into the controller
+    bool scan_whitelist_applied;            // controller filters on the accept list
+    uint8_t scan_found_at_start;
+    uint8_t scans_since_open;   // whitelist scans since the last open scan
+    uint8_t whitelist_size;     // known devices in the accept list, counted from the completion events
+    bool whitelist_failed;      // accept list incomplete, whitelist scans disabled
+    uint32_t scan_pauses;
+    uint32_t scan_yields;       // running scans stopped for GATT traffic
+    int64_t scan_held_since_us; // scanning held back since, 0 if not
+    uint64_t scan_held_us;      // total time scanning was held back
     uint16_t gattc_if;
+    int16_t notify_reg_device;  // device of the outstanding register_for_notify, NOTIFY_REG_*
     flood_light_device_t devices[MAX_DEVICES];
 
     // connection tracking
     bool all_devices_found;
     uint8_t discovered_count;
     uint8_t conn_count; // number of active connections
+    int64_t reset_due_us;   // a device list reset waits for its links until, 0 if none
 
     // Callbacks
     device_found_cb_t device_found_cb;
@@ -75,17 +161,21 @@ static struct {
     device_connected_cb_t device_connected_cb;
     device_disconnected_cb_t device_disconnected_cb;
     device_power_state_cb_t device_power_state_cb;
+    device_availability_cb_t device_availability_cb;
 } device_manager = {
     .by_name = false,
-    .remote_device_name = {0},
     .by_uuid = false,
-    .remote_service_uuid = 0,
     .scanning = false,
+    .scan_paused = false,
+    .scan_profile_applied = SCAN_PROFILE_COUNT,
     .scan_interval = 5,  // in s
     .scan_duration = 15,
+    .tx_power = 4,
+    .mtu = 158,
     .scan_timer = NULL,
     .all_devices_found = false,
     .gattc_if = ESP_GATT_IF_NONE,
+    .notify_reg_device = NOTIFY_REG_NONE,
     .discovered_count = 0,
     .conn_count = 0,
     .device_found_cb = NULL,
@@ -95,18 +185,193 @@ static struct {
 };
 
 /**
- * @brief gatt config type (what are we going to set/load)
+ * @brief device actor messages, stack events and calls from other tasks
  */
 typedef enum {
-    GATT_CONFIG_DEVICE_NAME,
-    GATT_CONFIG_BY_NAME,
-    GATT_CONFIG_BLE_POWER,
-    GATT_CONFIG_BLE_INTERVAL,
-    GATT_CONFIG_BLE_DURATION,
-    GATT_CONFIG_MTU,
-    GATT_CONFIG_BY_UUID,
-    GATT_CONFIG_SERVICE_UUID,
-} gatt_config_type_t;
+    ACTOR_MSG_GATTC,        // Bluedroid GATTC event
+    ACTOR_MSG_GAP,          // Bluedroid GAP event
+    ACTOR_MSG_SCAN_TIMER,   // rest between scans is over
+    ACTOR_MSG_COMMAND,      // light command from MQTT
+    ACTOR_MSG_CALL,         // run a function on the actor, the caller waits
+} actor_msg_type_t;
+
+/* GATTC event copied out of the BTC callback */
+typedef struct {
+    esp_gattc_cb_event_t event;
+    esp_gatt_if_t gattc_if;
+    esp_ble_gattc_cb_param_t param;
+    uint8_t value[NOTIFY_COPY_MAX]; // notify payload, param.notify.value points here
+} actor_gattc_evt_t;
+
+/* GAP event copied out of the BTC callback, only the fields the actor uses */
+typedef struct {
+    esp_gap_ble_cb_event_t event;
+    esp_bt_status_t status;
+    esp_gap_search_evt_t search_evt;
+    esp_ble_wl_operation_t wl_operation;
+    esp_ble_evt_type_t ble_evt_type;
+    esp_bd_addr_t bda;
+    uint16_t conn_int;      // connection parameter update
+    uint16_t latency;
+    uint16_t timeout;
+    int8_t rssi;
+    uint8_t adv_data_len;
+    uint8_t scan_rsp_len;
+    uint8_t adv[ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX];
+} actor_gap_evt_t;
+
+typedef struct {
+    actor_msg_type_t type;
+    int64_t posted_us;
+    union {
+        actor_gattc_evt_t gattc;
+        actor_gap_evt_t gap;
+        struct {
+            esp_bd_addr_t mac;
+            light_op_t op;
+            int64_t rx_us;  // MQTT receive time, 0 if unknown
+        } command;
+        struct {
+            void (*fn)(void *arg);
+            void *arg;
+            SemaphoreHandle_t done;
+        } call;
+    };
+} actor_msg_t;
+
+/* device actor task, the only task touching device_manager, the registry and the caches */
+static struct {
+    QueueHandle_t queue;
+    TaskHandle_t task;
+    bool send_armed[MAX_DEVICES];
+    TickType_t send_at[MAX_DEVICES];
+
+    // queue and service counters
+    uint8_t queue_peak;
+    uint32_t processed;
+    atomic_uint dropped;        // posted from other tasks
+    uint64_t wait_us_total;
+    uint32_t wait_us_max;
+    uint64_t service_us_total;
+    uint32_t service_us_max;
+} device_actor = {0};
+
+/* state seen by the getters. The actor is the only writer, each part is
+ * guarded by a sequence counter that is odd while the actor writes it. */
+static struct {
+    atomic_uint devices_seq;
+    ble_devices_t devices;
+    atomic_uint stats_seq;
+    ble_stats_t stats;
+} snapshot = {0};
+
+static void seq_write_begin(atomic_uint *seq)
+{
+    atomic_fetch_add_explicit(seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void seq_write_end(atomic_uint *seq)
+{
+    atomic_fetch_add_explicit(seq, 1, memory_order_release);
+}
+/**
+ * @brief wait until no write is in progress
+ * @return sequence to hand to seq_read_retry
+ */
+static unsigned seq_read_begin(atomic_uint *seq)
+{
+    unsigned start;
+    int spins = 0;
+    while ((start = atomic_load_explicit(seq, memory_order_acquire)) & 1) {
+        // the actor may be preempted mid write, let it finish
+        if (++spins >= SEQ_READ_SPINS) {
+            vTaskDelay(1);
+            spins = 0;
+        }
+    }
+    return start;
+}
+/**
+ * @brief did the actor write while the reader copied?
+ */
+static bool seq_read_retry(atomic_uint *seq, unsigned start)
+{
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(seq, memory_order_relaxed) != start;
+}
+
+/**
+ * @brief hand a message to the device actor
+ * @param wait ticks to wait for queue space, 0 from the BTC and timer tasks
+ * @param reserve free slots that must remain, lossy events leave room for link events
+ */
+static bool actor_post(actor_msg_t *msg, TickType_t wait, UBaseType_t reserve)
+{
+    if (device_actor.queue == NULL) return false;
+
+    if (reserve && uxQueueSpacesAvailable(device_actor.queue) <= reserve) {
+        atomic_fetch_add(&device_actor.dropped, 1);
+        return false;
+    }
+    msg->posted_us = esp_timer_get_time();
+    if (xQueueSend(device_actor.queue, msg, wait) != pdTRUE) {
+        atomic_fetch_add(&device_actor.dropped, 1);
+        return false;
+    }
+    return true;
+}
+
+/* connection pool counters, links are capped at MAX_CONNECTIONS */
+static struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+} conn_pool = {0};
+
+/* opens waiting for the stack, one runs at a time */
+static conn_sched_t conn_sched;
+
+/* links of devices no longer in the table, each keeps its pool slot until
+ * its close event. Matched by MAC: an open that never completed has no
+ * conn_id, and a lamp found again meanwhile must not take the events. */
+static struct {
+    esp_bd_addr_t mac[MAX_CONNECTIONS];
+    bool opening[MAX_CONNECTIONS]; // cancelled open, the scheduler waits for its OPEN or DISCONNECT event
+    uint8_t count;
+} closing_links;
+
+/* reconnect policy counters */
+static struct {
+    uint32_t timeouts;      // attempts cut off at the connect deadline
+    uint32_t retries;       // failed attempts retried after a backoff
+    uint32_t breaker_trips; // devices declared unreachable
+    uint32_t fast_fails;    // commands failed at once for an unreachable device
+} reconnects = {0};
+
+/* write pipeline counters */
+static struct {
+    uint32_t completed;     // completion events received
+    uint32_t superseded;    // waiting frames replaced by a newer value
+    uint32_t overflows;     // waiting frames dropped, pipeline full
+    uint32_t retries;       // writes sent again after ESP_GATT_CONGESTED
+    uint32_t congestions;   // links that reported congestion
+    uint32_t timeouts;      // credits reclaimed without a completion event
+} write_pipes = {0};
+
+#define GATT_CONFIG_VERSION 1
+
+/* BLE settings as persisted in one blob, runtime copies live in device_manager */
+typedef struct {
+    bool by_name;
+    bool by_uuid;
+    uint8_t tx_power;
+    uint8_t scan_interval;
+    uint8_t scan_duration;
+    uint16_t mtu;
+    uint16_t filter_len;
+    uint8_t filter[ADV_FILTER_BLOB_MAX]; // adv_filter_serialize output, only filter_len bytes are stored
+} gatt_config_t;
 
 /*
 // map esp ble power to int 0-7
@@ -123,127 +388,133 @@ static const esp_power_level_t power_map[8] = {
 */
 // Static functions//////////////////////////////////////////////////////
 /**
- * @brief gatt config keys for nvs
+ * @brief filter patterns from older firmware: a pattern blob of its own, or
+ * a single name and uuid under separate keys before that
  */
-static const char* gatt_config_key(gatt_config_type_t type)
+static void gatt_config_migrate_filter(nvs_handle_t handle, gatt_config_t *config)
 {
-    switch (type) {
-        case GATT_CONFIG_BY_NAME:   return "by_name";
-        case GATT_CONFIG_DEVICE_NAME:   return "device_name";
-        case GATT_CONFIG_BLE_POWER:     return "ble_power";
-        case GATT_CONFIG_BLE_INTERVAL:  return "ble_interval";
-        case GATT_CONFIG_BLE_DURATION:  return "ble_duration";
-        case GATT_CONFIG_MTU:           return "mtu";
-        case GATT_CONFIG_BY_UUID:       return "by_uuid";
-        case GATT_CONFIG_SERVICE_UUID:  return "service_uuid";
-        default:                        return NULL;
+    size_t len = sizeof(config->filter);
+    if (nvs_get_blob(handle, "filters", config->filter, &len) == ESP_OK) {
+        config->filter_len = (uint16_t)len;
+        return;
     }
-}
 
+    // device_manager.filter is not in use yet during init, build the patterns there
+    adv_filter_t *filter = &device_manager.filter;
+    adv_filter_clear(filter);
+
+    char name[ADV_NAME_MAX + 1] = {0};
+    size_t name_len = sizeof(name);
+    if (nvs_get_str(handle, "device_name", name, &name_len) == ESP_OK) {
+        adv_filter_set_names(filter, name);
+    }
+    uint16_t uuid = 0;
+    if (nvs_get_u16(handle, "service_uuid", &uuid) == ESP_OK && uuid != 0) {
+        char text[8];
+        snprintf(text, sizeof(text), "%04X", uuid);
+        adv_filter_set_uuids(filter, text);
+    }
+    config->filter_len = (uint16_t)adv_filter_serialize(filter, config->filter, sizeof(config->filter));
+}
 /**
- * @brief load gatt config from nvs 
-*/
-static esp_err_t gatt_load_config(gatt_config_type_t type, void *val, size_t *len)
+ * @brief import the settings older firmware kept under one key each,
+ * missing keys keep their defaults
+ */
+static esp_err_t gatt_config_migrate(uint8_t version, const uint8_t *old, size_t old_len, void *data, size_t *len)
 {
-    const char *key = gatt_config_key(type);
-    if (!key) return ESP_ERR_INVALID_ARG;
+    if (version != 0) return ESP_ERR_INVALID_VERSION; // no older blob schema yet
 
+    gatt_config_t *config = data;
     nvs_handle_t handle;
-    esp_err_t err = nvs_open(NVS, NVS_READONLY, &handle);
-    if (err != ESP_OK) return err;
-
-    switch (type) {
-        case GATT_CONFIG_BY_NAME:
-        case GATT_CONFIG_BY_UUID:
-            // NVS doesn't support bool so load as uint8_t (0 = false, 1 = true) 
-            uint8_t temp_u8;
-            err = nvs_get_u8(handle, key, &temp_u8);
-            if (err == ESP_OK) {
-                *(bool*)val = (temp_u8 != 0); // Convert to bool
-            }
-            break;
-        case GATT_CONFIG_DEVICE_NAME:
-            err = nvs_get_str(handle, key, (char*)val, len);
-            break;
-
-        case GATT_CONFIG_BLE_POWER:
-        case GATT_CONFIG_BLE_INTERVAL:
-        case GATT_CONFIG_BLE_DURATION:
-            err = nvs_get_u8(handle, key, (uint8_t*)val);
-            break;
-        case GATT_CONFIG_MTU:
-        case GATT_CONFIG_SERVICE_UUID:
-            err = nvs_get_u16(handle, key, (uint16_t*)val);
-            break;
-        default:
-            err = ESP_ERR_INVALID_ARG;
+    if (nvs_open(NVS, NVS_READONLY, &handle) == ESP_OK) {
+        // NVS doesn't support bool, flags were stored as uint8_t
+        uint8_t u8;
+        if (nvs_get_u8(handle, "by_name", &u8) == ESP_OK) config->by_name = (u8 != 0);
+        if (nvs_get_u8(handle, "by_uuid", &u8) == ESP_OK) config->by_uuid = (u8 != 0);
+        if (nvs_get_u8(handle, "ble_power", &u8) == ESP_OK) config->tx_power = u8;
+        if (nvs_get_u8(handle, "ble_interval", &u8) == ESP_OK) config->scan_interval = u8;
+        if (nvs_get_u8(handle, "ble_duration", &u8) == ESP_OK) config->scan_duration = u8;
+        uint16_t u16;
+        if (nvs_get_u16(handle, "mtu", &u16) == ESP_OK) config->mtu = u16;
+        gatt_config_migrate_filter(handle, config);
+        nvs_close(handle);
+    } else {
+        ESP_LOGW(TAG, "No BLE config in NVS, using defaults");
     }
-
-    nvs_close(handle);
-    return err;
+    *len = offsetof(gatt_config_t, filter) + config->filter_len;
+    return ESP_OK;
 }
 /**
- * @brief save gatt config to nvs 
-*/
-static esp_err_t gatt_save_config(gatt_config_type_t type, const void* val)
+ * @brief load the BLE settings blob into the runtime state
+ */
+static void load_gatt_config(void)
 {
-    const char *key = gatt_config_key(type);
-    if (!key) return ESP_ERR_INVALID_ARG;
-
-    nvs_handle_t handle;
-    esp_err_t err = nvs_open(NVS, NVS_READWRITE, &handle);
-    if (err != ESP_OK) return err;
-
-    switch (type) {
-        case GATT_CONFIG_BY_NAME:
-        case GATT_CONFIG_BY_UUID:
-            // NVS doesn't support bool so save as uint8_t (0 = false, 1 = true)
-            uint8_t u8_val = *(bool*)val ? 1 : 0;
-            err = nvs_set_u8(handle, key, u8_val);
-            break;
-        case GATT_CONFIG_DEVICE_NAME:
-            err = nvs_set_str(handle, key, (const char*)val);
-            break;
+    gatt_config_t *config = calloc(1, sizeof(*config)); // ~1.7 KB, kept off the main task stack
+    if (!config) {
+        ESP_LOGE(TAG, "No memory to load BLE config, using defaults");
+        return;
+    }
+    config->by_name = device_manager.by_name;
+    config->by_uuid = device_manager.by_uuid;
+    config->tx_power = device_manager.tx_power;
+    config->scan_interval = device_manager.scan_interval;
+    config->scan_duration = device_manager.scan_duration;
+    config->mtu = device_manager.mtu;
 
-        case GATT_CONFIG_BLE_POWER:
-        case GATT_CONFIG_BLE_INTERVAL:
-        case GATT_CONFIG_BLE_DURATION:
-            err = nvs_set_u8(handle, key, *(uint8_t*)val); // all are uint8_t
-            break;
-        case GATT_CONFIG_MTU:
-        case GATT_CONFIG_SERVICE_UUID:
-            err = nvs_set_u16(handle, key, *(uint16_t*)val);
-            break;
-        default:
-            err = ESP_ERR_INVALID_ARG;
-            break;
+    size_t len = sizeof(*config);
+    esp_err_t err = config_store_load(NVS, GATT_CONFIG_VERSION, config, &len, gatt_config_migrate);
+    if (err == ESP_OK && (len < offsetof(gatt_config_t, filter) ||
+                          config->filter_len > len - offsetof(gatt_config_t, filter))) {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "BLE config not loaded (%s), using defaults", esp_err_to_name(err));
+        free(config);
+        return;
     }
 
-    if (err == ESP_OK) {
-        nvs_commit(handle);
+    device_manager.by_name = config->by_name;
+    device_manager.by_uuid = config->by_uuid;
+    device_manager.tx_power = config->tx_power;
+    device_manager.scan_interval = config->scan_interval;
+    device_manager.scan_duration = config->scan_duration;
+    device_manager.mtu = config->mtu;
+
+    adv_filter_t *filter = &device_manager.filter;
+    adv_filter_clear(filter);
+    if (config->filter_len > 0 &&
+        adv_filter_deserialize(filter, config->filter, config->filter_len) != ESP_OK) {
+        ESP_LOGW(TAG, "Stored filter patterns ignored");
     }
-    nvs_close(handle);
-    return err;
+    free(config);
+
+    ESP_LOGI(TAG, "BLE config: filter by name %s, by uuid %s, %d name(s), %d uuid(s), %d company id(s)",
+             device_manager.by_name ? "ENABLED" : "DISABLED", device_manager.by_uuid ? "ENABLED" : "DISABLED",
+             filter->name_set.count, filter->uuid16_set.count,
+             filter->company_set.count);
 }
 /**
- * @brief Modbus CRC function 
-*/
-static uint16_t crc16_modbus(const uint8_t *data, size_t len)
-{
-    uint16_t crc = 0xFFFF;
-    for (size_t i = 0; i < len; ++i) {
-        crc ^= data[i];
-        for (int bit = 0; bit < 8; ++bit) {
-            if (crc & 0x0001) {
-                crc = (crc >> 1) ^ 0xA001;
-            } else {
-                crc >>= 1;
-            }
-        }
-    }
-    return crc;
+ * @brief persist the runtime BLE settings as one blob, written once edits settle
+ */
+static esp_err_t save_gatt_config(void)
+{
+    gatt_config_t *config = calloc(1, sizeof(*config));
+    if (!config) return ESP_ERR_NO_MEM;
+
+    config->by_name = device_manager.by_name;
+    config->by_uuid = device_manager.by_uuid;
+    config->tx_power = device_manager.tx_power;
+    config->scan_interval = device_manager.scan_interval;
+    config->scan_duration = device_manager.scan_duration;
+    config->mtu = device_manager.mtu;
+    config->filter_len = (uint16_t)adv_filter_serialize(&device_manager.filter, config->filter,
+                                                        sizeof(config->filter));
+
+    esp_err_t err = config_store_save_deferred(NVS, GATT_CONFIG_VERSION, config,
+                                               offsetof(gatt_config_t, filter) + config->filter_len);
+    free(config);
+    return err;
 }
-
 static void decode_notification(int device_index,
                                 const uint8_t *data,
                                 uint16_t len)
@@ -258,33 +529,6 @@ static void decode_notification(int device_index,
         }
     
 }
-/**
- * @brief build the w_cmd
- * @param opcode the command type (0x11 = on/off, 0x13 = brightness 0x17 rbg)
- * @param *payload data
- * @param paylaod_len size of the payload data only not the whole w_cmd
- * @return Total length 
-*/
-static size_t build_cmd(uint8_t opcode, const uint8_t *payload, size_t payload_len)
-{
-    w_cmd[0] = 0xAA;        // header
-    w_cmd[1] = opcode;      // 0x11 = on/off, 0x13 = brightness
-    w_cmd[2] = 3 + payload_len;
-
-    for (size_t i = 0; i < payload_len; i++) {
-        w_cmd[3 + i] = payload[i];
-    }
-    
-    uint16_t crc = crc16_modbus(w_cmd, 3 + payload_len);  // append to end
-    w_cmd[3 + payload_len] = crc & 0xFF;                    // low byte first
-    w_cmd[4 + payload_len] = (crc >> 8) & 0xFF;             // high byte
-
-    size_t pkt_len = 3 + payload_len + 2; // header + payload + crc
-    ESP_LOGD(TAG, "Built command buffer:");
-    ESP_LOG_BUFFER_HEX_LEVEL(TAG, w_cmd, pkt_len, ESP_LOG_DEBUG);
-    if (pkt_len > CMD_MAX_LEN) return 0;
-    return pkt_len;
-}
 static void stop_scan_timer(void)
 {
     if (device_manager.scan_timer != NULL) {
@@ -295,29 +539,78 @@ static void stop_scan_timer(void)
     }
 }
 
-static void start_scan_timer(void)
+static void arm_scan_timer(uint32_t delay_ms)
 {
     if (device_manager.scan_timer != NULL) {
-        xTimerChangePeriod(device_manager.scan_timer, 
-                          pdMS_TO_TICKS(device_manager.scan_interval * 1000), 0);
+        xTimerChangePeriod(device_manager.scan_timer, pdMS_TO_TICKS(delay_ms), 0);
         xTimerStart(device_manager.scan_timer, 0);
-        ESP_LOGD(TAG, "Scan timer restarting scan in %d", device_manager.scan_interval);
+        ESP_LOGD(TAG, "Scan timer restarting scan in %lu ms", (unsigned long)delay_ms);
     }
 }
-static void start_scanning(void)
+
+static void start_scan_timer(void)
 {
-    if (device_manager.scanning) {
-        ESP_LOGI(TAG, "Scanning already in progress");
-        return;
+    arm_scan_timer(scan_scheduler_rest_ms(device_manager.scan_interval));
+}
+/**
+ * @brief GATT work in flight: an open, a discovery within its deadline, or
+ * commands for a link that has its write handle. Missing handles alone
+ * don't count, a link whose discovery failed only waits to close.
+ */
+static bool scan_gatt_busy(void)
+{
+    for (int i = 0; i < device_manager.discovered_count; i++) {
+        const flood_light_device_t *device = &device_manager.devices[i];
+        if (device->connecting) return true;
+        if (!device->connected || device->evicting) continue;
+        if (device->discovery_due_us) return true;
+        if (device->write_char_handle && (device->pending_count || write_pipe_busy(&device->write_pipe))) return true;
     }
-    
-    device_manager.all_devices_found = false;
-    device_manager.scanning = true;
-
-    esp_ble_gap_start_scanning(device_manager.scan_duration);
-    ESP_LOGD(TAG, "Scaning started for %d s", (int)device_manager.scan_duration);
+    return false;
+}
+/**
+ * @brief pause scanning, it is resumed by the scan timer once GATT traffic settles
+ */
+static void pause_scanning(void)
+{
+    if (!device_manager.scan_paused) {
+        device_manager.scan_pauses++;
+        device_manager.scan_held_since_us = esp_timer_get_time();
+    }
+    device_manager.scan_paused = true;
+    arm_scan_timer(SCAN_PAUSE_RETRY_MS);
+}
+/**
+ * @brief scanning is no longer held back, account the time it yielded
+ */
+static void scan_hold_end(void)
+{
+    if (device_manager.scan_held_since_us) {
+        device_manager.scan_held_us += esp_timer_get_time() - device_manager.scan_held_since_us;
+        device_manager.scan_held_since_us = 0;
+    }
+    device_manager.scan_paused = false;
 }
 
+/**
+ * @brief scan only known devices via the controller accept list?
+ * Open scans still run every OPEN_SCAN_EVERY scans while the table has room.
+ */
+static bool whitelist_scan_due(void)
+{
+#ifdef CONFIG_BTHUB_SCAN_WHITELIST
+    if (device_manager.whitelist_failed || device_manager.whitelist_size == 0) return false;
+    if (device_manager.whitelist_size >= MAX_DEVICES) return true;
+
+    if (++device_manager.scans_since_open >= OPEN_SCAN_EVERY) {
+        device_manager.scans_since_open = 0;
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
 static void stop_scanning(void)
 {
     device_manager.scanning = false;
@@ -325,340 +618,1657 @@ static void stop_scanning(void)
     ESP_LOGI(TAG, "Scanning stopped");
 }
 /**
- * @brief ble scan task callback
-*/
-static void scan_timer_cb(TimerHandle_t xTimer)
+ * @brief load a newly discovered device into the controller accept list
+ */
+static void whitelist_add(const esp_bd_addr_t mac)
 {
-    start_scanning();
+#ifdef CONFIG_BTHUB_SCAN_WHITELIST
+    if (device_manager.whitelist_failed) return;
+
+    esp_err_t err = esp_ble_gap_update_whitelist(true, (uint8_t *)mac, BLE_WL_ADDR_TYPE_PUBLIC);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Accept list update failed (%s), using open scans", esp_err_to_name(err));
+        device_manager.whitelist_failed = true;
+    }
+#endif
 }
+/**
+ * @brief drop a device from the controller accept list. The controller
+ * rejects the change while a scan filters on the list, so such a scan is
+ * stopped first, the caller starts scanning again.
+ */
+static void whitelist_remove(const esp_bd_addr_t mac)
+{
+#ifdef CONFIG_BTHUB_SCAN_WHITELIST
+    if (device_manager.whitelist_failed) return;
 
-static bool control_device(int device_index, uint8_t *data, uint8_t length)
-{ 
+    if (device_manager.scanning && device_manager.scan_whitelist_applied) {
+        stop_scanning();
+    }
+    esp_err_t err = esp_ble_gap_update_whitelist(false, (uint8_t *)mac, BLE_WL_ADDR_TYPE_PUBLIC);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Accept list update failed (%s), using open scans", esp_err_to_name(err));
+        device_manager.whitelist_failed = true;
+    }
+#endif
+}
 
-    if (device_index < 0 || device_index >= MAX_DEVICES) {
-        ESP_LOGE(TAG, "Invalid device index: %d", device_index);
-        return false;
+static void whitelist_clear(void)
+{
+#ifdef CONFIG_BTHUB_SCAN_WHITELIST
+    esp_ble_gap_clear_whitelist();
+    device_manager.whitelist_size = 0;
+    device_manager.whitelist_failed = false;
+    device_manager.scans_since_open = 0;
+#endif
+}
+
+static void start_scanning(void)
+{
+    if (device_manager.scanning) {
+        ESP_LOGI(TAG, "Scanning already in progress");
+        return;
+    }
+    if (device_manager.reset_due_us) return; // the reset starts scanning once its links are down
+    // radio time goes to pending commands first
+    if (scan_gatt_busy()) {
+        ESP_LOGD(TAG, "GATT traffic pending, scan postponed");
+        pause_scanning();
+        return;
     }
     
-    flood_light_device_t *device = &device_manager.devices[device_index];
-    
-    
-    if (!device->connected) {
-        ESP_LOGD(TAG, "Device %d is not connected... connecting", device_index);
+    scan_hold_end();
+    device_manager.all_devices_found = false;
+    device_manager.scanning = true;
+    device_manager.scan_started_us = esp_timer_get_time();
+    if (device_manager.scan_left_s) {
+        // finish a yielded scan, it keeps counting the devices found before
+        device_manager.scan_run_s = device_manager.scan_left_s;
+        device_manager.scan_left_s = 0;
+        trace_record(TRACE_SUBSYS_DEVICE, TRACE_DEV_SCAN_RESUME, TRACE_NO_DEVICE, device_manager.scan_run_s, 0);
+    } else {
+        device_manager.scan_run_s = device_manager.scan_duration;
+        device_manager.scan_found_at_start = device_manager.discovered_count;
+    }
+
+    scan_profile_id_t profile = scan_scheduler_current();
+    bool whitelist = whitelist_scan_due();
+    if (profile != device_manager.scan_profile_applied || whitelist != device_manager.scan_whitelist_applied) {
+        // scan starts from ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT
+        esp_ble_scan_params_t params = scan_scheduler_profile(profile)->params;
+        if (whitelist) {
+            // host only wakes for known lamps, once per device and scan
+            params.scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ONLY_WLST;
+            params.scan_duplicate = BLE_SCAN_DUPLICATE_ENABLE;
+        }
+        esp_err_t err = esp_ble_gap_set_scan_params(&params);
+        if (err == ESP_OK) {
+            device_manager.scan_profile_applied = profile;
+            device_manager.scan_whitelist_applied = whitelist;
+            ESP_LOGI(TAG, "Scan profile: %s%s", scan_scheduler_profile(profile)->name,
+                     whitelist ? " (accept list)" : "");
+            return;
+        }
+        ESP_LOGE(TAG, "Failed to set scan params: %s", esp_err_to_name(err));
+    }
 
-        memcpy(device->pending_cmd, data, length);
-        device->pending_cmd_len = length;
-        device->has_pending = true;
-        ESP_LOGI(TAG, "Command queued for device %d", device_index);
+    esp_ble_gap_start_scanning(device_manager.scan_run_s);
+    ESP_LOGD(TAG, "Scaning started for %d s", (int)device_manager.scan_run_s);
+}
 
-        if(!connect_to_device(device_index)){
-            ESP_LOGE(TAG, "Failed to connect to device, abort");
-            device->has_pending = false;
-            return false;
-        }
-        
-        return true;     
+/**
+ * @brief stop a running scan for GATT traffic, the rest of it runs once the
+ * traffic settled
+ */
+static void yield_scanning(void)
+{
+    uint32_t elapsed_s = (uint32_t)((esp_timer_get_time() - device_manager.scan_started_us) / 1000000);
+    uint8_t left = elapsed_s < device_manager.scan_run_s ? (uint8_t)(device_manager.scan_run_s - elapsed_s) : 1;
+
+    stop_scanning();
+    device_manager.scan_left_s = left;
+    device_manager.scan_yields++;
+    trace_record(TRACE_SUBSYS_DEVICE, TRACE_DEV_SCAN_YIELD, TRACE_NO_DEVICE, left, 0);
+    ESP_LOGD(TAG, "Scan yields to GATT traffic, %u s left", left);
+    pause_scanning();
+}
+/**
+ * @brief scan/connect arbitration, runs on the actor after every event: a
+ * running scan gives way as soon as links are opened or commands wait
+ */
+static void scan_arbitrate(void)
+{
+    if (device_manager.scanning && scan_gatt_busy()) {
+        yield_scanning();
     }
-    
-    if (device->char_handle == 0) {
-        ESP_LOGE(TAG, "No characteristic handle for device %d", device_index);
-        return false;
+}
+/**
+ * @brief ble scan task callback, runs on the timer task so it only wakes the actor
+*/
+static void scan_timer_cb(TimerHandle_t xTimer)
+{
+    actor_msg_t msg = { .type = ACTOR_MSG_SCAN_TIMER };
+    if (!actor_post(&msg, 0, 0)) {
+        // actor is flooded, try again later instead of losing the scan cycle
+        xTimerChangePeriod(xTimer, pdMS_TO_TICKS(SCAN_PAUSE_RETRY_MS), 0);
     }
+}
 
-    if (device->write_char_handle  == 0) {
-        ESP_LOGE(TAG, "No suitable characteristic handle for device %d", device_index);
-        return false;
+/**
+ * @brief queue an op for a device, an op with the same opcode already queued is
+ * dropped so only the newest value is sent (50 slider moves -> 1 write)
+ */
+static void queue_pending_op(flood_light_device_t *device, uint8_t opcode,
+                             const uint8_t *payload, uint8_t payload_len)
+{
+    // remove older op with the same opcode, keep order of the rest
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < device->pending_count; i++) {
+        light_op_t *op = &device->pending_ops[(device->pending_head + i) % CMD_QUEUE_LEN];
+        if (op->opcode == opcode) continue;
+        if (kept != i) {
+            device->pending_ops[(device->pending_head + kept) % CMD_QUEUE_LEN] = *op;
+        }
+        kept++;
     }
-    
-    esp_gatt_status_t ret = esp_ble_gattc_write_char(
-        device_manager.gattc_if,
-        device->conn_id,
-        device->write_char_handle,
-        length,
-        data,
-        ESP_GATT_WRITE_TYPE_NO_RSP,
-        ESP_GATT_AUTH_REQ_NONE);
-        
-    if (ret == ESP_GATT_OK) {
-        ESP_LOGI(TAG, "Successfully controlled device %d", device_index);
-        return true;
-    } else {
-        ESP_LOGE(TAG, "Failed to control device %d: %d", device_index, ret);
-        return false;
+    device->pending_count = kept;
+
+    if (device->pending_count == CMD_QUEUE_LEN) {
+        // full, drop the oldest
+        device->pending_head = (device->pending_head + 1) % CMD_QUEUE_LEN;
+        device->pending_count--;
     }
+
+    light_op_t *op = &device->pending_ops[(device->pending_head + device->pending_count) % CMD_QUEUE_LEN];
+    op->opcode = opcode;
+    op->payload_len = payload_len;
+    memcpy(op->payload, payload, payload_len);
+    device->pending_count++;
 }
+static void invalidate_gatt_cache(int device_index);
 /**
- * @brief Send any pending commands for a device
+ * @brief put a frame back into the op queue, it is sent once the link is ready again
  */
-static void send_pending_commands(int device_index)
+static void requeue_frame(flood_light_device_t *device, const light_frame_t *frame)
 {
-    if (device_index < 0 || device_index >= MAX_DEVICES) {
-        return;
+    queue_pending_op(device, frame->data[1], &frame->data[3], frame->data[2] - 3);
+}
+/**
+ * @brief frames still waiting in the write pipeline go back to the op queue
+ */
+static void requeue_waiting_frames(flood_light_device_t *device)
+{
+    light_frame_t frame;
+    while (write_pipe_pop(&device->write_pipe, &frame)) {
+        requeue_frame(device, &frame);
     }
-    
+}
+/**
+ * @brief hand waiting frames to the stack while the link has credits and
+ * isn't congested, completions and uncongest events call it again
+ */
+static void write_pump(int device_index)
+{
     flood_light_device_t *device = &device_manager.devices[device_index];
-    
-    if (device->has_pending && device->connected && device->write_char_handle != 0) {
-        ESP_LOGD(TAG, "sending command:");
-        ESP_LOG_BUFFER_HEX(TAG, device->pending_cmd, device->pending_cmd_len);
-        vTaskDelay(pdMS_TO_TICKS(300));
-        ESP_LOGI(TAG, "Sending pending command to device %d", device_index);   
+    light_frame_t frame;
+
+    while (device->connected && device->write_char_handle &&
+           write_pipe_take(&device->write_pipe, esp_timer_get_time(), &frame)) {
         esp_gatt_status_t ret = esp_ble_gattc_write_char(
             device_manager.gattc_if,
             device->conn_id,
             device->write_char_handle,
-            device->pending_cmd_len,
-            device->pending_cmd,
+            frame.len,
+            frame.data,
             ESP_GATT_WRITE_TYPE_NO_RSP,
             ESP_GATT_AUTH_REQ_NONE);
-            
-        if (ret == ESP_GATT_OK) {
-            ESP_LOGI(TAG, "Successfully sent pending command to device %d", device_index);
-            
-        } else {
-            ESP_LOGE(TAG, "Failed to send pending command to device %d: %d", device_index, ret);
+
+        trace_record(TRACE_SUBSYS_DEVICE, TRACE_DEV_WRITE, (uint8_t)device_index, frame.data[1], ret);
+        if (ret != ESP_GATT_OK) {
+            ESP_LOGE(TAG, "Failed to write op 0x%02x to device %d: %d", frame.data[1], device_index, ret);
+            write_pipe_untake(&device->write_pipe);
+            device->link.write_failures++;
+            if (device->handles_cached) {
+                // cached handles may be stale, keep the op and fall back to discovery
+                requeue_frame(device, &frame);
+                invalidate_gatt_cache(device_index);
+            }
+            return;
+        }
+        device->link.writes++;
+        if (device->lat_rx_us && !device->lat_write_us) {
+            device->lat_write_us = esp_timer_get_time();
+            latency_record(LATENCY_STAGE_WRITE, device->lat_slot, device->lat_picked_us, device->lat_write_us);
         }
-        device->has_pending = false;
     }
 }
-// Unified device event handler
-static void gattc_device_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param, int device_index)
+/**
+ * @brief queue a framed command for a connected device, a waiting frame with
+ * the same opcode is superseded (lamp commands are fire-and-forget state)
+ */
+static void write_frame(int device_index, const light_frame_t *frame)
 {
-    esp_ble_gattc_cb_param_t *p_data = (esp_ble_gattc_cb_param_t *)param;
     flood_light_device_t *device = &device_manager.devices[device_index];
 
-    switch (event) {
-    case ESP_GATTC_REG_EVT:
-        ESP_LOGI(TAG, "GATTC registered with gattc_if %d", gattc_if);
-        device_manager.gattc_if = gattc_if;
+    switch (write_pipe_submit(&device->write_pipe, frame, true)) {
+    case WRITE_PIPE_SUPERSEDED:
+        write_pipes.superseded++;
         break;
-        
-    case ESP_GATTC_OPEN_EVT:
-        if (p_data->open.status != ESP_GATT_OK){
-            ESP_LOGE(TAG, "Device %d: connect failed, status %d", device_index, p_data->open.status);
-            device->connected = false;
-            break;
-        }
-        
-        device->conn_id = p_data->open.conn_id;
-        device->connected = true;
+    case WRITE_PIPE_OVERFLOW:
+        write_pipes.overflows++;
+        ESP_LOGW(TAG, "Device %d: write pipeline full, oldest frame dropped", device_index);
+        break;
+    default:
+        break;
+    }
+    write_pump(device_index);
+}
+
+/**
+ * @brief a link leaves the table with its device, it is released by its close event
+ * @param opening its open is still outstanding (conn_sched_drop was called)
+ */
+static void closing_link_add(const esp_bd_addr_t mac, bool opening)
+{
+    if (closing_links.count >= MAX_CONNECTIONS) {
+        ESP_LOGW(TAG, "Closing link not tracked, no room");
+        if (opening) conn_sched_opened(&conn_sched, CONN_SCHED_DROPPED); // don't stall the queue
+        return;
+    }
+    closing_links.opening[closing_links.count] = opening;
+    memcpy(closing_links.mac[closing_links.count++], mac, ESP_BD_ADDR_LEN);
+}
+/**
+ * @return index of the closing link of a MAC, -1 if none
+ */
+static int closing_link_find(const esp_bd_addr_t mac)
+{
+    for (int i = 0; i < closing_links.count; i++) {
+        if (memcmp(closing_links.mac[i], mac, ESP_BD_ADDR_LEN) == 0) return i;
+    }
+    return -1;
+}
+static void closing_link_release(int index)
+{
+    closing_links.count--;
+    closing_links.opening[index] = closing_links.opening[closing_links.count];
+    memcpy(closing_links.mac[index], closing_links.mac[closing_links.count], ESP_BD_ADDR_LEN);
+}
+/**
+ * @brief number of links open, being opened or being closed
+ */
+static uint8_t pool_links_in_use(void)
+{
+    uint8_t used = closing_links.count;
+    for (int i = 0; i < device_manager.discovered_count; i++) {
+        const flood_light_device_t *device = &device_manager.devices[i];
+        if (device->connected || device->connecting) used++;
+    }
+    return used;
+}
+/**
+ * @brief a link whose discovery failed, else the least recently commanded idle link
+ * @return device index or -1 when every link is busy
+ */
+static int pool_find_victim(void)
+{
+    int victim = -1;
+    for (int i = 0; i < device_manager.discovered_count; i++) {
+        const flood_light_device_t *device = &device_manager.devices[i];
+        if (!device->connected || device->evicting) continue;
+        // can't carry commands, goes before any healthy link (its own close was refused)
+        if (device->discovery_failed) return i;
+        // links still in discovery or with unsent commands are not idle
+        if (conn_sched_priority(&conn_sched, i) == CONN_PRIO_COMMAND) continue;
+        if (device->pending_count || !device->char_handle || !device->write_char_handle) continue;
+        if (write_pipe_busy(&device->write_pipe)) continue;
+
+        if (victim < 0 || (int32_t)(device->last_used - device_manager.devices[victim].last_used) < 0) {
+            victim = i;
+        }
+    }
+    return victim;
+}
+static void count_connect_failure(int device_index, int64_t now_us);
+/* one pass of pool_service */
+typedef struct {
+    int64_t now_us;
+    int free_links;
+} pool_round_t;
+
+/**
+ * @brief may a queued device open now: no link yet, not backing off, and
+ * warm-up or background opens leave the last free link to commands
+ */
+static bool pool_ready(int device_index, conn_prio_t prio, void *ctx)
+{
+    pool_round_t *round = ctx;
+    flood_light_device_t *device = &device_manager.devices[device_index];
+
+    if (device->connected || device->connecting) return false;
+    if (closing_link_find(device->mac_address) >= 0) return false; // its old link is still closing
+    if (round->free_links < (prio == CONN_PRIO_COMMAND ? 1 : 2)) return false;
+    if (prio == CONN_PRIO_BACKGROUND && device_manager.scanning) return false; // would cut the scan short
+    return reconnect_may_connect(&device->reconnect, round->now_us);
+}
+/**
+ * @brief evict idle links for commanded devices the free links can't serve,
+ * then start the most urgent open. Only one open is outstanding, the OPEN
+ * event calls this again for the next one. Called whenever a link closes,
+ * opens or becomes idle.
+ */
+static void pool_service(void)
+{
+    if (device_manager.reset_due_us) return; // nothing opens while the device list resets
+
+    pool_round_t round = {
+        .now_us = esp_timer_get_time(),
+        .free_links = MAX_CONNECTIONS - pool_links_in_use(),
+    };
+    int closing = closing_links.count;
+    for (int i = 0; i < device_manager.discovered_count; i++) {
+        if (device_manager.devices[i].evicting) closing++;
+    }
+
+    // links already on their way out count as room
+    int missing = -round.free_links - closing;
+    for (int i = 0; i < device_manager.discovered_count; i++) {
+        flood_light_device_t *device = &device_manager.devices[i];
+        if (conn_sched_priority(&conn_sched, i) != CONN_PRIO_COMMAND || device->connected) continue;
+        if (!reconnect_may_connect(&device->reconnect, round.now_us)) continue; // retried when its backoff ends
+        if (++missing <= 0) continue;
+
+        int victim = pool_find_victim();
+        if (victim < 0) {
+            ESP_LOGW(TAG, "Connection pool full, device %d waits for a free link", i);
+            break;
+        }
+        ESP_LOGI(TAG, "Connection pool full, closing idle device %d for device %d", victim, i);
+        if (disconnect_from_device(victim)) {
+            device_manager.devices[victim].evicting = true;
+            conn_pool.evictions++;
+        }
+    }
+
+    while (!conn_sched_busy(&conn_sched)) {
+        int next = conn_sched_next(&conn_sched, device_manager.discovered_count, pool_ready, &round);
+        if (next < 0) break;
+
+        conn_sched_opening(&conn_sched, next);
+        if (connect_to_device(next)) break;
+
+        // backs the device off, so the next round picks another one
+        count_connect_failure(next, round.now_us);
+    }
+}
+/**
+ * @brief get a link for a device, opening it as soon as it is its turn
+ */
+static bool pool_acquire(int device_index)
+{
+    flood_light_device_t *device = &device_manager.devices[device_index];
+
+    if (device->connecting || conn_sched_priority(&conn_sched, device_index) == CONN_PRIO_COMMAND) return true;
+
+    if (device_manager.gattc_if == ESP_GATT_IF_NONE) {
+        ESP_LOGE(TAG, "GATTC not registered");
+        return false;
+    }
+    conn_sched_request(&conn_sched, device_index, CONN_PRIO_COMMAND);
+    pool_service();
+    return true;
+}
+/**
+ * @brief report a change of reachability once
+ */
+static void set_available(int device_index, bool available)
+{
+    flood_light_device_t *device = &device_manager.devices[device_index];
+    if (device->offline != available) return;
+
+    device->offline = !available;
+    if (device_manager.device_availability_cb) {
+        device_manager.device_availability_cb(device->mac_address, available);
+    }
+}
+/**
+ * @brief a connect attempt failed or ran out of time: retry after the
+ * backoff while commands wait, fail them once the breaker opens
+ */
+static void count_connect_failure(int device_index, int64_t now_us)
+{
+    flood_light_device_t *device = &device_manager.devices[device_index];
+
+    device->connecting = false;
+    device->lat_connect_us = 0;
+    device->link.connect_failures++;
+    conn_sched_opened(&conn_sched, device_index);
+
+    if (reconnect_failed(&device->reconnect, now_us)) {
+        reconnects.breaker_trips++;
+        ESP_LOGW(TAG, "Device %d unreachable after %d attempts, dropping %d command(s)",
+                 device_index, device->reconnect.failures, device->pending_count);
+        device->pending_head = 0;
+        device->pending_count = 0;
+        device->lat_rx_us = 0;
+        conn_sched_cancel(&conn_sched, device_index);
+        set_available(device_index, false);
+    } else if (device->pending_count) {
+        reconnects.retries++;
+        conn_sched_request(&conn_sched, device_index, CONN_PRIO_COMMAND);
+        ESP_LOGI(TAG, "Device %d: connect attempt %d failed, retry in %lld ms", device_index,
+                 device->reconnect.failures, (device->reconnect.at_us - now_us) / 1000);
+    }
+}
+/**
+ * @brief count the failure and hand the freed open to the next device
+ */
+static void connect_failed(int device_index, int64_t now_us)
+{
+    count_connect_failure(device_index, now_us);
+    pool_service();
+}
+
+/**
+ * @brief ask the lamp for the connection parameters of a mode
+ */
+static void request_conn_params(int device_index, conn_params_mode_t mode)
+{
+    flood_light_device_t *device = &device_manager.devices[device_index];
+    if (mode >= CONN_PARAMS_MODE_COUNT || !device->connected) return;
+
+    esp_ble_conn_update_params_t params = {0};
+    memcpy(params.bda, device->mac_address, sizeof(params.bda));
+    conn_params_fill(mode, &params);
+    esp_err_t err = esp_ble_gap_update_conn_params(&params);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Device %d: %s connection parameters not requested (%s)", device_index,
+                 conn_params_mode_name(mode), esp_err_to_name(err));
+        conn_params_updated(&device->conn_params, false, 0, 0, 0, esp_timer_get_time());
+        return;
+    }
+    conn_params_requested(&device->conn_params, mode);
+    ESP_LOGD(TAG, "Device %d: requesting %s connection parameters", device_index, conn_params_mode_name(mode));
+}
+/**
+ * @brief commands are going to a linked lamp, switch it to the short interval
+ */
+static void link_activity(int device_index)
+{
+    flood_light_device_t *device = &device_manager.devices[device_index];
+    request_conn_params(device_index, conn_params_activity(&device->conn_params, esp_timer_get_time()));
+}
+
+/**
+ * @brief record the MQTT side of a command and start tracing it, a command
+ * arriving while an older one waits for its notification joins that trace
+ */
+static void trace_command(int device_index, const actor_msg_t *msg, int64_t now_us)
+{
+    flood_light_device_t *device = device_index >= 0 ? &device_manager.devices[device_index] : NULL;
+    int slot = device ? device->lat_slot : -1;
+
+    latency_record(LATENCY_STAGE_PARSE, slot, msg->command.rx_us, msg->posted_us);
+    latency_record(LATENCY_STAGE_QUEUE, slot, msg->posted_us, now_us);
+    trace_record(TRACE_SUBSYS_DEVICE, TRACE_DEV_COMMAND, device ? (uint8_t)device_index : TRACE_NO_DEVICE,
+                 msg->command.op.opcode, msg->command.rx_us ? (uint32_t)(now_us - msg->command.rx_us) : 0);
+
+    if (!device) return;
+    if (device->lat_rx_us && now_us - device->lat_picked_us < LATENCY_TRACE_TIMEOUT_US) return;
+
+    device->lat_rx_us = msg->command.rx_us ? msg->command.rx_us : msg->posted_us;
+    device->lat_picked_us = now_us;
+    device->lat_write_us = 0;
+}
+
+static bool control_device(int device_index, uint8_t opcode, const uint8_t *payload, uint8_t payload_len)
+{ 
+
+    if (device_index < 0 || device_index >= MAX_DEVICES) {
+        ESP_LOGE(TAG, "Invalid device index: %d", device_index);
+        return false;
+    }
+    if (payload_len > LIGHT_CMD_PAYLOAD_MAX) {
+        ESP_LOGE(TAG, "Payload too long: %d", payload_len);
+        return false;
+    }
+    
+    flood_light_device_t *device = &device_manager.devices[device_index];
+    if (!device->connected && reconnect_fast_fail(&device->reconnect, esp_timer_get_time())) {
+        reconnects.fast_fails++;
+        device->lat_rx_us = 0;
+        ESP_LOGW(TAG, "Device %d unreachable, command 0x%02x failed", device_index, opcode);
+        return false;
+    }
+    device->last_used = xTaskGetTickCount();
+
+    if (device->connected && !device->evicting) {
+        conn_pool.hits++;
+        link_activity(device_index);
+    } else {
+        conn_pool.misses++;
+    }
+
+    // not ready until service discovery found the write handle, queue until then
+    if (!device->connected || device->evicting || device->write_char_handle == 0) {
+
+        queue_pending_op(device, opcode, payload, payload_len);
+        ESP_LOGI(TAG, "Command 0x%02x queued for device %d (%d pending)", opcode, device_index, device->pending_count);
+
+        if (device->connected && !device->evicting) return true; // discovery in progress
+
+        ESP_LOGD(TAG, "Device %d is not connected... connecting", device_index);
+        if (!pool_acquire(device_index)) {
+            ESP_LOGE(TAG, "Failed to connect to device, abort");
+            device->pending_count = 0;
+            return false;
+        }
+        
+        return true;     
+    }
+    
+    light_frame_t frame;
+    frame.len = (uint8_t)light_cmd_build(frame.data, sizeof(frame.data), opcode, payload, payload_len);
+    if (!frame.len) return false;
+
+    write_frame(device_index, &frame);
+    ESP_LOGI(TAG, "Successfully controlled device %d", device_index);
+    return true;
+}
+/**
+ * @brief Send pending commands for a device in the order they were queued
+ */
+static void send_pending_commands(int device_index)
+{
+    if (device_index < 0 || device_index >= MAX_DEVICES) {
+        return;
+    }
+    
+    flood_light_device_t *device = &device_manager.devices[device_index];
+    
+    if (device->pending_count == 0 || !device->connected || device->write_char_handle == 0) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Sending %d pending command(s) to device %d", device->pending_count, device_index);
+
+    light_op_t ops[CMD_QUEUE_LEN];
+    light_frame_t frames[CMD_QUEUE_LEN];
+    uint8_t count = device->pending_count;
+    for (uint8_t i = 0; i < count; i++) {
+        ops[i] = device->pending_ops[(device->pending_head + i) % CMD_QUEUE_LEN];
+    }
+    device->pending_head = 0;
+    device->pending_count = 0;
+
+    light_cmd_build_batch(ops, count, frames);
+    for (uint8_t i = 0; i < count; i++) {
+        if (frames[i].len == 0) {
+            ESP_LOGE(TAG, "Failed to send pending command to device %d", device_index);
+            continue;
+        }
+        write_frame(device_index, &frames[i]);
+    }
+    // link is idle now, a waiting device may take it
+    pool_service();
+}
+/**
+ * @brief flush pending commands once the link settled, the actor runs it
+ * when the deadline passes
+ */
+static void schedule_pending_send(int device_index, uint32_t delay_ms)
+{
+    device_actor.send_armed[device_index] = true;
+    device_actor.send_at[device_index] = xTaskGetTickCount() + pdMS_TO_TICKS(delay_ms);
+}
+/**
+ * @brief register for notifications of the lamp's state characteristic. The
+ * REG_FOR_NOTIFY event only carries the handle, which is the same on every
+ * lamp of a model, so one registration is outstanding at a time and the
+ * event belongs to it. Lamps opened meanwhile wait for their turn.
+ */
+static void register_notify(int device_index)
+{
+    flood_light_device_t *device = &device_manager.devices[device_index];
+
+    if (device_manager.notify_reg_device != NOTIFY_REG_NONE) {
+        device->notify_reg_waiting = true;
+        return;
+    }
+    device->notify_reg_waiting = false;
+    esp_err_t err = esp_ble_gattc_register_for_notify(device_manager.gattc_if, device->mac_address,
+                                                      device->char_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Device %d: notify registration not started (%s)", device_index, esp_err_to_name(err));
+        return;
+    }
+    device_manager.notify_reg_device = (int16_t)device_index;
+}
+/**
+ * @brief the outstanding registration finished, start the next waiting one
+ */
+static void register_notify_next(void)
+{
+    device_manager.notify_reg_device = NOTIFY_REG_NONE;
+    for (int i = 0; i < device_manager.discovered_count; i++) {
+        flood_light_device_t *device = &device_manager.devices[i];
+        if (!device->notify_reg_waiting) continue;
+        device->notify_reg_waiting = false;
+        if (!device->connected || device->char_handle == 0) continue;
+
+        register_notify(i);
+        if (device_manager.notify_reg_device != NOTIFY_REG_NONE) return;
+    }
+}
+/**
+ * @brief remember the resolved handles for the next connection
+ */
+static void store_gatt_cache(int device_index)
+{
+    flood_light_device_t *device = &device_manager.devices[device_index];
+    gatt_cache_entry_t entry = {
+        .service_uuid = device->service_uuid,
+        .service_start_handle = device->service_start_handle,
+        .service_end_handle = device->service_end_handle,
+        .write_char_handle = device->write_char_handle,
+        .char_handle = device->char_handle,
+        .cccd_handle = device->cccd_handle,
+    };
+    esp_err_t err = gatt_cache_store(device->mac_address, &entry);
+    if (err == ESP_OK) {
+        device->handles_cached = true;
+        ESP_LOGI(TAG, "Device %d: GATT handles cached", device_index);
+    } else {
+        ESP_LOGW(TAG, "Device %d: failed to cache handles (%s)", device_index, esp_err_to_name(err));
+    }
+}
+/**
+ * @brief discovery failed or ran out of time: queued commands fail and the
+ * link is closed, the next command connects and discovers again
+ */
+static void discovery_failed(int device_index)
+{
+    flood_light_device_t *device = &device_manager.devices[device_index];
+    if (device->discovery_failed) return;
+
+    ESP_LOGW(TAG, "Device %d: no usable GATT handles, closing link, dropping %d command(s)",
+             device_index, device->pending_count);
+    device->discovery_failed = true;
+    device->discovery_due_us = 0;
+    device->pending_head = 0;
+    device->pending_count = 0;
+    device->lat_rx_us = 0;
+    device->lat_open_us = 0;
+    device_actor.send_armed[device_index] = false;
+    write_pipe_reset(&device->write_pipe);
+    // evicting: the disconnect doesn't ask for a reconnect
+    if (!device->evicting && disconnect_from_device(device_index)) device->evicting = true;
+    pool_service(); // the link counts as closing now
+}
+/**
+ * @brief search only the advertised service, all services if it is unknown
+ */
+static void start_service_discovery(int device_index)
+{
+    flood_light_device_t *device = &device_manager.devices[device_index];
+    esp_bt_uuid_t filter = {
+        .len = ESP_UUID_LEN_16,
+        .uuid = {.uuid16 = device->service_uuid,},
+    };
+    esp_err_t err = esp_ble_gattc_search_service(device_manager.gattc_if, device->conn_id,
+                                                 device->service_uuid ? &filter : NULL);
+    if (err) {
+        ESP_LOGE(TAG, "Device %d: service search error = %x", device_index, err);
+        discovery_failed(device_index);
+    }
+}
+/**
+ * @brief forget cached handles and rediscover if the link is up
+ */
+static void invalidate_gatt_cache(int device_index)
+{
+    flood_light_device_t *device = &device_manager.devices[device_index];
+
+    ESP_LOGW(TAG, "Device %d: cached handles invalid, rediscovering", device_index);
+    requeue_waiting_frames(device); // sent again once discovery found the handles
+    device->handles_cached = false;
+    device->char_handle = 0;
+    device->write_char_handle = 0;
+    device->cccd_handle = 0;
+    gatt_cache_erase(device->mac_address);
+
+    if (device->connected) {
+        device->discovery_due_us = esp_timer_get_time() + DISCOVERY_TIMEOUT_US;
+        start_service_discovery(device_index);
+    }
+}
+// Unified device event handler
+/**
+ * @brief commanded within the warm-up window, its link is worth restoring
+ */
+static bool recently_used(const flood_light_device_t *device)
+{
+#if CONFIG_BTHUB_WARMUP_WINDOW_S > 0
+    if (device->last_used == 0) return false;
+    return xTaskGetTickCount() - device->last_used < pdMS_TO_TICKS(CONFIG_BTHUB_WARMUP_WINDOW_S * 1000UL);
+#else
+    return false;
+#endif
+}
+/**
+ * @brief count an opened link and its connect time
+ */
+static void link_connected(flood_light_device_t *device, int64_t now_us)
+{
+    ble_link_stats_t *link = &device->link;
+    link->last_seen_ms = (uint32_t)(now_us / 1000);
+    if (link->connects == UINT16_MAX) return; // saturated, keep the average as is
+    link->connects++;
+
+    if (device->lat_connect_us > 0) {
+        device->connect_ms_total += (uint32_t)((now_us - device->lat_connect_us) / 1000);
+        uint32_t avg = device->connect_ms_total / link->connects;
+        link->connect_avg_ms = avg > UINT16_MAX ? UINT16_MAX : (uint16_t)avg;
+    }
+}
+/**
+ * @brief count a lost link by reason
+ */
+static void link_disconnected(flood_light_device_t *device, uint8_t reason)
+{
+    ble_link_stats_t *link = &device->link;
+    switch (reason) {
+    case ESP_GATT_CONN_TIMEOUT:              link->disc_timeout++; break;
+    case ESP_GATT_CONN_TERMINATE_PEER_USER:  link->disc_remote++;  break;
+    case ESP_GATT_CONN_TERMINATE_LOCAL_HOST: link->disc_local++;   break;
+    default:                                 link->disc_other++;   break;
+    }
+    link->last_reason = reason;
+}
+
+static void gattc_device_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param, int device_index)
+{
+    esp_ble_gattc_cb_param_t *p_data = (esp_ble_gattc_cb_param_t *)param;
+    flood_light_device_t *device = &device_manager.devices[device_index];
+
+    switch (event) {
+    case ESP_GATTC_REG_EVT:
+        ESP_LOGI(TAG, "GATTC registered with gattc_if %d", gattc_if);
+        device_manager.gattc_if = gattc_if;
+        break;
+        
+    case ESP_GATTC_CONNECT_EVT:
+        // parameters the stack negotiated, ESP_GATTC_OPEN_EVT follows
+        conn_params_opened(&device->conn_params, p_data->connect.conn_params.interval,
+                           p_data->connect.conn_params.latency, p_data->connect.conn_params.timeout,
+                           esp_timer_get_time());
+        break;
+
+    case ESP_GATTC_OPEN_EVT:
+        if (p_data->open.status != ESP_GATT_OK){
+            device->connected = false;
+            if (device->open_abandoned) {
+                // the attempt was already counted when its deadline passed
+                device->open_abandoned = false;
+                break;
+            }
+            if (!device->connecting) break; // late event of an open that already ended
+            ESP_LOGE(TAG, "Device %d: connect failed, status %d", device_index, p_data->open.status);
+            connect_failed(device_index, esp_timer_get_time());
+            break;
+        }
+        device->connecting = false;
+        device->open_abandoned = false;
+        reconnect_connected(&device->reconnect);
+        set_available(device_index, true);
+        
+        device->lat_open_us = esp_timer_get_time();
+        latency_record(LATENCY_STAGE_CONNECT, device->lat_slot, device->lat_connect_us, device->lat_open_us);
+        link_connected(device, device->lat_open_us);
+        device->lat_connect_us = 0;
+
+        device->conn_id = p_data->open.conn_id;
+        device->connected = true;
+        write_pipe_reset(&device->write_pipe);
+        device_registry_set_conn(device->conn_id, device_index);
         device_manager.conn_count++;
         
         ESP_LOGI(TAG, "Device %d: Successfully connected", device_index);
+
+        // the stack is free again, the next queued open overlaps this discovery
+        conn_sched_opened(&conn_sched, device_index);
+        pool_service();
+
+        if (device->pending_count) {
+            link_activity(device_index); // commands wait for this link
+        }
+        
+        // Notify callback
+        if (device_manager.device_connected_cb) {
+            device_manager.device_connected_cb(device_index);
+        }
+        
+        if (device->handles_cached) {
+            // known lamp: skip MTU exchange and discovery, frames fit the default MTU
+            ESP_LOGI(TAG, "Device %d: using cached GATT handles", device_index);
+            register_notify(device_index);
+            schedule_pending_send(device_index, 0);
+            break;
+        }
+
+        device->discovery_due_us = esp_timer_get_time() + DISCOVERY_TIMEOUT_US;
+        esp_err_t mtu_ret = esp_ble_gattc_send_mtu_req(gattc_if, p_data->open.conn_id);
+        if (mtu_ret){
+            ESP_LOGE(TAG, "Device %d: MTU error = %x", device_index, mtu_ret);
+        }
+        break;
+        
+    case ESP_GATTC_CFG_MTU_EVT:
+        if (param->cfg_mtu.status != ESP_GATT_OK){
+            ESP_LOGE(TAG, "Device %d: MTU config failed", device_index);
+        } else {
+            ESP_LOGI(TAG, "Device %d: MTU %d", device_index, param->cfg_mtu.mtu);
+        }
+        start_service_discovery(device_index);
+        break;
+        
+    case ESP_GATTC_SEARCH_RES_EVT: {
+        // only 16 bit uuids
+        if (p_data->search_res.srvc_id.uuid.len == ESP_UUID_LEN_16 ){
+            // if uuid dosen't match adv service uuid skip
+            if (p_data->search_res.srvc_id.uuid.uuid.uuid16 != device_manager.devices[device_index].service_uuid){ 
+                break;
+            }
+            ESP_LOGI(TAG, "Device %d: Found service Service UUID: 0x%0X", device_index, p_data->search_res.srvc_id.uuid.uuid.uuid16);
+            device->service_start_handle = p_data->search_res.start_handle;
+            device->service_end_handle = p_data->search_res.end_handle;
+        }
+        break;
+    }
+    
+    case ESP_GATTC_SEARCH_CMPL_EVT:
+        if (device->discovery_failed) break; // timed out, the link is closing
+        if (p_data->search_cmpl.status != ESP_GATT_OK){
+            ESP_LOGE(TAG, "Device %d: service search failed = %x", device_index, p_data->search_cmpl.status);
+            discovery_failed(device_index);
+            break;
+        }
+
+        ESP_LOGI(TAG, "Device %d: Service discovery complete", device_index);
+
+        // Get characteristics count
+        uint16_t count = 0;
+        esp_gatt_status_t status = esp_ble_gattc_get_attr_count(
+            gattc_if,
+            device->conn_id,
+            ESP_GATT_DB_CHARACTERISTIC,
+            device->service_start_handle,
+            device->service_end_handle,
+            INVALID_HANDLE,
+            &count);
+
+        if (status != ESP_GATT_OK || count == 0) {
+            ESP_LOGE(TAG, "Device %d: No characteristics found", device_index);
+            discovery_failed(device_index);
+            break;
+        }
+
+        esp_gattc_char_elem_t *char_elem_result = malloc(sizeof(esp_gattc_char_elem_t) * count);
+        if (!char_elem_result) {
+            ESP_LOGE(TAG, "Device %d: No memory for characteristics", device_index);
+            discovery_failed(device_index);
+            break;
+        }
+
+        // LOOK FOR NOTIFY CHARACTERISTIC 
+        esp_bt_uuid_t notify_uuid = {
+            .len = ESP_UUID_LEN_16,
+            .uuid = {.uuid16 = device_manager.devices[device_index].service_uuid + 2,},
+        };
+
+        uint16_t notify_count = count;
+        esp_gatt_status_t st1 = esp_ble_gattc_get_char_by_uuid(
+            gattc_if,
+            device->conn_id,
+            device->service_start_handle,
+            device->service_end_handle,
+            notify_uuid,
+            char_elem_result,
+            &notify_count);
+
+        if (st1 == ESP_GATT_OK && notify_count > 0 && 
+            (char_elem_result[0].properties & ESP_GATT_CHAR_PROP_BIT_NOTIFY)) {
+            device->char_handle = char_elem_result[0].char_handle;
+            register_notify(device_index);
+            ESP_LOGD(TAG, "Device %d: Registered for notifications (handle 0x%08x)", device_index, device->char_handle);
+        }
+
+        esp_bt_uuid_t write_uuid = {
+            .len = ESP_UUID_LEN_16,
+            .uuid = {.uuid16 = device_manager.devices[device_index].service_uuid + 1,},
+        };
+
+        uint16_t write_count = count;
+        esp_gatt_status_t st2 = esp_ble_gattc_get_char_by_uuid(
+            gattc_if,
+            device->conn_id,
+            device->service_start_handle,
+            device->service_end_handle,
+            write_uuid,
+            char_elem_result,
+            &write_count);
+
+        if (st2 == ESP_GATT_OK && write_count > 0 &&
+            (char_elem_result[0].properties & (ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_WRITE_NR))) {
+            device->write_char_handle = char_elem_result[0].char_handle;
+            ESP_LOGD(TAG, "Device %d: Found write characteristic (handle 0x%08x)", device_index, device->write_char_handle);
+        }
+        free(char_elem_result);
+        if (device->write_char_handle == 0) {
+            ESP_LOGW(TAG, "Device %d: write characteristic not found", device_index);
+            discovery_failed(device_index);
+            break;
+        }
+        device->discovery_due_us = 0;
+        schedule_pending_send(device_index, PENDING_SEND_DELAY_MS);
+        break;
+
+        
+    case ESP_GATTC_REG_FOR_NOTIFY_EVT:{
+        register_notify_next(); // this one is done, the next lamp may register
+
+        esp_gatt_status_t status = p_data->reg_for_notify.status;
+
+        if (status != ESP_GATT_OK) {
+            ESP_LOGE(TAG, "Device %d: notify registration failed (0x%x)",   device_index, status);
+            break;
+        }
+
+        uint16_t handle = p_data->reg_for_notify.handle;
+        
+        if (device_index < 0) {
+            ESP_LOGW(TAG, "REG_FOR_NOTIFY_EVT: Unknown handle=0x%04x", handle);
+            break;
+        }
+
+        flood_light_device_t *device = &device_manager.devices[device_index];
+        if (!device->connected || handle != device->char_handle) {
+            ESP_LOGW(TAG, "Device %d: stale notify registration for handle 0x%04x", device_index, handle);
+            break;
+        }
+        latency_record(LATENCY_STAGE_DISCOVERY, device->lat_slot, device->lat_open_us, esp_timer_get_time());
+        device->lat_open_us = 0;
+
+        if (device->cccd_handle == 0) {
+            // not cached, look the descriptor up in the discovered database
+            uint16_t count = 0;
+            esp_gatt_status_t ret_status = esp_ble_gattc_get_attr_count(
+                gattc_if,
+                device->conn_id,
+                ESP_GATT_DB_DESCRIPTOR,
+                device->service_start_handle,
+                device->service_end_handle,
+                handle,
+                &count
+            );
+
+            if (ret_status != ESP_GATT_OK || count == 0) {
+                ESP_LOGE(TAG, "Device %d: no descriptors found (ret=0x%x)", device_index, ret_status);
+                break;
+            }
+
+            esp_gattc_descr_elem_t *descr_elem_result = malloc(sizeof(esp_gattc_descr_elem_t) * count);
+            if (!descr_elem_result) {
+                ESP_LOGE(TAG, "Device %d: out of memory for descriptors", device_index);
+                break;
+            }
+
+            esp_bt_uuid_t notify_descr_uuid = {
+                .len = ESP_UUID_LEN_16,
+                .uuid = {.uuid16 = ESP_GATT_UUID_CHAR_CLIENT_CONFIG}
+            };
+
+            ret_status = esp_ble_gattc_get_descr_by_char_handle(
+                gattc_if,
+                device->conn_id,
+                handle,
+                notify_descr_uuid,
+                descr_elem_result,
+                &count
+            );
+
+            if (ret_status == ESP_GATT_OK && count > 0 &&
+                descr_elem_result[0].uuid.len == ESP_UUID_LEN_16 &&
+                descr_elem_result[0].uuid.uuid.uuid16 == ESP_GATT_UUID_CHAR_CLIENT_CONFIG) {
+                device->cccd_handle = descr_elem_result[0].handle;
+            }
+            free(descr_elem_result);
+
+            if (device->cccd_handle == 0) {
+                ESP_LOGW(TAG, "Device %d: no valid CCC descriptor found", device_index);
+                break;
+            }
+            // every handle is resolved now, remember them for the next connection
+            if (device->write_char_handle != 0) {
+                store_gatt_cache(device_index);
+            }
+        }
+
+        uint16_t notify_en = 1;
+        esp_err_t ret = esp_ble_gattc_write_char_descr(
+            gattc_if,
+            device->conn_id,
+            device->cccd_handle,
+            sizeof(notify_en),
+            (uint8_t *)&notify_en,
+            ESP_GATT_WRITE_TYPE_RSP,
+            ESP_GATT_AUTH_REQ_NONE
+        );
+
+        if (ret == ESP_OK) {
+            ESP_LOGI(TAG, "Device %d: notifications enabled", device_index);
+        } else {
+            ESP_LOGE(TAG, "Device %d: failed to enable notifications (ret=0x%x)", device_index, ret);
+        }
+        break;
+    }
+
+    case ESP_GATTC_WRITE_CHAR_EVT: {
+        // the stack's buffers were full, the frame is sent again after the congestion
+        bool retry = p_data->write.status == ESP_GATT_CONGESTED;
+        if (write_pipe_completed(&device->write_pipe, retry, esp_timer_get_time())) {
+            write_pipes.completed++;
+            if (retry) write_pipes.retries++;
+        }
+        if (p_data->write.status != ESP_GATT_OK && !retry) {
+            ESP_LOGE(TAG, "Device %d: write to handle 0x%04x failed (0x%x)", device_index,
+                     p_data->write.handle, p_data->write.status);
+            device->link.write_failures++;
+            if (device->handles_cached) {
+                invalidate_gatt_cache(device_index);
+            }
+        }
+        write_pump(device_index);
+        if (!write_pipe_busy(&device->write_pipe)) {
+            pool_service(); // link is idle now, a waiting device may take it
+        }
+        break;
+    }
+
+    case ESP_GATTC_CONGEST_EVT:
+        write_pipe_congested(&device->write_pipe, p_data->congest.congested);
+        if (p_data->congest.congested) {
+            write_pipes.congestions++;
+            ESP_LOGD(TAG, "Device %d: link congested, writes paused", device_index);
+        } else {
+            write_pump(device_index);
+        }
+        break;
+
+    case ESP_GATTC_NOTIFY_EVT:
+        ESP_LOGI(TAG, "Device %d: Received notification", device_index);
+        ESP_LOG_BUFFER_HEX_LEVEL(TAG, p_data->notify.value, p_data->notify.value_len, ESP_LOG_DEBUG);
+        decode_notification(device_index,p_data->notify.value, p_data->notify.value_len);
+        device->link.notifies++;
+        device->link.last_seen_ms = (uint32_t)(esp_timer_get_time() / 1000);
+        if (device->lat_write_us) {
+            int64_t now_us = esp_timer_get_time();
+            latency_record(LATENCY_STAGE_NOTIFY, device->lat_slot, device->lat_write_us, now_us);
+            latency_record(LATENCY_STAGE_TOTAL, device->lat_slot, device->lat_rx_us, now_us);
+            device->lat_rx_us = 0;
+            device->lat_write_us = 0;
+        }
+        break;
+        
+    case ESP_GATTC_DISCONNECT_EVT:
+        ESP_LOGI(TAG, "Device %d: Disconnected, reason 0x%02x", device_index, p_data->disconnect.reason);
+        link_disconnected(device, p_data->disconnect.reason);
+        trace_record(TRACE_SUBSYS_DEVICE, TRACE_DEV_DISCONNECT, (uint8_t)device_index, p_data->disconnect.reason, 0);
+        bool warm_up = device->connected && !device->evicting &&
+                       p_data->disconnect.reason != ESP_GATT_CONN_TERMINATE_LOCAL_HOST && recently_used(device);
+        if (device->connected) {
+            device_manager.conn_count--;
+            // an open that never completed has no conn_id of its own, 0 may be another lamp's
+            device_registry_clear_conn(device->conn_id);
+        }
+        if (device->connecting) {
+            conn_sched_opened(&conn_sched, device_index); // the open ended without OPEN event
+        }
+        requeue_waiting_frames(device);
+        write_pipe_reset(&device->write_pipe);
+        device->connected = false;
+        device->connecting = false;
+        device->evicting = false;
+        device->notify_reg_waiting = false;
+        device->discovery_due_us = 0;
+        device->discovery_failed = false;
+        reconnect_disconnected(&device->reconnect);
+        device->conn_id = 0;
+        device->lat_open_us = 0;
+        if (!device->handles_cached) {
+            // found again by the next discovery, which must find them to succeed
+            device->char_handle = 0;
+            device->write_char_handle = 0;
+            device->cccd_handle = 0;
+        }
         
         // Notify callback
-        if (device_manager.device_connected_cb) {
-            device_manager.device_connected_cb(device_index);
+        if (device_manager.device_disconnected_cb) {
+            device_manager.device_disconnected_cb(device_index);
         }
-        
-        esp_err_t mtu_ret = esp_ble_gattc_send_mtu_req(gattc_if, p_data->open.conn_id);
-        if (mtu_ret){
-            ESP_LOGE(TAG, "Device %d: MTU error = %x", device_index, mtu_ret);
+        if (device->pending_count) {
+            conn_sched_request(&conn_sched, device_index, CONN_PRIO_COMMAND); // commands were still waiting
+        } else if (warm_up) {
+            conn_sched_request(&conn_sched, device_index, CONN_PRIO_WARMUP); // lost, not closed by us
         }
+        // freed slot goes to the next waiting device
+        pool_service();
         break;
         
-    case ESP_GATTC_CFG_MTU_EVT:
-        if (param->cfg_mtu.status != ESP_GATT_OK){
-            ESP_LOGE(TAG, "Device %d: MTU config failed", device_index);
-        } else {
-            ESP_LOGI(TAG, "Device %d: MTU %d", device_index, param->cfg_mtu.mtu);
-            esp_ble_gattc_search_service(gattc_if, param->cfg_mtu.conn_id, NULL); //, &remote_filter_service_uuid);
-        }
+    default:
         break;
+    }
+}
+/**
+ * @brief find app id of device with this mac
+ * @param mac_addr mac address
+ * @return device app id (int)
+ */ 
+static int find_device_by_mac(const esp_bd_addr_t mac_addr)
+{
+    return device_registry_find_mac(mac_addr);
+}
+/**
+ * @brief find device index of the device with this connection id (needed for esp_gattc_cb)
+ * @param conn_id connection id
+ * @return device index (int)
+ */
+static int find_device_by_conn(uint16_t conn_id)
+{
+    return device_registry_find_conn(conn_id);
+}
+/**
+ * @brief link event of a device that left the table, even if the lamp was
+ * found again since: a cancelled open ends and lets the next one start, an
+ * open that went through is closed, the close event releases the pool slot
+ */
+static void closing_link_event(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
+                               esp_ble_gattc_cb_param_t *param, int closing)
+{
+    if (event == ESP_GATTC_CONNECT_EVT) return;
+
+    if (closing_links.opening[closing]) {
+        closing_links.opening[closing] = false;
+        conn_sched_opened(&conn_sched, CONN_SCHED_DROPPED);
+    }
+    if (event == ESP_GATTC_OPEN_EVT && param->open.status == ESP_GATT_OK) {
+        esp_ble_gattc_close(gattc_if, param->open.conn_id); // DISCONNECT follows
+    } else {
+        closing_link_release(closing);
+    }
+    pool_service();
+}
+/**
+ * @brief route a GATTC event to its device, runs on the actor
+ */
+static void gattc_dispatch(actor_gattc_evt_t *evt)
+{
+    esp_gattc_cb_event_t event = evt->event;
+    esp_gatt_if_t gattc_if = evt->gattc_if;
+    esp_ble_gattc_cb_param_t *param = &evt->param;
+    int device_index = -1;
+
+    if (event == ESP_GATTC_REG_EVT) {
         
-    case ESP_GATTC_SEARCH_RES_EVT: {
-        // only 16 bit uuids
-        if (p_data->search_res.srvc_id.uuid.len == ESP_UUID_LEN_16 ){
-            // if uuid dosen't match adv service uuid skip
-            if (p_data->search_res.srvc_id.uuid.uuid.uuid16 != device_manager.devices[device_index].service_uuid){ 
+        device_manager.gattc_if = gattc_if;
+        ESP_LOGI(TAG, "Device manager assigned gattc_if %d", gattc_if);
+
+    } else {
+
+        switch(event) {
+            case ESP_GATTC_CONNECT_EVT:
+                device_index = find_device_by_mac(param->connect.remote_bda);
+                break;
+            case ESP_GATTC_OPEN_EVT:
+                device_index = find_device_by_mac(param->open.remote_bda);
+                break;
+            case ESP_GATTC_CFG_MTU_EVT:
+                device_index = find_device_by_conn(param->cfg_mtu.conn_id);
+                break;
+            case ESP_GATTC_SEARCH_RES_EVT:
+                device_index = find_device_by_conn(param->search_res.conn_id);
+                break;
+            case ESP_GATTC_SEARCH_CMPL_EVT:
+                device_index = find_device_by_conn(param->search_cmpl.conn_id);
+                break;
+            case ESP_GATTC_REG_FOR_NOTIFY_EVT:
+                // the event only has the handle, it belongs to the one outstanding registration
+                device_index = device_manager.notify_reg_device;
+                break;
+            case ESP_GATTC_NOTIFY_EVT:
+                device_index = find_device_by_conn(param->notify.conn_id);
                 break;
+            case ESP_GATTC_WRITE_CHAR_EVT:
+                device_index = find_device_by_conn(param->write.conn_id);
+                break;
+            case ESP_GATTC_CONGEST_EVT:
+                device_index = find_device_by_conn(param->congest.conn_id);
+                break;
+            case ESP_GATTC_DISCONNECT_EVT:
+                device_index = find_device_by_mac(param->disconnect.remote_bda);
+                break;
+            default:
+                break;
+        }
+        if (gattc_if != device_manager.gattc_if) {
+            ESP_LOGW(TAG, "Event %d for unknown gatt_if %d", event, gattc_if);
+            return;
+        }
+        const uint8_t *bda = event == ESP_GATTC_CONNECT_EVT ? param->connect.remote_bda :
+                             event == ESP_GATTC_OPEN_EVT ? param->open.remote_bda :
+                             event == ESP_GATTC_DISCONNECT_EVT ? param->disconnect.remote_bda : NULL;
+        int closing = bda ? closing_link_find(bda) : -1;
+        if (closing >= 0) {
+            closing_link_event(event, gattc_if, param, closing);
+            return;
+        }
+        if (device_index < 0) {
+            ESP_LOGD(TAG, "Event %d for unknown device", event);
+            if (event == ESP_GATTC_OPEN_EVT && param->open.status == ESP_GATT_OK) {
+                // an open nobody tracks went through, close it and hold its slot until then
+                esp_ble_gattc_close(gattc_if, param->open.conn_id);
+                closing_link_add(param->open.remote_bda, false);
+                pool_service();
+            } else if (event == ESP_GATTC_REG_FOR_NOTIFY_EVT) {
+                register_notify_next();
             }
-            ESP_LOGI(TAG, "Device %d: Found service Service UUID: 0x%0X", device_index, p_data->search_res.srvc_id.uuid.uuid.uuid16);
-            device->service_start_handle = p_data->search_res.start_handle;
-            device->service_end_handle = p_data->search_res.end_handle;
+            return;
         }
+        trace_record(TRACE_SUBSYS_DEVICE, TRACE_DEV_GATTC, (uint8_t)device_index, event, 0);
+        gattc_device_event_handler(event, gattc_if, param, device_index);
+        
+    }   
+}
+/**
+ * @brief  GATTC callback, copies the event to the actor
+ */
+static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param)
+{
+    UBaseType_t reserve = 0;
+
+    switch (event) {
+    case ESP_GATTC_REG_EVT:
+    case ESP_GATTC_CONNECT_EVT:
+    case ESP_GATTC_OPEN_EVT:
+    case ESP_GATTC_CFG_MTU_EVT:
+    case ESP_GATTC_SEARCH_RES_EVT:
+    case ESP_GATTC_SEARCH_CMPL_EVT:
+    case ESP_GATTC_REG_FOR_NOTIFY_EVT:
+    case ESP_GATTC_WRITE_CHAR_EVT:
+    case ESP_GATTC_CONGEST_EVT:
+    case ESP_GATTC_DISCONNECT_EVT:
+        break;
+    case ESP_GATTC_NOTIFY_EVT:
+        reserve = ACTOR_QUEUE_RESERVE; // the lamp reports its state again
         break;
+    default:
+        return; // not used by the device manager
+    }
+
+    actor_msg_t msg = {
+        .type = ACTOR_MSG_GATTC,
+        .gattc = {
+            .event = event,
+            .gattc_if = gattc_if,
+            .param = *param,
+        },
+    };
+    if (event == ESP_GATTC_NOTIFY_EVT) {
+        // the value buffer belongs to the stack, keep a copy
+        uint16_t len = param->notify.value_len;
+        if (len > NOTIFY_COPY_MAX) len = NOTIFY_COPY_MAX;
+        memcpy(msg.gattc.value, param->notify.value, len);
+        msg.gattc.param.notify.value_len = len;
+        msg.gattc.param.notify.value = NULL;
+    }
+    bool posted = actor_post(&msg, 0, reserve);
+    trace_record(TRACE_SUBSYS_GATTC, event, TRACE_NO_DEVICE, gattc_if, posted);
+    if (!posted && reserve == 0) {
+        ESP_LOGE(TAG, "Actor queue full, GATTC event %d lost", event);
+    }
+}
+/**
+ * @brief Add new device
+ */
+static void device_manager_add_device(esp_bd_addr_t mac, const char *name, uint16_t uuid, int8_t rssi,
+                                      const uint8_t *adv, uint8_t adv_len)
+{
+    if (device_manager.discovered_count >= MAX_DEVICES) {
+        ESP_LOGW(TAG, "Device limit reached (%d)", MAX_DEVICES);
+        return;
     }
     
-    case ESP_GATTC_SEARCH_CMPL_EVT:
-        if (p_data->search_cmpl.status != ESP_GATT_OK){
-            ESP_LOGE(TAG, "Device %d: service search failed = %x", device_index, p_data->search_cmpl.status);
-            break;
-        }
+    uint8_t index = device_manager.discovered_count;
+    flood_light_device_t *device = &device_manager.devices[index];
+                        
+    memcpy(device->mac_address, mac, ESP_BD_ADDR_LEN);
+    device->service_uuid = uuid;
+    device->rssi = rssi;
+    device->link.last_seen_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    memcpy(device->adv, adv, adv_len);
+    device->adv_len = adv_len;
 
-        ESP_LOGI(TAG, "Device %d: Service discovery complete", device_index);
+    if (name != NULL) {
+        strncpy(device->name, name, sizeof(device->name) - 1);
+        device->name[sizeof(device->name) - 1] = '\0';
+    } else {
+        // Generate a default name if no name available
+        snprintf(device->name, sizeof(device->name), "Unkown");
+    }
+    device->app_id = index;
+    device->lat_slot = (int8_t)latency_device_slot(mac);
 
-        // Get characteristics count
-        uint16_t count = 0;
-        esp_gatt_status_t status = esp_ble_gattc_get_attr_count(
-            gattc_if,
-            device->conn_id,
-            ESP_GATT_DB_CHARACTERISTIC,
-            device->service_start_handle,
-            device->service_end_handle,
-            INVALID_HANDLE,
-            &count);
+    gatt_cache_entry_t cached;
+    if (gatt_cache_load(mac, &cached) == ESP_OK && cached.service_uuid == uuid) {
+        device->service_start_handle = cached.service_start_handle;
+        device->service_end_handle = cached.service_end_handle;
+        device->write_char_handle = cached.write_char_handle;
+        device->char_handle = cached.char_handle;
+        device->cccd_handle = cached.cccd_handle;
+        device->handles_cached = true;
+    }
 
-        if (status != ESP_GATT_OK || count == 0) {
-            ESP_LOGE(TAG, "Device %d: No characteristics found", device_index);
-            break;
-        }
+    if (!device_registry_add(device->mac_address, index)) {
+        ESP_LOGE(TAG, "Failed to index device #%d", index);
+        memset(device, 0, sizeof(*device));
+        return;
+    }
 
-        esp_gattc_char_elem_t *char_elem_result = malloc(sizeof(esp_gattc_char_elem_t) * count);
-        if (!char_elem_result) {
-            ESP_LOGE(TAG, "Device %d: No memory for characteristics", device_index);
-            break;
-        }
+    whitelist_add(device->mac_address);
 
-        // LOOK FOR NOTIFY CHARACTERISTIC 
-        esp_bt_uuid_t notify_uuid = {
-            .len = ESP_UUID_LEN_16,
-            .uuid = {.uuid16 = device_manager.devices[device_index].service_uuid + 2,},
-        };
+    ESP_LOGI(TAG, "Discovered device #%d, %s", index, device->name);
+    ESP_LOG_BUFFER_HEX(TAG, mac, ESP_BD_ADDR_LEN);
 
-        uint16_t notify_count = count;
-        esp_gatt_status_t st1 = esp_ble_gattc_get_char_by_uuid(
-            gattc_if,
-            device->conn_id,
-            device->service_start_handle,
-            device->service_end_handle,
-            notify_uuid,
-            char_elem_result,
-            &notify_count);
+    device_manager.discovered_count++;
+    trace_record(TRACE_SUBSYS_DEVICE, TRACE_DEV_ADDED, index, (uint32_t)rssi, 0);
+#ifdef CONFIG_BTHUB_CONNECT_PREFETCH
+    if (!device->handles_cached) {
+        // resolve the handles while idle, opened once the scan is over
+        conn_sched_request(&conn_sched, index, CONN_PRIO_BACKGROUND);
+    }
+#endif
 
-        if (st1 == ESP_GATT_OK && notify_count > 0 && 
-            (char_elem_result[0].properties & ESP_GATT_CHAR_PROP_BIT_NOTIFY)) {
-            device->char_handle = char_elem_result[0].char_handle;
-            esp_ble_gattc_register_for_notify(gattc_if, device->mac_address, char_elem_result[0].char_handle);
-            ESP_LOGD(TAG, "Device %d: Registered for notifications (handle 0x%08x)", device_index, device->char_handle);
+    // Notify callback
+    if (device_manager.device_found_cb) {
+        device_manager.device_found_cb(device->mac_address , device->name);
+    }
+
+    // Check if we found all devices
+    if (device_manager.discovered_count >= MAX_DEVICES) {
+
+        device_manager.all_devices_found = true;
+        ESP_LOGI(TAG, "All %d devices found!", MAX_DEVICES);
+                            
+        if (device_manager.all_devices_found_cb) {
+            device_manager.all_devices_found_cb();
+        }
+    }
+}
+/**
+ * @brief mirror the filter switches into the compiled filter
+ */
+static void compile_adv_filter(void)
+{
+    device_manager.filter.by_name = device_manager.by_name;
+    device_manager.filter.by_uuid = device_manager.by_uuid;
+}
+/**
+ * @brief rebuild the lookup tables after the device table was compacted
+ */
+static void reindex_devices(void)
+{
+    device_registry_reset();
+    for (int i = 0; i < device_manager.discovered_count; i++) {
+        const flood_light_device_t *device = &device_manager.devices[i];
+        device_registry_add(device->mac_address, i);
+        if (device->connected) {
+            device_registry_set_conn(device->conn_id, i);
         }
+    }
+}
+/**
+ * @brief drop a device, the last device moves into its slot so the table
+ * stays dense. Call reindex_devices() once done removing.
+ */
+static void remove_device(int device_index)
+{
+    flood_light_device_t *device = &device_manager.devices[device_index];
+    ESP_LOGI(TAG, "Dropping device #%d, %s", device_index, device->name);
+    trace_record(TRACE_SUBSYS_DEVICE, TRACE_DEV_REMOVED, (uint8_t)device_index, 0, 0);
 
-        esp_bt_uuid_t write_uuid = {
-            .len = ESP_UUID_LEN_16,
-            .uuid = {.uuid16 = device_manager.devices[device_index].service_uuid + 1,},
-        };
+    conn_sched_drop(&conn_sched, device_index);
+    if (device->connected) {
+        // the link stays in use until its disconnect event, even if the lamp passes the filter again
+        disconnect_from_device(device_index);
+        device_manager.conn_count--;
+        closing_link_add(device->mac_address, false);
+    } else if (device->connecting) {
+        // cancel the open, its OPEN or DISCONNECT event releases the slot and lets the next open start
+        esp_ble_gap_disconnect(device->mac_address);
+        closing_link_add(device->mac_address, true);
+    }
+    whitelist_remove(device->mac_address);
+    if (device_manager.notify_reg_device == device_index) {
+        device_manager.notify_reg_device = NOTIFY_REG_ORPHAN; // its event is discarded
+    }
+
+    int last = device_manager.discovered_count - 1;
+    if (device_index != last) {
+        *device = device_manager.devices[last];
+        device->app_id = device_index;
+        device_actor.send_armed[device_index] = device_actor.send_armed[last];
+        device_actor.send_at[device_index] = device_actor.send_at[last];
+        conn_sched_move(&conn_sched, last, device_index);
+        if (device_manager.notify_reg_device == last) device_manager.notify_reg_device = device_index;
+    }
+    memset(&device_manager.devices[last], 0, sizeof(flood_light_device_t));
+    device_actor.send_armed[last] = false;
+    device_manager.discovered_count--;
+    device_manager.all_devices_found = false;
+}
+/**
+ * @brief re-check the device table against a changed filter. Devices that
+ * still match keep their links, the others are dropped and scanning only
+ * looks for the free slots.
+ */
+static void refilter_devices(void)
+{
+    uint8_t before = device_manager.discovered_count;
 
-        uint16_t write_count = count;
-        esp_gatt_status_t st2 = esp_ble_gattc_get_char_by_uuid(
-            gattc_if,
-            device->conn_id,
-            device->service_start_handle,
-            device->service_end_handle,
-            write_uuid,
-            char_elem_result,
-            &write_count);
+    for (int i = device_manager.discovered_count - 1; i >= 0; i--) {
+        const flood_light_device_t *device = &device_manager.devices[i];
+        if (device->adv_len == 0) continue; // nothing to judge by
 
-        if (st2 == ESP_GATT_OK && write_count > 0 &&
-            (char_elem_result[0].properties & (ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_WRITE_NR))) {
-            device->write_char_handle = char_elem_result[0].char_handle;
-            ESP_LOGD(TAG, "Device %d: Found write characteristic (handle 0x%08x)", device_index, device->write_char_handle);
-        } else {
-            ESP_LOGW(TAG, "Device %d: write characteristic not found", device_index);
+        adv_fields_t fields;
+        adv_parse(device->adv, device->adv_len, &fields);
+        if (!adv_filter_match(&device_manager.filter, &fields, NULL)) {
+            remove_device(i);
+        }
+    }
+    if (device_manager.discovered_count != before) {
+        reindex_devices();
+        pool_service(); // an open of a dropped device may have been cancelled
+    }
+    reject_cache_reset(); // rejected adverts may pass now
+    ESP_LOGI(TAG, "Filter applied, kept %d/%d devices", device_manager.discovered_count, before);
+
+    if (device_manager.discovered_count >= MAX_DEVICES) return;
+
+    device_manager.all_devices_found = false;
+    device_manager.scan_left_s = 0; // start over with the new filter
+    scan_scheduler_reset();
+#ifdef CONFIG_BTHUB_SCAN_WHITELIST
+    device_manager.scans_since_open = OPEN_SCAN_EVERY - 1; // next scan accepts all advertisers
+#endif
+    if (!device_manager.scanning) {
+        stop_scan_timer();
+        start_scanning();
+    }
+}
+/**
+ * @brief an active scan may report an advert before its scan response,
+ * only cache a reject once the name had a chance to show up
+ */
+static bool adv_report_complete(const actor_gap_evt_t *evt)
+{
+    const scan_profile_t *profile = scan_scheduler_profile(device_manager.scan_profile_applied);
+    if (profile->params.scan_type == BLE_SCAN_TYPE_PASSIVE) return true;
+
+    return evt->scan_rsp_len > 0 ||
+           evt->ble_evt_type == ESP_BLE_EVT_NON_CONN_ADV ||
+           evt->ble_evt_type == ESP_BLE_EVT_SCAN_RSP;
+}
+/**
+ * @brief GAP event handler, runs on the actor
+ */
+static void gap_event_handler(const actor_gap_evt_t *evt)
+{
+    switch (evt->event) {
+    case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT:
+        if (evt->status != ESP_BT_STATUS_SUCCESS) {
+            ESP_LOGE(TAG, "Scan params rejected, keeping previous profile");
+            device_manager.scan_profile_applied = SCAN_PROFILE_COUNT;
+        }
+        if (device_manager.scanning) {
+            esp_ble_gap_start_scanning(device_manager.scan_run_s);
         }
-        free(char_elem_result);
-        send_pending_commands(device_index);
         break;
-
-        
-    case ESP_GATTC_REG_FOR_NOTIFY_EVT:{
         
-        esp_gatt_status_t status = p_data->reg_for_notify.status;
-
-        if (status != ESP_GATT_OK) {
-            ESP_LOGE(TAG, "Device %d: notify registration failed (0x%x)",   device_index, status);
-            break;
+    case ESP_GAP_BLE_SCAN_START_COMPLETE_EVT:
+        if (!(evt->status == ESP_BT_STATUS_SUCCESS)) {
+             ESP_LOGE(TAG, "Scan start failed");
         }
-
-        uint16_t handle = p_data->reg_for_notify.handle;
+        break;
         
-        if (device_index < 0) {
-            ESP_LOGW(TAG, "REG_FOR_NOTIFY_EVT: Unknown handle=0x%04x", handle);
-            break;
-        }
+    case ESP_GAP_BLE_SCAN_RESULT_EVT:
+        switch (evt->search_evt) {
+        case ESP_GAP_SEARCH_INQ_RES_EVT: {
+            uint8_t adv_len = evt->adv_data_len + evt->scan_rsp_len;
+            int idx = find_device_by_mac(evt->bda);
+            if (idx >= 0) {
+                flood_light_device_t *device = &device_manager.devices[idx];
+                device->rssi = evt->rssi;
+                device->link.last_seen_ms = (uint32_t)(esp_timer_get_time() / 1000);
+                if (reconnect_seen(&device->reconnect)) {
+                    ESP_LOGI(TAG, "Device %d advertises again", idx);
+                    set_available(idx, true);
+                }
+                if (adv_len > device->adv_len) {
+                    // keep the fullest report, scan responses come after the advert
+                    memcpy(device->adv, evt->adv, adv_len);
+                    device->adv_len = adv_len;
+                }
+                break; // device already registered update rssi and exit
+            }
+            if (device_manager.all_devices_found) 
+                break;
 
-        flood_light_device_t *device = &device_manager.devices[device_index];
+            uint32_t now_ms = pdTICKS_TO_MS(xTaskGetTickCount());
+            if (reject_cache_contains(evt->bda, now_ms))
+                break; // rejected recently, skip parsing
 
-        uint16_t count = 0;
-        esp_gatt_status_t ret_status = esp_ble_gattc_get_attr_count(
-            gattc_if,
-            device->conn_id,
-            ESP_GATT_DB_DESCRIPTOR,
-            device->service_start_handle,
-            device->service_end_handle,
-            handle,
-            &count
-        );
+            adv_fields_t fields;
+            if (!adv_parse(evt->adv, adv_len, &fields)) {
+                ESP_LOGD(TAG, "Malformed advertisement");
+            }
+            uint16_t service_uuid;
+            if (!adv_filter_match(&device_manager.filter, &fields, &service_uuid)) {
+                if (adv_report_complete(evt)) {
+                    reject_cache_add(evt->bda, now_ms);
+                }
+                break; // name or uuid didn't match skip
+            }
+            if (service_uuid == 0) {
+                // the write and notify characteristics are found from the 16-bit service UUID,
+                // a lamp without one could be listed but never controlled
+                if (adv_report_complete(evt)) {
+                    reject_cache_add(evt->bda, now_ms);
+                }
+                break;
+            }
+
+            char tmp_name[32]= {0};
+            if (fields.name_len > 0) {
+                uint8_t name_len = fields.name_len;
+                if (name_len >= sizeof(tmp_name)) name_len = sizeof(tmp_name) - 1; // limit lenght to 32
 
-        if (ret_status != ESP_GATT_OK || count == 0) {
-            ESP_LOGE(TAG, "Device %d: no descriptors found (ret=0x%x)", device_index, ret_status);
+                memcpy(tmp_name, fields.name, name_len);
+            }
+            esp_bd_addr_t mac;
+            memcpy(mac, evt->bda, sizeof(mac));
+            device_manager_add_device(mac, fields.name_len > 0 ? tmp_name : NULL,
+                                      service_uuid, evt->rssi, evt->adv, adv_len);
+        
             break;
         }
 
-        esp_gattc_descr_elem_t *descr_elem_result = malloc(sizeof(esp_gattc_descr_elem_t) * count);
-        if (!descr_elem_result) {
-            ESP_LOGE(TAG, "Device %d: out of memory for descriptors", device_index);
+        case ESP_GAP_SEARCH_INQ_CMPL_EVT:
+            
+            ESP_LOGI(TAG, "Scan completed, found %d/%d devices.", 
+                        device_manager.discovered_count, MAX_DEVICES);
+            device_manager.scanning = false;
+            scan_scheduler_scan_done(device_manager.discovered_count > device_manager.scan_found_at_start,
+                                     device_manager.discovered_count >= MAX_DEVICES);
+            start_scan_timer();
+            pool_service(); // background opens wait for the scan to end
+            break;
+            
+        default:
             break;
         }
-
-        esp_bt_uuid_t notify_descr_uuid = {
-            .len = ESP_UUID_LEN_16,
-            .uuid = {.uuid16 = ESP_GATT_UUID_CHAR_CLIENT_CONFIG}
-        };
-
-        ret_status = esp_ble_gattc_get_descr_by_char_handle(
-            gattc_if,
-            device->conn_id,
-            handle,
-            notify_descr_uuid,
-            descr_elem_result,
-            &count
-        );
-
-        if (ret_status == ESP_GATT_OK && count > 0 &&
-            descr_elem_result[0].uuid.len == ESP_UUID_LEN_16 &&
-            descr_elem_result[0].uuid.uuid.uuid16 == ESP_GATT_UUID_CHAR_CLIENT_CONFIG) {
-
-            uint16_t notify_en = 1;
-            ret_status = esp_ble_gattc_write_char_descr(
-                gattc_if,
-                device->conn_id,
-                descr_elem_result[0].handle,
-                sizeof(notify_en),
-                (uint8_t *)&notify_en,
-                ESP_GATT_WRITE_TYPE_RSP,
-                ESP_GATT_AUTH_REQ_NONE
-            );
-
-            if (ret_status == ESP_GATT_OK) {
-                ESP_LOGI(TAG, "Device %d: notifications enabled", device_index);
+        break;
+    
+    case ESP_GAP_BLE_UPDATE_WHITELIST_COMPLETE_EVT:
+        if (evt->status == ESP_BT_STATUS_SUCCESS) {
+            if (evt->wl_operation == ESP_BLE_WHITELIST_ADD) {
+                device_manager.whitelist_size++;
+            } else if (evt->wl_operation == ESP_BLE_WHITELIST_REMOVE) {
+                if (device_manager.whitelist_size) device_manager.whitelist_size--;
             } else {
-                ESP_LOGE(TAG, "Device %d: failed to enable notifications (ret=0x%x)", device_index, ret_status);
+                device_manager.whitelist_size = 0;
             }
-        } else {
-            ESP_LOGW(TAG, "Device %d: no valid CCC descriptor found", device_index);
+        } else if (evt->wl_operation != ESP_BLE_WHITELIST_CLEAR) {
+            // list full, or out of step with the table: known devices would be missed
+            // or dropped ones still wake the host
+            ESP_LOGW(TAG, "Accept list %s failed, using open scans",
+                     evt->wl_operation == ESP_BLE_WHITELIST_ADD ? "add" : "remove");
+            device_manager.whitelist_failed = true;
+            device_manager.scan_profile_applied = SCAN_PROFILE_COUNT; // reload params on next scan
         }
+        break;
 
-        free(descr_elem_result);
+    case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT: {
+        int idx = find_device_by_mac(evt->bda);
+        if (idx < 0 || !device_manager.devices[idx].connected) break;
+        conn_params_t *cp = &device_manager.devices[idx].conn_params;
+        conn_params_updated(cp, evt->status == ESP_BT_STATUS_SUCCESS, evt->conn_int, evt->latency, evt->timeout,
+                            esp_timer_get_time());
+        if (evt->status == ESP_BT_STATUS_SUCCESS) {
+            ESP_LOGI(TAG, "Device %d: %s connection, interval %u.%02u ms, latency %u, timeout %u ms", idx,
+                     conn_params_mode_name(cp->mode), cp->interval * 125 / 100, cp->interval * 125 % 100,
+                     cp->latency, cp->timeout * 10);
+        } else {
+            ESP_LOGW(TAG, "Device %d: connection parameter update refused, status %d", idx, evt->status);
+        }
         break;
     }
 
-
-    case ESP_GATTC_NOTIFY_EVT:
-        ESP_LOGI(TAG, "Device %d: Received notification", device_index);
-        ESP_LOG_BUFFER_HEX_LEVEL(TAG, p_data->notify.value, p_data->notify.value_len, ESP_LOG_DEBUG);
-        decode_notification(device_index,p_data->notify.value, p_data->notify.value_len);
-        break;
-        
-    case ESP_GATTC_DISCONNECT_EVT:
-        ESP_LOGI(TAG, "Device %d: Disconnected", device_index);
-        device->connected = false;
-        device->conn_id = 0;
-        device->char_handle = 0;
-        device_manager.conn_count--;
-        
-        // Notify callback
-        if (device_manager.device_disconnected_cb) {
-            device_manager.device_disconnected_cb(device_index);
+    case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT:
+        if (evt->status != ESP_BT_STATUS_SUCCESS){
+            ESP_LOGE(TAG, "Scan stop failed");
+        } else {
+            ESP_LOGI(TAG, "Scan stopped successfully");
+            device_manager.scanning = false;
         }
         break;
         
@@ -667,260 +2277,584 @@ static void gattc_device_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t
     }
 }
 /**
- * @brief find app id of device with this mac
- * @param mac_addr mac address
- * @return device app id (int)
- */ 
-static int find_device_by_mac(const esp_bd_addr_t mac_addr)
+ * @brief GAP callback, copies the fields the actor needs
+ */
+static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
 {
-    for (int i = 0; i < device_manager.discovered_count; i++) {
-        if (memcmp(device_manager.devices[i].mac_address, mac_addr, ESP_BD_ADDR_LEN) == 0) {
-            return i;
+    actor_msg_t msg = {
+        .type = ACTOR_MSG_GAP,
+        .gap = { .event = event },
+    };
+    actor_gap_evt_t *evt = &msg.gap;
+    UBaseType_t reserve = 0;
+
+    switch (event) {
+    case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT:
+        evt->status = param->scan_param_cmpl.status;
+        break;
+    case ESP_GAP_BLE_SCAN_START_COMPLETE_EVT:
+        evt->status = param->scan_start_cmpl.status;
+        break;
+    case ESP_GAP_BLE_SCAN_RESULT_EVT:
+        evt->search_evt = param->scan_rst.search_evt;
+        if (evt->search_evt == ESP_GAP_SEARCH_INQ_RES_EVT) {
+            reserve = ACTOR_QUEUE_RESERVE; // the device advertises again
+            memcpy(evt->bda, param->scan_rst.bda, sizeof(evt->bda));
+            evt->rssi = param->scan_rst.rssi;
+            evt->ble_evt_type = param->scan_rst.ble_evt_type;
+            evt->adv_data_len = param->scan_rst.adv_data_len;
+            evt->scan_rsp_len = param->scan_rst.scan_rsp_len;
+            if (evt->adv_data_len + evt->scan_rsp_len > sizeof(evt->adv)) {
+                evt->adv_data_len = 0;
+                evt->scan_rsp_len = 0;
+            }
+            memcpy(evt->adv, param->scan_rst.ble_adv, evt->adv_data_len + evt->scan_rsp_len);
         }
+        break;
+    case ESP_GAP_BLE_UPDATE_WHITELIST_COMPLETE_EVT:
+        evt->status = param->update_whitelist_cmpl.status;
+        evt->wl_operation = param->update_whitelist_cmpl.wl_operation;
+        break;
+    case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT:
+        evt->status = param->scan_stop_cmpl.status;
+        break;
+    case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+        evt->status = param->update_conn_params.status;
+        memcpy(evt->bda, param->update_conn_params.bda, sizeof(evt->bda));
+        evt->conn_int = param->update_conn_params.conn_int;
+        evt->latency = param->update_conn_params.latency;
+        evt->timeout = param->update_conn_params.timeout;
+        break;
+    default:
+        return; // not used by the device manager
+    }
+
+    bool posted = actor_post(&msg, 0, reserve);
+    if (event != ESP_GAP_BLE_SCAN_RESULT_EVT || evt->search_evt != ESP_GAP_SEARCH_INQ_RES_EVT) {
+        // adverts would flush the ring within seconds, the actor traces new devices
+        trace_record(TRACE_SUBSYS_GAP, event, TRACE_NO_DEVICE,
+                     event == ESP_GAP_BLE_SCAN_RESULT_EVT ? evt->search_evt : evt->status, posted);
+    }
+    if (!posted && reserve == 0) {
+        ESP_LOGE(TAG, "Actor queue full, GAP event %d lost", event);
     }
-    return -1; // Not found
 }
 /**
- * @brief find device index of the device with this char handle (needed for esp_gattc_cb)
- * @param handle char handle
- * @return device index (int)
+ * @brief time the reconnect policy of a device needs the actor, 0 if never
+ */
+static int64_t reconnect_due_us(const flood_light_device_t *device)
+{
+    if (device->reconnect.state == RECONNECT_CONNECTING && !device->connecting) return 0;
+    if (device->reconnect.state == RECONNECT_BACKOFF &&
+        conn_sched_priority(&conn_sched, device - device_manager.devices) == CONN_PRIO_NONE) return 0;
+    return reconnect_next_us(&device->reconnect);
+}
+/**
+ * @brief ticks until the earliest armed deferred send, connect deadline,
+ * retry, discovery or reset timeout, portMAX_DELAY if none
  */
-static int find_device_by_notify_handle(uint16_t handle) {
+static TickType_t actor_next_wait(void)
+{
+    TickType_t now = xTaskGetTickCount();
+    TickType_t wait = portMAX_DELAY;
+
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        if (!device_actor.send_armed[i]) continue;
+        int32_t left = (int32_t)(device_actor.send_at[i] - now);
+        if (left <= 0) return 0;
+        if ((TickType_t)left < wait) wait = (TickType_t)left;
+    }
+
+    int64_t now_us = esp_timer_get_time();
+    if (device_manager.reset_due_us) {
+        if (device_manager.reset_due_us <= now_us) return 0;
+        TickType_t left = pdMS_TO_TICKS((device_manager.reset_due_us - now_us + 999) / 1000) + 1;
+        if (left < wait) wait = left;
+    }
     for (int i = 0; i < device_manager.discovered_count; i++) {
-        if (device_manager.devices[i].char_handle == handle) {
-            return i;
+        const flood_light_device_t *device = &device_manager.devices[i];
+        int64_t due_us[] = {
+            reconnect_due_us(device),
+            device->connected ? conn_params_due_us(&device->conn_params) : 0,
+            device->connected ? write_pipe_due_us(&device->write_pipe) : 0,
+            device->connected ? device->discovery_due_us : 0,
+        };
+        for (size_t k = 0; k < sizeof(due_us) / sizeof(due_us[0]); k++) {
+            if (due_us[k] == 0) continue;
+            if (due_us[k] <= now_us) return 0;
+            TickType_t left = pdMS_TO_TICKS((due_us[k] - now_us + 999) / 1000) + 1;
+            if (left < wait) wait = left;
         }
     }
-    return -1;
+    return wait;
 }
 /**
- * @brief find device index of the device with this connection id (needed for esp_gattc_cb)
- * @param conn_id connection id
- * @return device index (int)
+ * @brief move links that stopped receiving commands to the idle parameters
  */
-static int find_device_by_conn(uint16_t conn_id)
+static void conn_params_service_all(void)
 {
+    int64_t now_us = esp_timer_get_time();
     for (int i = 0; i < device_manager.discovered_count; i++) {
-         if (device_manager.devices[i].conn_id == conn_id) {
-            return i;
-        }
+        flood_light_device_t *device = &device_manager.devices[i];
+        if (!device->connected) continue;
+        request_conn_params(i, conn_params_service(&device->conn_params, now_us));
     }
-    return -1; // Not found
 }
 /**
- * @brief  GATTC callback
+ * @brief reclaim credits of writes whose completion never came
  */
-static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param)
+static void write_pipes_service(void)
 {
-    int device_index = -1;
+    int64_t now_us = esp_timer_get_time();
+    for (int i = 0; i < device_manager.discovered_count; i++) {
+        flood_light_device_t *device = &device_manager.devices[i];
+        if (!device->connected) continue;
+        uint8_t expired = write_pipe_expire(&device->write_pipe, now_us);
+        if (expired == 0) continue;
+        write_pipes.timeouts += expired;
+        ESP_LOGW(TAG, "Device %d: %u write(s) without completion", i, expired);
+        write_pump(i);
+    }
+}
+/**
+ * @brief close links whose discovery ran past its deadline
+ */
+static bool discovery_service(void)
+{
+    int64_t now_us = esp_timer_get_time();
+    bool changed = false;
 
-    if (event == ESP_GATTC_REG_EVT) {
-        
-        device_manager.gattc_if = gattc_if;
-        ESP_LOGI(TAG, "Device manager assigned gattc_if %d", gattc_if);
+    for (int i = 0; i < device_manager.discovered_count; i++) {
+        const flood_light_device_t *device = &device_manager.devices[i];
+        if (!device->connected || device->discovery_due_us == 0 || device->discovery_due_us > now_us) continue;
 
-    } else {
+        ESP_LOGW(TAG, "Device %d: no write characteristic after %d s", i, DISCOVERY_TIMEOUT_US / 1000000);
+        discovery_failed(i);
+        changed = true;
+    }
+    return changed;
+}
+/**
+ * @brief cut off connect attempts past their deadline and start the retries
+ * whose backoff ended
+ */
+static bool reconnect_service(void)
+{
+    int64_t now_us = esp_timer_get_time();
+    bool retry = false;
+    bool changed = false;
 
-        switch(event) {
-            case ESP_GATTC_OPEN_EVT:
-                device_index = find_device_by_mac(param->open.remote_bda);
-                break;
-            case ESP_GATTC_CFG_MTU_EVT:
-                device_index = find_device_by_conn(param->cfg_mtu.conn_id);
-                break;
-            case ESP_GATTC_SEARCH_RES_EVT:
-                device_index = find_device_by_conn(param->search_res.conn_id);
-                break;
-            case ESP_GATTC_SEARCH_CMPL_EVT:
-                device_index = find_device_by_conn(param->search_cmpl.conn_id);
-                break;
-            case ESP_GATTC_REG_FOR_NOTIFY_EVT:
-                device_index = find_device_by_notify_handle(param->reg_for_notify.handle);
-                break;
-            case ESP_GATTC_NOTIFY_EVT:
-                device_index = find_device_by_conn(param->notify.conn_id);
-                break;
-            case ESP_GATTC_DISCONNECT_EVT:
-                device_index = find_device_by_mac(param->disconnect.remote_bda);
-                break;
-            default:
-                break;
-        }
-        if (gattc_if != device_manager.gattc_if) {
-            ESP_LOGW(TAG, "Event %d for unknown gatt_if %d", event, gattc_if);
-            return;
+    for (int i = 0; i < device_manager.discovered_count; i++) {
+        flood_light_device_t *device = &device_manager.devices[i];
+        int64_t due_us = reconnect_due_us(device);
+        if (due_us == 0 || due_us > now_us) continue;
+
+        changed = true;
+        if (device->connecting && reconnect_timed_out(&device->reconnect, now_us)) {
+            ESP_LOGW(TAG, "Device %d: no connection after %d ms, giving up this attempt",
+                     i, CONFIG_BTHUB_CONNECT_TIMEOUT_MS);
+            reconnects.timeouts++;
+            // cancel the pending open so the next attempt or device gets the radio
+            esp_ble_gap_disconnect(device->mac_address);
+            device->open_abandoned = true;
+            connect_failed(i, now_us);
+        } else if (reconnect_may_connect(&device->reconnect, now_us)) {
+            retry = true;
         }
-        gattc_device_event_handler(event, gattc_if, param, device_index);
-        
-    }   
+    }
+    if (retry) {
+        pool_service();
+    }
+    return changed;
 }
 /**
- * @brief Add new device
+ * @brief counters owned by the actor, queue depth and drops are read live
  */
-static void device_manager_add_device(esp_bd_addr_t mac, const char *name, uint16_t uuid, int8_t rssi)
+static void fill_stats(ble_stats_t *stats)
 {
-    if (device_manager.discovered_count >= MAX_DEVICES) {
-        ESP_LOGW(TAG, "Device limit reached (%d)", MAX_DEVICES);
-        return;
+    stats->pool_size = MAX_CONNECTIONS;
+    stats->pool_in_use = pool_links_in_use();
+    stats->pool_hits = conn_pool.hits;
+    stats->pool_misses = conn_pool.misses;
+    stats->pool_evictions = conn_pool.evictions;
+    stats->conn_queued = conn_sched.queued;
+    stats->conn_queue_peak = conn_sched.queued_peak;
+    stats->opens_command = conn_sched.opens[CONN_PRIO_COMMAND];
+    stats->opens_warmup = conn_sched.opens[CONN_PRIO_WARMUP];
+    stats->opens_background = conn_sched.opens[CONN_PRIO_BACKGROUND];
+    stats->connect_timeouts = reconnects.timeouts;
+    stats->connect_retries = reconnects.retries;
+    stats->breaker_trips = reconnects.breaker_trips;
+    stats->fast_fails = reconnects.fast_fails;
+    stats->unreachable = 0;
+    stats->write_waiting = 0;
+    stats->write_in_flight = 0;
+    for (int i = 0; i < device_manager.discovered_count; i++) {
+        const flood_light_device_t *device = &device_manager.devices[i];
+        if (device->offline) stats->unreachable++;
+        stats->write_waiting += device->write_pipe.wait_count;
+        stats->write_in_flight += device->write_pipe.in_flight;
+    }
+    stats->write_credits = WRITE_PIPE_CREDITS;
+    stats->write_completed = write_pipes.completed;
+    stats->write_superseded = write_pipes.superseded;
+    stats->write_overflows = write_pipes.overflows;
+    stats->write_retries = write_pipes.retries;
+    stats->write_congestions = write_pipes.congestions;
+    stats->write_timeouts = write_pipes.timeouts;
+    stats->scan_profile = scan_scheduler_profile(scan_scheduler_current())->name;
+    stats->scan_backoff = scan_scheduler_backoff();
+    stats->scan_paused = device_manager.scan_paused;
+    stats->scan_pauses = device_manager.scan_pauses;
+    stats->scan_yields = device_manager.scan_yields;
+    uint64_t held_us = device_manager.scan_held_us;
+    if (device_manager.scan_held_since_us) held_us += esp_timer_get_time() - device_manager.scan_held_since_us;
+    stats->scan_held_ms = (uint32_t)(held_us / 1000);
+    stats->scan_whitelist = device_manager.scan_whitelist_applied;
+    stats->whitelist_size = device_manager.whitelist_size;
+    reject_cache_get_stats(&stats->reject_hits, &stats->reject_lookups, &stats->reject_entries);
+
+    stats->actor_queue_len = ACTOR_QUEUE_LEN;
+    stats->actor_queue_peak = device_actor.queue_peak;
+    stats->actor_processed = device_actor.processed;
+    if (device_actor.processed) {
+        stats->actor_wait_avg_us = (uint32_t)(device_actor.wait_us_total / device_actor.processed);
+        stats->actor_service_avg_us = (uint32_t)(device_actor.service_us_total / device_actor.processed);
+    }
+    stats->actor_wait_max_us = device_actor.wait_us_max;
+    stats->actor_service_max_us = device_actor.service_us_max;
+}
+static void device_record(int device_index, ble_device_record_t *record)
+{
+    const flood_light_device_t *device = &device_manager.devices[device_index];
+
+    memset(record, 0, sizeof(*record)); // records are compared with memcmp
+    memcpy(record->mac, device->mac_address, sizeof(record->mac));
+    record->index = device->app_id;
+    record->connected = device->connected;
+    record->uuid = device->service_uuid;
+    record->rssi = device->rssi;
+    record->available = !device->offline;
+    record->conn_state = device->reconnect.state;
+    if (device->connected) {
+        record->conn_mode = device->conn_params.mode;
+        record->conn_interval = device->conn_params.interval;
+        record->conn_latency = device->conn_params.latency;
+        record->conn_timeout = device->conn_params.timeout;
+    }
+    record->conn_updates = device->conn_params.updates;
+    record->conn_refusals = device->conn_params.refusals;
+    memcpy(record->name, device->name, sizeof(record->name));
+    record->link = device->link;
+}
+/**
+ * @brief the part of a record that moves the generation. Counters that run
+ * with every advert, write or notification are left out and RSSI counts in
+ * 8 dB steps, otherwise a scan alone would invalidate every ?since= copy
+ */
+static void record_key(const ble_device_record_t *record, ble_device_record_t *key)
+{
+    memcpy(key, record, sizeof(*key));
+    key->rssi /= 8;
+    key->link.writes = 0;
+    key->link.write_failures = 0;
+    key->link.notifies = 0;
+    key->link.last_seen_ms = 0;
+}
+static bool record_changed(const ble_device_record_t *a, const ble_device_record_t *b)
+{
+    ble_device_record_t key_a, key_b;
+    record_key(a, &key_a);
+    record_key(b, &key_b);
+    return memcmp(&key_a, &key_b, sizeof(key_a)) != 0;
+}
+/**
+ * @brief publish the device table, the generation only moves when more than
+ * the free running counters changed
+ */
+static void publish_devices(void)
+{
+    ble_devices_t *pub = &snapshot.devices;
+    bool changed = pub->count != device_manager.discovered_count ||
+                   pub->conn_count != device_manager.conn_count;
+    bool stale = changed;
+
+    for (int i = 0; i < device_manager.discovered_count && !changed; i++) {
+        ble_device_record_t record;
+        device_record(i, &record);
+        if (memcmp(&record, &pub->devices[i], sizeof(record)) == 0) continue;
+        stale = true;
+        changed = record_changed(&record, &pub->devices[i]);
+    }
+    if (!stale) return;
+
+    seq_write_begin(&snapshot.devices_seq);
+    pub->count = device_manager.discovered_count;
+    pub->conn_count = device_manager.conn_count;
+    for (int i = 0; i < device_manager.discovered_count; i++) {
+        device_record(i, &pub->devices[i]);
     }
-    
-    uint8_t index = device_manager.discovered_count;
-    flood_light_device_t *device = &device_manager.devices[index];
-                        
-    memcpy(device->mac_address, mac, ESP_BD_ADDR_LEN);
-    device->service_uuid = uuid;
-    device->rssi = rssi;
+    if (changed) pub->generation++;
+    seq_write_end(&snapshot.devices_seq);
+}
+/**
+ * @brief copy the reader visible state out of the actor
+ */
+static void publish_snapshot(void)
+{
+    publish_devices();
 
-    if (name != NULL) {
-        strncpy(device->name, name, sizeof(device->name) - 1);
-        device->name[sizeof(device->name) - 1] = '\0';
-    } else {
-        // Generate a default name if no name available
-        snprintf(device->name, sizeof(device->name), "Unkown");
-    }
-    device->app_id = index;
+    seq_write_begin(&snapshot.stats_seq);
+    fill_stats(&snapshot.stats);
+    seq_write_end(&snapshot.stats_seq);
+}
 
-    ESP_LOGI(TAG, "Discovered device #%d, %s", index, device->name);
-    ESP_LOG_BUFFER_HEX(TAG, mac, ESP_BD_ADDR_LEN);
+static void actor_dispatch(actor_msg_t *msg)
+{
+    switch (msg->type) {
+    case ACTOR_MSG_GATTC:
+        if (msg->gattc.event == ESP_GATTC_NOTIFY_EVT) {
+            msg->gattc.param.notify.value = msg->gattc.value;
+        }
+        gattc_dispatch(&msg->gattc);
+        break;
+    case ACTOR_MSG_GAP:
+        gap_event_handler(&msg->gap);
+        break;
+    case ACTOR_MSG_SCAN_TIMER:
+        start_scanning();
+        break;
+    case ACTOR_MSG_COMMAND: {
+        int device_index = find_device_by_mac(msg->command.mac);
+        trace_command(device_index, msg, esp_timer_get_time());
+        control_device(device_index, msg->command.op.opcode,
+                       msg->command.op.payload, msg->command.op.payload_len);
+        break;
+    }
+    case ACTOR_MSG_CALL:
+        msg->call.fn(msg->call.arg);
+        publish_snapshot(); // the caller may read right after it wakes
+        xSemaphoreGive(msg->call.done);
+        break;
+    default:
+        break;
+    }
+}
+/**
+ * @brief start a device list reset: scanning stops and every link closes.
+ * The table is cleared by reset_service once the links are down, so their
+ * disconnect events still find their devices.
+ */
+static void reset_device_list(void)
+{
+    if (device_manager.reset_due_us) return; // already under way
 
-    device_manager.discovered_count++;
+    // Stop scanning if in progress
+    if (device_manager.scanning) {
+        stop_scanning();
+    }
+    // stop scan timer so it dosent start scanning unexpectedly 
+    stop_scan_timer();
+    // nothing opens again, queued commands are dropped with their devices. An
+    // open under way keeps the scheduler busy until its event.
+    for (int i = 0; i < device_manager.discovered_count; i++) {
+        conn_sched_cancel(&conn_sched, i);
+    }
+    memset(device_actor.send_armed, 0, sizeof(device_actor.send_armed));
 
-    // Notify callback
-    if (device_manager.device_found_cb) {
-        device_manager.device_found_cb(device->mac_address , device->name);
+    for (int i = 0; i < device_manager.discovered_count; i++) {
+        flood_light_device_t *device = &device_manager.devices[i];
+        device->pending_count = 0;
+        if (device->connected) {
+            // evicting: the disconnect doesn't ask for a reconnect
+            if (!device->evicting && disconnect_from_device(i)) device->evicting = true;
+        } else if (device->connecting) {
+            esp_ble_gap_disconnect(device->mac_address); // cancel the open
+        }
+    }
+    device_manager.reset_due_us = esp_timer_get_time() + RESET_TIMEOUT_US;
+    ESP_LOGI(TAG, "Resetting device list, closing links");
+}
+/**
+ * @brief clear the device table and scan from scratch
+ */
+static void clear_device_list(void)
+{
+    for (int i = 0; i < device_manager.discovered_count; i++) {
+        conn_sched_drop(&conn_sched, i); // an open still outstanding ends with its event
+    }
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        memset(&device_manager.devices[i], 0, sizeof(flood_light_device_t));
+    }
+    memset(device_actor.send_armed, 0, sizeof(device_actor.send_armed));
+    device_registry_reset();
+    if (device_manager.notify_reg_device >= 0) {
+        device_manager.notify_reg_device = NOTIFY_REG_ORPHAN; // its device is gone
     }
+    whitelist_clear();
+    reject_cache_reset(); // filters may have changed
+    device_manager.discovered_count = 0;
+    device_manager.conn_count = 0;
+    device_manager.all_devices_found = false;
+    device_manager.scan_left_s = 0;
+    scan_hold_end();
+    scan_scheduler_reset();
+    start_scanning();
+}
+/**
+ * @brief finish a device list reset once its links are down or the wait timed out
+ * @return true if the table was cleared
+ */
+static bool reset_service(void)
+{
+    if (device_manager.reset_due_us == 0) return false;
 
-    // Check if we found all devices
-    if (device_manager.discovered_count >= MAX_DEVICES) {
+    uint8_t open = 0;
+    for (int i = 0; i < device_manager.discovered_count; i++) {
+        const flood_light_device_t *device = &device_manager.devices[i];
+        if (device->connected || device->connecting) open++;
+    }
+    if (open && esp_timer_get_time() < device_manager.reset_due_us) return false;
 
-        device_manager.all_devices_found = true;
-        ESP_LOGI(TAG, "All %d devices found!", MAX_DEVICES);
-                            
-        if (device_manager.all_devices_found_cb) {
-            device_manager.all_devices_found_cb();
+    if (open) {
+        // their close events release the slots, even once the lamps are found again
+        ESP_LOGW(TAG, "%d link(s) still open after the reset timeout", open);
+        for (int i = 0; i < device_manager.discovered_count; i++) {
+            const flood_light_device_t *device = &device_manager.devices[i];
+            if (device->connected || device->connecting) closing_link_add(device->mac_address, device->connecting);
         }
     }
+    device_manager.reset_due_us = 0;
+    clear_device_list();
+    ESP_LOGI(TAG, "Device list reset");
+    return true;
 }
 /**
- * @brief GAP callback
+ * @brief device actor task, owns all device state. Handles stack events and
+ * API calls in arrival order and runs deferred sends when their timer expires.
  */
-static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+static void device_actor_task(void *arg)
 {
-    uint8_t *adv_name = NULL;
-    uint8_t adv_name_len = 0;
-    uint8_t *adv_uuid = NULL;
-    uint8_t uuid_len = 0;
-
-    switch (event) {
-    case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT:
-        start_scanning();
-        break;
-        
-    case ESP_GAP_BLE_SCAN_START_COMPLETE_EVT:
-        if (!(param->scan_start_cmpl.status == ESP_BT_STATUS_SUCCESS)) {
-             ESP_LOGE(TAG, "Scan start failed");
+    actor_msg_t msg;
+    uint8_t unpublished = 0;
+
+    for (;;) {
+        if (xQueueReceive(device_actor.queue, &msg, actor_next_wait()) == pdTRUE) {
+            int64_t start_us = esp_timer_get_time();
+            UBaseType_t depth = uxQueueMessagesWaiting(device_actor.queue) + 1;
+            if (depth > device_actor.queue_peak) device_actor.queue_peak = (uint8_t)depth;
+
+            actor_dispatch(&msg);
+
+            uint32_t wait_us = (uint32_t)(start_us - msg.posted_us);
+            uint32_t service_us = (uint32_t)(esp_timer_get_time() - start_us);
+            device_actor.processed++;
+            device_actor.wait_us_total += wait_us;
+            device_actor.service_us_total += service_us;
+            if (wait_us > device_actor.wait_us_max) device_actor.wait_us_max = wait_us;
+            if (service_us > device_actor.service_us_max) device_actor.service_us_max = service_us;
+            unpublished++;
         }
-        break;
-        
-    case ESP_GAP_BLE_SCAN_RESULT_EVT: {
-        esp_ble_gap_cb_param_t *scan_result = (esp_ble_gap_cb_param_t *)param;
-        
-        switch (scan_result->scan_rst.search_evt) {
-        case ESP_GAP_SEARCH_INQ_RES_EVT:
-            if (device_manager.all_devices_found) 
-                break;
-            
-            
-            adv_name = esp_ble_resolve_adv_data_by_type(
-                scan_result->scan_rst.ble_adv,
-                scan_result->scan_rst.adv_data_len + scan_result->scan_rst.scan_rsp_len,
-                ESP_BLE_AD_TYPE_NAME_CMPL,
-                &adv_name_len);
-            
-                
-            
-            if (device_manager.by_name) { // name filter enabled
-                if (!adv_name || adv_name_len == 0) break; // no name skip
-                        // name dosen't match skip
-                if (strlen(device_manager.remote_device_name) != adv_name_len ||
-                            strncmp((char *)adv_name, device_manager.remote_device_name, adv_name_len) != 0)
-                    break;
-
-            }
-
-            adv_uuid = esp_ble_resolve_adv_data_by_type(
-                scan_result->scan_rst.ble_adv,
-                scan_result->scan_rst.adv_data_len + scan_result->scan_rst.scan_rsp_len,
-                ESP_BLE_AD_TYPE_16SRV_CMPL, // complete list of 16-bit UUIDs
-                &uuid_len
-            );
-
-            if (device_manager.by_uuid) { // uuid filter enabled
-                if (uuid_len < 2) break;   // too short skip
-                bool found = false;
-                for (int i = 0; i + 1 < uuid_len; i += 2) {
-                    uint16_t u = adv_uuid[i] | (adv_uuid[i + 1] << 8);
-                    if (u == device_manager.remote_service_uuid)  {
-                        found = true;
-                        break;
-                    }
-                }
-                if (!found) break; // uuid didn't match skip
-            }
-
-            int idx = find_device_by_mac(scan_result->scan_rst.bda);
-            if (idx >= 0 ) {
-                device_manager.devices[idx].rssi = scan_result->scan_rst.rssi;
-                break; // device already registered update rssi and exit
-            }
-            char tmp_name[32]= {0};
-            if (adv_name && adv_name_len > 0) {
-
-                if (adv_name_len >= sizeof(tmp_name)) adv_name_len = sizeof(tmp_name) - 1; // limit lenght to 32
 
-                memcpy(tmp_name, adv_name, adv_name_len);
-                tmp_name[adv_name_len] = '\0';
+        TickType_t now = xTaskGetTickCount();
+        for (int i = 0; i < MAX_DEVICES; i++) {
+            if (device_actor.send_armed[i] && (int32_t)(device_actor.send_at[i] - now) <= 0) {
+                device_actor.send_armed[i] = false;
+                send_pending_commands(i);
+                unpublished++;
             }
-            uint16_t temp_uuid = 0;
-            if (adv_uuid && uuid_len >= 2) {
-                temp_uuid = adv_uuid[0] | (adv_uuid[1] << 8);
-            }
-            device_manager_add_device(scan_result->scan_rst.bda, (adv_name && adv_name_len > 0) ? tmp_name : NULL, temp_uuid, 
-                                        scan_result->scan_rst.rssi);
-        
-            break;
-
-        case ESP_GAP_SEARCH_INQ_CMPL_EVT:
-            
-            ESP_LOGI(TAG, "Scan completed, found %d/%d devices.", 
-                        device_manager.discovered_count, MAX_DEVICES);
-            device_manager.scanning = false;
-            start_scan_timer();
-            break;
-            
-        default:
-            break;
         }
-        break;
-    }
-    
-    case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT:
-        if (param->scan_stop_cmpl.status != ESP_BT_STATUS_SUCCESS){
-            ESP_LOGE(TAG, "Scan stop failed");
-        } else {
-            ESP_LOGI(TAG, "Scan stopped successfully");
-            device_manager.scanning = false;
+        if (reconnect_service()) {
+            unpublished++;
         }
-        break;
-        
-    default:
-        break;
+        if (discovery_service()) {
+            unpublished++;
+        }
+        if (reset_service()) {
+            unpublished++;
+        }
+        conn_params_service_all();
+        write_pipes_service();
+        scan_arbitrate();
+
+        // readers see the state once a burst is drained, or periodically under load
+        if (unpublished && (uxQueueMessagesWaiting(device_actor.queue) == 0 ||
+                            unpublished >= ACTOR_PUBLISH_EVERY)) {
+            publish_snapshot();
+            unpublished = 0;
+        }
+    }
+}
+/**
+ * @brief run fn on the actor and wait until it returned
+ */
+static bool actor_call(void (*fn)(void *arg), void *arg)
+{
+    if (xTaskGetCurrentTaskHandle() == device_actor.task) {
+        fn(arg);
+        return true;
+    }
+
+    StaticSemaphore_t done_buf;
+    actor_msg_t msg = {
+        .type = ACTOR_MSG_CALL,
+        .call = {
+            .fn = fn,
+            .arg = arg,
+            .done = xSemaphoreCreateBinaryStatic(&done_buf),
+        },
+    };
+    if (device_actor.task == NULL || !actor_post(&msg, pdMS_TO_TICKS(ACTOR_POST_TIMEOUT_MS), 0)) {
+        ESP_LOGE(TAG, "Device actor not reachable");
+        vSemaphoreDelete(msg.call.done);
+        return false;
+    }
+    // fn may use the caller's stack, so wait for it to finish however long it takes
+    xSemaphoreTake(msg.call.done, portMAX_DELAY);
+    vSemaphoreDelete(msg.call.done);
+    return true;
+}
+/**
+ * @brief queue a light command, the actor resolves the mac when it runs it
+ */
+static bool post_command(const uint8_t *mac, uint8_t opcode, const uint8_t *payload, uint8_t payload_len,
+                         int64_t rx_us)
+{
+    if (payload_len > LIGHT_CMD_PAYLOAD_MAX) {
+        ESP_LOGE(TAG, "Payload too long: %d", payload_len);
+        return false;
+    }
+    actor_msg_t msg = {
+        .type = ACTOR_MSG_COMMAND,
+        .command.op = {
+            .opcode = opcode,
+            .payload_len = payload_len,
+        },
+        .command.rx_us = rx_us,
+    };
+    memcpy(msg.command.mac, mac, ESP_BD_ADDR_LEN);
+    memcpy(msg.command.op.payload, payload, payload_len);
+
+    if (!actor_post(&msg, pdMS_TO_TICKS(ACTOR_POST_TIMEOUT_MS), 0)) {
+        ESP_LOGE(TAG, "Device actor busy, command 0x%02x dropped", opcode);
+        return false;
     }
+    return true;
 }
 /////////////// static ends here //////////////////
 
 void device_manager_init(void)
 {
+    device_registry_reset();
+    conn_sched_init(&conn_sched);
+
+    // stack events queue up here until the actor takes over at the end of init
+    device_actor.queue = xQueueCreate(ACTOR_QUEUE_LEN, sizeof(actor_msg_t));
+    if (device_actor.queue == NULL) {
+        ESP_LOGE(TAG, "Failed to create device actor queue");
+        return;
+    }
+
     ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
 
     esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
@@ -967,67 +2901,12 @@ void device_manager_init(void)
     device_manager.device_connected_cb = NULL;
     device_manager.device_disconnected_cb = NULL;
 
-    err = gatt_load_config(GATT_CONFIG_BY_NAME, &device_manager.by_name, NULL);
-    if (err == ESP_OK) {
-        ESP_LOGI(TAG, "Filter by name: %s", device_manager.by_name ? "ENABLED" : "DISABLED");
-    } else {
-        ESP_LOGW(TAG, "Filter by name flag not found in NVS");
-        gatt_save_config(GATT_CONFIG_BY_NAME, &device_manager.by_name);
-    }
-
-    size_t name_len = sizeof(device_manager.remote_device_name);
-    err = gatt_load_config(GATT_CONFIG_DEVICE_NAME, device_manager.remote_device_name, &name_len);
-    if (err != ESP_OK) {
-        ESP_LOGW(TAG, "No remote device name filter found in NVS");
-        return;
-    }
-
-    err = gatt_load_config(GATT_CONFIG_BY_UUID, &device_manager.by_uuid, NULL);
-    if (err == ESP_OK) {
-        ESP_LOGI(TAG, "Filter by uuid: %s", device_manager.by_uuid ? "ENABLED" : "DISABLED");
-    } else {
-        ESP_LOGW(TAG, "Filter by uuid flag not found in NVS");
-        gatt_save_config(GATT_CONFIG_BY_UUID, &device_manager.by_uuid);
-    }
-
-    size_t uuid_len = sizeof(device_manager.remote_service_uuid);
-    err = gatt_load_config(GATT_CONFIG_SERVICE_UUID, &device_manager.remote_service_uuid, &uuid_len);
-    if (err != ESP_OK) {
-        ESP_LOGW(TAG, "No remote service uuid filter found in NVS");
-        return;
-    }
-
-    int8_t tx_power = 4; // default power
-    size_t power_len = sizeof(tx_power);
-   
-    err = gatt_load_config(GATT_CONFIG_BLE_POWER, &tx_power, &power_len);
-    if (err == ESP_OK) {
-       // esp_power_level_t esp_level = tx_power;
-        esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_DEFAULT, tx_power);
-        ESP_LOGI(TAG, "Restored BLE power from NVS: %d", tx_power);
-    } else {
-        ESP_LOGW(TAG, "BLE power not found, using default");
-        gatt_save_config(GATT_CONFIG_BLE_POWER, &tx_power);
-    }
-
-    size_t interval_len = sizeof(device_manager.scan_interval);
-    err = gatt_load_config(GATT_CONFIG_BLE_INTERVAL, &device_manager.scan_interval, &interval_len);
-    if (err == ESP_OK) {
-      
-        ESP_LOGI(TAG, "Restored BLE scan interval from NVS: %d", device_manager.scan_interval);
-    } else {
-        ESP_LOGW(TAG, " BLE scan interval not found, using default");
-        gatt_save_config(GATT_CONFIG_BLE_INTERVAL, &device_manager.scan_interval);
-    }
+    load_gatt_config();
+    compile_adv_filter();
 
-    size_t duration_len = sizeof(device_manager.scan_duration);
-    err = gatt_load_config(GATT_CONFIG_BLE_DURATION, &device_manager.scan_duration, &duration_len);
-    if (err == ESP_OK) {
-      
-        ESP_LOGI(TAG, "Restored BLE scan interval from NVS: %d", device_manager.scan_interval);
-    } else {
-        ESP_LOGW(TAG, " BLE scan duration not found, using default");
-        gatt_save_config(GATT_CONFIG_BLE_DURATION, &device_manager.scan_duration);
+    err = esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_DEFAULT, device_manager.tx_power);
+    if (err) {
+        ESP_LOGE(TAG, "TX power set failed: %x", err);
     }
 
     err = esp_ble_gattc_app_register(0);
@@ -1036,15 +2915,7 @@ void device_manager_init(void)
         return;
     }
 
-    uint16_t mtu = 158;
-    size_t mtu_len = sizeof(mtu);
-    err = gatt_load_config(GATT_CONFIG_MTU, &mtu, &mtu_len);
-    if (err != ESP_OK) {
-        
-        ESP_LOGW(TAG, "MTU size not found, using default");
-        gatt_save_config(GATT_CONFIG_MTU, &mtu);
-    }
-    err = esp_ble_gatt_set_local_mtu(mtu);
+    err = esp_ble_gatt_set_local_mtu(device_manager.mtu);
     if (err){
         ESP_LOGE(TAG, "MTU set failed: %x", err);
     }
@@ -1057,8 +2928,16 @@ void device_manager_init(void)
         scan_timer_cb
     );
 
+    // from here on only the actor touches device state
+    if (xTaskCreatePinnedToCore(device_actor_task, "dev_actor", ACTOR_STACK_SIZE, NULL,
+                                ACTOR_PRIORITY, &device_actor.task, ACTOR_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start device actor");
+        return;
+    }
+
     ESP_LOGI(TAG, "Starting device discovery...");
-    start_scanning();
+    actor_msg_t msg = { .type = ACTOR_MSG_SCAN_TIMER };
+    actor_post(&msg, portMAX_DELAY, 0);
 }
 
 void device_manager_set_callbacks(
@@ -1066,13 +2945,15 @@ void device_manager_set_callbacks(
     all_devices_found_cb_t all_found,
     device_connected_cb_t device_connected,
     device_disconnected_cb_t device_disconnected,
-    device_power_state_cb_t device_power_state)
+    device_power_state_cb_t device_power_state,
+    device_availability_cb_t device_availability)
 {
     if (device_found) device_manager.device_found_cb = device_found;
     if (all_found) device_manager.all_devices_found_cb = all_found;
     if (device_connected) device_manager.device_connected_cb = device_connected;
     if (device_disconnected) device_manager.device_disconnected_cb = device_disconnected;
     if (device_power_state) device_manager.device_power_state_cb = device_power_state;
+    if (device_availability) device_manager.device_availability_cb = device_availability;
 }
 
 bool connect_to_device(int device_index)
@@ -1084,7 +2965,7 @@ bool connect_to_device(int device_index)
     
     flood_light_device_t *device = &device_manager.devices[device_index];
     
-    if (device->connected) {
+    if (device->connected || device->connecting) {
         ESP_LOGI(TAG, "Device %d already connected", device_index);
         return true;
     }
@@ -1094,13 +2975,22 @@ bool connect_to_device(int device_index)
         return false;
     }
     
+    if (device_manager.scanning) {
+        // give the radio to the connection, scan resumes when links settle
+        yield_scanning();
+    }
+
     ESP_LOGI(TAG, "Connecting to: %d", device_index);
     
     esp_err_t ret = esp_ble_gattc_open(device_manager.gattc_if, device->mac_address, BLE_ADDR_TYPE_PUBLIC, true);
+    trace_record(TRACE_SUBSYS_DEVICE, TRACE_DEV_CONNECT, (uint8_t)device_index, ret == ESP_OK, 0);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to initiate connection: %d", ret);
         return false;
     }
+    device->connecting = true;
+    device->lat_connect_us = esp_timer_get_time();
+    reconnect_connecting(&device->reconnect, device->lat_connect_us);
     return true;
 }
 
@@ -1127,255 +3017,258 @@ bool disconnect_from_device(int device_index)
     return true;
 }
 
-bool device_set_power(const uint8_t *mac, const bool power)
+bool device_set_power(const uint8_t *mac, const bool power, int64_t rx_us)
 {
     uint8_t payload = power ? 0x01 : 0x00;
-    size_t cmd_len = build_cmd(0x11, &payload, 1);
-    if (!cmd_len) return false;
-    int device_index = find_device_by_mac(mac);
-    return control_device(device_index, w_cmd, cmd_len);
+    return post_command(mac, LIGHT_OP_POWER, &payload, 1, rx_us);
 }
 
-bool device_set_brightness(const uint8_t *mac, uint8_t brightness)
+bool device_set_brightness(const uint8_t *mac, uint8_t brightness, int64_t rx_us)
 {   
-    size_t cmd_len = build_cmd(0x13, &brightness, 1);
-    if (!cmd_len) return false;
-    int device_index = find_device_by_mac(mac);
-    return control_device(device_index, w_cmd, cmd_len);
+    return post_command(mac, LIGHT_OP_BRIGHTNESS, &brightness, 1, rx_us);
 }
 
-bool device_set_color(const uint8_t *mac, uint8_t r, uint8_t g, uint8_t b)
+bool device_set_color(const uint8_t *mac, uint8_t r, uint8_t g, uint8_t b, int64_t rx_us)
 {  
     uint8_t payload[7] = {r, g, b, r, g, b, 0x64}; 
-    size_t cmd_len = build_cmd(0x17, payload, 7);
-    if (!cmd_len) return false;
-    int device_index = find_device_by_mac(mac);
-    return control_device(device_index, w_cmd, cmd_len);
+    return post_command(mac, LIGHT_OP_COLOR, payload, sizeof(payload), rx_us);
+}
+
+static void reset_devices_call(void *arg)
+{
+    reset_device_list();
 }
 
 bool ble_reset_devices(void)
 {
-    // Stop scanning if in progress
-    if (device_manager.scanning) {
-        stop_scanning();
-    }
-    // stop scan timer so it dosent start scanning unexpectedly 
-    stop_scan_timer();
-    // disconnect from all devices
-    for (int i = 0; i < MAX_DEVICES; i++) {
-        disconnect_from_device(i);
-    }
-    vTaskDelay(pdMS_TO_TICKS(200));
-    // Reset device list
-    for (int i = 0; i < MAX_DEVICES; i++) {
-    memset(&device_manager.devices[i], 0, sizeof(flood_light_device_t));
-    }
-    device_manager.discovered_count = 0;
-    device_manager.conn_count = 0;
-    device_manager.all_devices_found = false;
-    start_scanning();
-    return true;
+    return actor_call(reset_devices_call, NULL);
 }
 
-void ble_update_config( const bool *by_name, const char *device_name, const bool *by_uuid, const uint16_t *uuid,
-                        const uint8_t *tx_power, const uint8_t *interval, const uint8_t *duration, const uint16_t *mtu)
+/* ble_update_config arguments, the actor reads them while the caller waits */
+typedef struct {
+    const bool *by_name;
+    const char *device_names;
+    const bool *by_uuid;
+    const char *uuids;
+    const char *company_ids;
+    const uint8_t *tx_power;
+    const uint8_t *interval;
+    const uint8_t *duration;
+    const uint16_t *mtu;
+} config_update_args_t;
+
+/* ble_get_config outputs */
+typedef struct {
+    bool *by_name;
+    char *device_names;
+    bool *by_uuid;
+    char *uuids;
+    char *company_ids;
+    uint8_t *tx_power;
+    uint8_t *interval;
+    uint8_t *duration;
+    uint16_t *mtu;
+} config_get_args_t;
+
+static void update_config(const bool *by_name, const char *device_names, const bool *by_uuid, const char *uuids,
+                          const char *company_ids, const uint8_t *tx_power, const uint8_t *interval, const uint8_t *duration, const uint16_t *mtu)
 {
-    bool reset_devices = false;
+    // parse into a copy first so a bad pattern leaves the running filter alone
+    static adv_filter_t new_filter; // ~1.8 KB, kept off the httpd task stack
+    new_filter = device_manager.filter;
+    if (adv_filter_set_names(&new_filter, device_names) != ESP_OK ||
+        adv_filter_set_uuids(&new_filter, uuids) != ESP_OK ||
+        adv_filter_set_companies(&new_filter, company_ids) != ESP_OK) {
+        ESP_LOGE(TAG, "Invalid filter patterns, config not applied");
+        return;
+    }
+
+    bool filter_changed = false;
+    bool changed = false;
 
     bool new_by_name = *by_name;
     if (new_by_name != device_manager.by_name){
-
         ESP_LOGI(TAG, "Filter by name: %s", new_by_name ? "ENABLED" : "DISABLED");
-        esp_err_t err = gatt_save_config(GATT_CONFIG_BY_NAME, by_name);
-
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to save config to NVS (%s)", esp_err_to_name(err));
-            return;
-        }
-        // Update runtime variable
         device_manager.by_name = new_by_name;
-        reset_devices = true;
-        
+        filter_changed = true;
     }
     
-    if (strcmp(device_name, device_manager.remote_device_name) != 0){
-
-        ESP_LOGI(TAG, "Updating device name='%s'", device_name);
-        esp_err_t err = gatt_save_config(GATT_CONFIG_DEVICE_NAME, device_name);
-
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to save config to NVS (%s)", esp_err_to_name(err));
-            return;
-        }
-        // Update runtime variable
-        strncpy(device_manager.remote_device_name, device_name, sizeof(device_manager.remote_device_name) - 1);
-        device_manager.remote_device_name[sizeof(device_manager.remote_device_name) - 1] = '\0';
-        reset_devices = true;
-
-    }
-
     bool new_by_uuid = *by_uuid;
     if (new_by_uuid != device_manager.by_uuid){
-
-        ESP_LOGI(TAG, "Filter by name: %s", new_by_uuid ? "ENABLED" : "DISABLED");
-        esp_err_t err = gatt_save_config(GATT_CONFIG_BY_UUID, by_uuid);
-
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to save config to NVS (%s)", esp_err_to_name(err));
-            return;
-        }
-        // Update runtime variable
+        ESP_LOGI(TAG, "Filter by uuid: %s", new_by_uuid ? "ENABLED" : "DISABLED");
         device_manager.by_uuid = new_by_uuid;
-        reset_devices = true;
-        
+        filter_changed = true;
     }
 
-    if ( *uuid != device_manager.remote_service_uuid ){ 
-
-        ESP_LOGI(TAG, "Updating service UUID=0x%04X", *uuid);
-        esp_err_t err = gatt_save_config(GATT_CONFIG_SERVICE_UUID, uuid);
-
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to save config to NVS (%s)", esp_err_to_name(err));
-            return;
-        }
-        // Update runtime variable
-        device_manager.remote_service_uuid = *uuid;
-        reset_devices = true;
+    if (!adv_filter_same_patterns(&new_filter, &device_manager.filter)) {
+        ESP_LOGI(TAG, "Updating filters: %d name(s), %d uuid(s), %d company id(s)", new_filter.name_set.count,
+                 new_filter.uuid16_set.count, new_filter.company_set.count);
+        device_manager.filter = new_filter;
+        filter_changed = true;
     }
 
-    if (reset_devices){
-
-        if(!ble_reset_devices())
-        {
-            ESP_LOGE(TAG, "Failed to reset devices");
-            return;
-        }
-        ESP_LOGI(TAG, "Scan restarted for new BLE filter settings");
-    }
-     
-    uint8_t old_power; 
-    size_t power_len = sizeof(old_power);
-   
-    esp_err_t err = gatt_load_config(GATT_CONFIG_BLE_POWER, &old_power, &power_len);
-    if (err != ESP_OK){
-        ESP_LOGE(TAG, "Failed to load BLE power (%s)", esp_err_to_name(err));
-        return;
-    }
     uint8_t new_power = *tx_power;
-    if (old_power != new_power){
+    if (new_power != device_manager.tx_power){
         ESP_LOGI(TAG, "Updating BLE TX power=%d", new_power);
-        err = gatt_save_config(GATT_CONFIG_BLE_POWER, tx_power);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to save BLE power (%s)", esp_err_to_name(err));
-            return;
-        }
+        device_manager.tx_power = new_power;
         //esp_power_level_t esp_level = power_map[tx_power];
         esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_DEFAULT, new_power);
+        changed = true;
     } 
     uint8_t new_interval = *interval;
     if (new_interval != device_manager.scan_interval){
-        // update runtime var
-        device_manager.scan_interval = new_interval;
         ESP_LOGI(TAG, "Updating BLE scan interval=%d", new_interval);
-        err = gatt_save_config(GATT_CONFIG_BLE_INTERVAL, interval);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to save BLE scan interval (%s)", esp_err_to_name(err));
-            return;
+        device_manager.scan_interval = new_interval;
+        if (!device_manager.scanning && !device_manager.scan_paused &&
+            xTimerIsTimerActive(device_manager.scan_timer)) {
+            start_scan_timer(); // rest from now on with the new interval
         }
-        
+        changed = true;
     }
     uint8_t new_duration = *duration;
     if (new_duration != device_manager.scan_duration){
-        // update runtime var
-        device_manager.scan_duration = new_duration;
         ESP_LOGI(TAG, "Updating BLE scan duration=%d", new_duration);
-        err = gatt_save_config(GATT_CONFIG_BLE_DURATION, duration);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to save BLE scan duration (%s)", esp_err_to_name(err));
-            return;
-        }
+        device_manager.scan_duration = new_duration;
+        changed = true;
     }
-    uint16_t old_mtu; 
-    size_t mtu_len = sizeof(old_mtu);
-   
-    err = gatt_load_config(GATT_CONFIG_MTU, &old_mtu, &mtu_len);
-    if (err != ESP_OK){
-        ESP_LOGE(TAG, "Failed to load MTU size (%s)", esp_err_to_name(err));
-        return;
+    uint16_t new_mtu = *mtu;
+    if (new_mtu != device_manager.mtu){
+        ESP_LOGI(TAG, "Updating BLE MTU=%d", new_mtu);
+        device_manager.mtu = new_mtu;
+        esp_ble_gatt_set_local_mtu(new_mtu); // apply
+        changed = true;
     }
-    uint8_t new_mtu = *mtu;
-    if (old_mtu != new_mtu){
-        ESP_LOGI(TAG, "Updating BLE TX power=%d", new_mtu);
-        err = gatt_save_config(GATT_CONFIG_MTU, mtu);
+
+    if (filter_changed || changed) {
+        esp_err_t err = save_gatt_config();
         if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to save MTU size (%s)", esp_err_to_name(err));
-            return;
+            ESP_LOGE(TAG, "Failed to save BLE config to NVS (%s)", esp_err_to_name(err));
         }
-        esp_ble_gatt_set_local_mtu(new_mtu); // apply
-    } 
-       
+    }
+
+    if (filter_changed){
+        compile_adv_filter();
+        refilter_devices();
+    }
 }
 
-void ble_get_config(bool *by_name, char *device_name, bool *by_uuid, uint16_t *uuid, 
-                    uint8_t *tx_power, uint8_t *interval, uint8_t *duration, uint16_t *mtu)
+static void update_config_call(void *arg)
 {
-    
-    strncpy(device_name, device_manager.remote_device_name, sizeof(device_manager.remote_device_name) - 1);
+    const config_update_args_t *args = arg;
+    update_config(args->by_name, args->device_names, args->by_uuid, args->uuids, args->company_ids,
+                  args->tx_power, args->interval, args->duration, args->mtu);
+}
 
-    esp_err_t err = gatt_load_config(GATT_CONFIG_BLE_POWER, tx_power, NULL);
-    if (err != ESP_OK) {
-        *tx_power = 0; 
-        ESP_LOGE(TAG, "Failed to load BLE power (%s)", esp_err_to_name(err));
+void ble_update_config( const bool *by_name, const char *device_names, const bool *by_uuid, const char *uuids,
+                        const char *company_ids, const uint8_t *tx_power, const uint8_t *interval, const uint8_t *duration, const uint16_t *mtu)
+{
+    config_update_args_t args = {
+        .by_name = by_name,
+        .device_names = device_names,
+        .by_uuid = by_uuid,
+        .uuids = uuids,
+        .company_ids = company_ids,
+        .tx_power = tx_power,
+        .interval = interval,
+        .duration = duration,
+        .mtu = mtu,
+    };
+    if (!actor_call(update_config_call, &args)) {
+        ESP_LOGE(TAG, "BLE config not applied");
     }
-    *interval = device_manager.scan_interval;
-    *duration = device_manager.scan_duration;
-    *by_name = device_manager.by_name;
-    *by_uuid = device_manager.by_uuid;
-    *uuid = device_manager.remote_service_uuid;
+}
 
-    err = gatt_load_config(GATT_CONFIG_MTU, mtu, NULL);
-    if (err != ESP_OK) {
-        *mtu = 0; 
-        ESP_LOGE(TAG, "Failed to load MTU size (%s)", esp_err_to_name(err));
+static void get_config_call(void *arg)
+{
+    config_get_args_t *args = arg;
+
+    adv_filter_get_names(&device_manager.filter, args->device_names, ADV_FILTER_TEXT_MAX);
+    adv_filter_get_uuids(&device_manager.filter, args->uuids, ADV_FILTER_TEXT_MAX);
+    adv_filter_get_companies(&device_manager.filter, args->company_ids, ADV_FILTER_TEXT_MAX);
+
+    *args->tx_power = device_manager.tx_power;
+    *args->interval = device_manager.scan_interval;
+    *args->duration = device_manager.scan_duration;
+    *args->by_name = device_manager.by_name;
+    *args->by_uuid = device_manager.by_uuid;
+    *args->mtu = device_manager.mtu;
+}
+
+void ble_get_config(bool *by_name, char *device_names, bool *by_uuid, char *uuids, char *company_ids,
+                    uint8_t *tx_power, uint8_t *interval, uint8_t *duration, uint16_t *mtu)
+{
+    config_get_args_t args = {
+        .by_name = by_name,
+        .device_names = device_names,
+        .by_uuid = by_uuid,
+        .uuids = uuids,
+        .company_ids = company_ids,
+        .tx_power = tx_power,
+        .interval = interval,
+        .duration = duration,
+        .mtu = mtu,
+    };
+    if (!actor_call(get_config_call, &args)) {
+        device_names[0] = uuids[0] = company_ids[0] = '\0';
+        *by_name = *by_uuid = false;
+        *tx_power = *interval = *duration = 0;
+        *mtu = 0;
     }
 }
 
-void ble_get_metrics(uint8_t *discovered_count, uint8_t *conn_count)
+void ble_get_metrics(uint8_t *discovered_count, uint8_t *conn_count, uint32_t *generation)
 {
+    unsigned seq;
+    ble_devices_t head;
+
+    do {
+        seq = seq_read_begin(&snapshot.devices_seq);
+        head.generation = snapshot.devices.generation;
+        head.count = snapshot.devices.count;
+        head.conn_count = snapshot.devices.conn_count;
+    } while (seq_read_retry(&snapshot.devices_seq, seq));
+
     if (discovered_count) {
-        *discovered_count = device_manager.discovered_count;
+        *discovered_count = head.count;
     }
 
     if (conn_count) {
-        *conn_count = device_manager.conn_count;
+        *conn_count = head.conn_count;
+    }
+    if (generation) {
+        *generation = head.generation;
     }
 }
 
-void ble_get_devices(uint8_t *indexes,const char **names, uint8_t *macs, bool *connected, uint16_t *uuids, int8_t *rssis)
+void ble_get_stats(ble_stats_t *stats)
 {
+    if (!stats) return;
 
-    for (int i = 0; i < device_manager.discovered_count; i++){
+    unsigned seq;
+    do {
+        seq = seq_read_begin(&snapshot.stats_seq);
+        *stats = snapshot.stats;
+    } while (seq_read_retry(&snapshot.stats_seq, seq));
 
-        if (indexes) {
-            indexes[i] = device_manager.devices[i].app_id;
-        }
-        if (names) {
-            names[i] = device_manager.devices[i].name;
-        }
-        if (macs) {
-            for (int j = 0; j < 6; j++) {
-                macs[i * 6 + j] = device_manager.devices[i].mac_address[j];
-            }
-        }
-        if (connected) {
-            connected[i] = device_manager.devices[i].connected;
-        }
-        if (uuids) {
-            uuids[i] = device_manager.devices[i].service_uuid;
-        }
-        if (rssis) {
-            rssis[i] = device_manager.devices[i].rssi;
-        }
-    } 
+    if (device_actor.queue) {
+        stats->actor_queue_depth = (uint8_t)uxQueueMessagesWaiting(device_actor.queue);
+    }
+    stats->actor_dropped = atomic_load(&device_actor.dropped);
+}
+
+uint32_t ble_get_devices(ble_devices_t *devices)
+{
+    unsigned seq;
+
+    do {
+        seq = seq_read_begin(&snapshot.devices_seq);
+        devices->generation = snapshot.devices.generation;
+        devices->count = snapshot.devices.count;
+        devices->conn_count = snapshot.devices.conn_count;
+        // count may be torn until the retry check, never copy past the table
+        uint8_t count = devices->count <= BLE_DEVICES_MAX ? devices->count : BLE_DEVICES_MAX;
+        memcpy(devices->devices, snapshot.devices.devices, count * sizeof(ble_device_record_t));
+    } while (seq_read_retry(&snapshot.devices_seq, seq));
+
+    return devices->generation;
 }
@@ -0,0 +1,188 @@
+#include "device_registry.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#define MAX_DEVICES     CONFIG_BTHUB_MAX_DEVICES
+#define REGISTRY_SLOTS  (2 * MAX_DEVICES) // keep load factor <= 0.5
+#define MAC_LEN         6
+#define EMPTY_SLOT      0xFF
+#define NO_KEY          0xFFFF
+
+static const char *TAG = "REGISTRY";
+
+typedef struct {
+    uint8_t mac[MAC_LEN];
+    uint8_t index;          // EMPTY_SLOT when unused
+} mac_slot_t;
+
+typedef struct {
+    uint16_t key;
+    uint8_t index;          // EMPTY_SLOT when unused
+} u16_slot_t;
+
+/* open addressing hash map uint16 key -> device index, with reverse keys per device */
+typedef struct {
+    u16_slot_t slots[REGISTRY_SLOTS];
+    uint16_t key_of[MAX_DEVICES];   // NO_KEY when device has no binding
+} u16_map_t;
+
+static struct {
+    mac_slot_t macs[REGISTRY_SLOTS];
+    u16_map_t conns;
+} registry;
+
+/**
+ * @brief FNV-1a over the mac, the low bytes carry most of the entropy
+ */
+static uint32_t mac_hash(const uint8_t *mac)
+{
+    uint32_t h = 2166136261u;
+    for (int i = MAC_LEN - 1; i >= 0; --i) {
+        h ^= mac[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Fibonacci hashing, the high bits of the product are the well mixed
+ * ones: conn ids are small consecutive numbers that cluster on the low bits
+ */
+static uint32_t u16_hash(uint16_t key)
+{
+    return ((uint32_t)key * 2654435761u) >> 16;
+}
+
+static void u16_map_reset(u16_map_t *map)
+{
+    for (int i = 0; i < REGISTRY_SLOTS; i++) {
+        map->slots[i].index = EMPTY_SLOT;
+    }
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        map->key_of[i] = NO_KEY;
+    }
+}
+
+static int u16_map_find(const u16_map_t *map, uint16_t key)
+{
+    uint32_t pos = u16_hash(key) % REGISTRY_SLOTS;
+    for (int n = 0; n < REGISTRY_SLOTS; n++) {
+        const u16_slot_t *slot = &map->slots[pos];
+        if (slot->index == EMPTY_SLOT) return -1;
+        if (slot->key == key) return slot->index;
+        pos = (pos + 1) % REGISTRY_SLOTS;
+    }
+    return -1;
+}
+/**
+ * @brief remove key using backward shift deletion (no tombstones)
+ */
+static void u16_map_remove(u16_map_t *map, uint16_t key)
+{
+    uint32_t pos = u16_hash(key) % REGISTRY_SLOTS;
+    int n = 0;
+    while (map->slots[pos].index != EMPTY_SLOT && map->slots[pos].key != key) {
+        if (++n >= REGISTRY_SLOTS) return;
+        pos = (pos + 1) % REGISTRY_SLOTS;
+    }
+    if (map->slots[pos].index == EMPTY_SLOT) return;
+
+    map->key_of[map->slots[pos].index] = NO_KEY;
+    map->slots[pos].index = EMPTY_SLOT;
+
+    uint32_t hole = pos;
+    uint32_t next = (pos + 1) % REGISTRY_SLOTS;
+    while (map->slots[next].index != EMPTY_SLOT) {
+        uint32_t home = u16_hash(map->slots[next].key) % REGISTRY_SLOTS;
+        // move entry back if its home is not in the cyclic range (hole, next]
+        bool in_range = (hole < next) ? (home > hole && home <= next)
+                                      : (home > hole || home <= next);
+        if (!in_range) {
+            map->slots[hole] = map->slots[next];
+            map->slots[next].index = EMPTY_SLOT;
+            hole = next;
+        }
+        next = (next + 1) % REGISTRY_SLOTS;
+    }
+}
+
+static void u16_map_set(u16_map_t *map, uint16_t key, int index)
+{
+    if (index < 0 || index >= MAX_DEVICES) return;
+
+    // a device holds at most one key per map, drop the old one
+    if (map->key_of[index] != NO_KEY) {
+        u16_map_remove(map, map->key_of[index]);
+    }
+    // key may still point at another device (e.g. reused conn_id)
+    u16_map_remove(map, key);
+
+    uint32_t pos = u16_hash(key) % REGISTRY_SLOTS;
+    for (int n = 0; n < REGISTRY_SLOTS; n++) {
+        u16_slot_t *slot = &map->slots[pos];
+        if (slot->index == EMPTY_SLOT) {
+            slot->key = key;
+            slot->index = (uint8_t)index;
+            map->key_of[index] = key;
+            return;
+        }
+        pos = (pos + 1) % REGISTRY_SLOTS;
+    }
+    ESP_LOGE(TAG, "Lookup table full, key 0x%04x dropped", key);
+}
+
+void device_registry_reset(void)
+{
+    for (int i = 0; i < REGISTRY_SLOTS; i++) {
+        registry.macs[i].index = EMPTY_SLOT;
+    }
+    u16_map_reset(&registry.conns);
+}
+
+bool device_registry_add(const uint8_t *mac, int index)
+{
+    if (index < 0 || index >= MAX_DEVICES) return false;
+
+    uint32_t pos = mac_hash(mac) % REGISTRY_SLOTS;
+    for (int n = 0; n < REGISTRY_SLOTS; n++) {
+        mac_slot_t *slot = &registry.macs[pos];
+        if (slot->index == EMPTY_SLOT) {
+            memcpy(slot->mac, mac, MAC_LEN);
+            slot->index = (uint8_t)index;
+            return true;
+        }
+        if (memcmp(slot->mac, mac, MAC_LEN) == 0) return false;
+        pos = (pos + 1) % REGISTRY_SLOTS;
+    }
+    return false;
+}
+
+int device_registry_find_mac(const uint8_t *mac)
+{
+    uint32_t pos = mac_hash(mac) % REGISTRY_SLOTS;
+    for (int n = 0; n < REGISTRY_SLOTS; n++) {
+        const mac_slot_t *slot = &registry.macs[pos];
+        if (slot->index == EMPTY_SLOT) return -1;
+        if (memcmp(slot->mac, mac, MAC_LEN) == 0) return slot->index;
+        pos = (pos + 1) % REGISTRY_SLOTS;
+    }
+    return -1;
+}
+
+void device_registry_set_conn(uint16_t conn_id, int index)
+{
+    u16_map_set(&registry.conns, conn_id, index);
+}
+
+void device_registry_clear_conn(uint16_t conn_id)
+{
+    u16_map_remove(&registry.conns, conn_id);
+}
+
+int device_registry_find_conn(uint16_t conn_id)
+{
+    return u16_map_find(&registry.conns, conn_id);
+}
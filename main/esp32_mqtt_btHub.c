@@ -2,6 +2,7 @@
 #include "mqtt_manager.h"
 #include "httpd_manager.h"
 #include "device_manager.h" 
+#include "config_store.h"
 
 #include <stdint.h>
 #include <string.h>
@@ -26,6 +27,11 @@ void app_main(void)
     }
     ESP_ERROR_CHECK( ret );
 
+    ret = config_store_init();
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Deferred config writes unavailable (%s)", esp_err_to_name(ret));
+    }
+
     ESP_LOGI(TAG, "Initializing device manager...");
     device_manager_init();
 
@@ -36,11 +42,11 @@ void app_main(void)
     mqtt_start();
     
     // Register the BLE callbacks
-    device_manager_set_callbacks(mqtt_device_found, NULL, NULL, NULL,mqtt_device_state);
+    device_manager_set_callbacks(mqtt_device_found, NULL, NULL, NULL,mqtt_device_state, mqtt_device_availability);
     // Register the MQTT callbacks
-    mqtt_set_callbacks(device_set_power, device_set_brightness, device_set_color, ble_get_metrics, ble_get_devices);
+    mqtt_set_callbacks(device_set_power, device_set_brightness, device_set_color, ble_get_devices);
     // Register the httpd server callbacks
     httpd_manager_set_callbacks(wifi_update_credentials, mqtt_update_config, mqtt_get_config, ble_update_config,
-                                ble_get_config, ble_get_metrics, ble_get_devices, ble_reset_devices);
+                                ble_get_config, ble_get_metrics, ble_get_stats, ble_get_devices, ble_reset_devices);
   
 }
\ No newline at end of file
@@ -0,0 +1,86 @@
+#include "gatt_cache.h"
+
+#include <stdio.h>
+#include "esp_log.h"
+#include "nvs.h"
+
+#define GATT_CACHE_NAMESPACE "gatt_cache"
+#define GATT_CACHE_VERSION 1
+
+static const char *TAG = "GATT_CACHE";
+
+/* on-flash layout, bump GATT_CACHE_VERSION when it changes */
+typedef struct {
+    uint8_t version;
+    gatt_cache_entry_t entry;
+} __attribute__((packed)) gatt_cache_blob_t;
+
+/**
+ * @brief nvs key for a device, 12 hex chars fits the 15 char key limit
+ */
+static void gatt_cache_key(const uint8_t *mac, char *key, size_t len)
+{
+    snprintf(key, len, "%02X%02X%02X%02X%02X%02X",
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+esp_err_t gatt_cache_load(const uint8_t *mac, gatt_cache_entry_t *entry)
+{
+    char key[13];
+    gatt_cache_key(mac, key, sizeof(key));
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(GATT_CACHE_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK) return err;
+
+    gatt_cache_blob_t blob;
+    size_t len = sizeof(blob);
+    err = nvs_get_blob(handle, key, &blob, &len);
+    nvs_close(handle);
+    if (err != ESP_OK) return err;
+
+    if (len != sizeof(blob) || blob.version != GATT_CACHE_VERSION) {
+        ESP_LOGW(TAG, "Stale cache entry for %s ignored", key);
+        return ESP_ERR_INVALID_VERSION;
+    }
+    *entry = blob.entry;
+    return ESP_OK;
+}
+
+esp_err_t gatt_cache_store(const uint8_t *mac, const gatt_cache_entry_t *entry)
+{
+    char key[13];
+    gatt_cache_key(mac, key, sizeof(key));
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(GATT_CACHE_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) return err;
+
+    gatt_cache_blob_t blob = {
+        .version = GATT_CACHE_VERSION,
+        .entry = *entry,
+    };
+    err = nvs_set_blob(handle, key, &blob, sizeof(blob));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+esp_err_t gatt_cache_erase(const uint8_t *mac)
+{
+    char key[13];
+    gatt_cache_key(mac, key, sizeof(key));
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(GATT_CACHE_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) return err;
+
+    err = nvs_erase_key(handle, key);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
@@ -1,9 +1,16 @@
 #include "httpd_manager.h"
 #include "dns_server.h"
 #include "system_metrics.h"
+#include "config_store.h"
+#include "latency.h"
+#include "trace.h"
+#include "reconnect.h"
+#include "conn_params.h"
+#include "adv_filter.h"
 
 #include <string.h> 
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_http_server.h"
 #include "esp_netif.h"
 #include "esp_littlefs.h"
@@ -37,6 +44,7 @@ static struct {
     ble_config_cb_t ble_config_cb;
     ble_get_config_cb_t ble_get_config_cb;
     ble_get_metrics_cb_t ble_get_metrics_cb;
+    ble_get_stats_cb_t ble_get_stats_cb;
     ble_get_devices_cb_t ble_get_devices_cb;
     ble_reset_devices_cb_t ble_reset_devices_cb;
 } httpd_callbacks = {0};
@@ -67,6 +75,7 @@ static const char* get_mime_type(const char *path) {
  */
 static esp_err_t captive_root_handler(httpd_req_t *req)
 {
+    trace_record(TRACE_SUBSYS_HTTP, TRACE_HTTP_CAPTIVE, TRACE_NO_DEVICE, req->method, 0);
     ESP_LOGI(TAG, "Serve root");
     httpd_resp_send(req, html_form, HTTPD_RESP_USE_STRLEN);
     return ESP_OK;
@@ -91,6 +100,7 @@ static esp_err_t captive_detection_handler(httpd_req_t *req, httpd_err_code_t er
  */ 
 static esp_err_t captive_submit_post(httpd_req_t *req)
 {
+    trace_record(TRACE_SUBSYS_HTTP, TRACE_HTTP_WIFI_SUBMIT, TRACE_NO_DEVICE, req->method, 0);
     char buf[128];
     int ret = httpd_req_recv(req, buf, sizeof(buf) - 1);
     if (ret <= 0) {
@@ -210,6 +220,7 @@ static esp_err_t check_default_credentials(void)
  * @brief login page handler
  */ 
 static esp_err_t login_post_handler(httpd_req_t *req) {
+    trace_record(TRACE_SUBSYS_HTTP, TRACE_HTTP_LOGIN, TRACE_NO_DEVICE, req->method, 0);
     
     char buf[64];
     int ret = httpd_req_recv(req, buf, sizeof(buf) - 1);
@@ -282,30 +293,54 @@ static esp_err_t login_post_handler(httpd_req_t *req) {
     return ESP_OK;
 }
 /**
- * @brief get metrics data
+ * @brief device table generation the caller already has (?since=<generation>)
+ */
+static bool metrics_devices_known(httpd_req_t *req, uint32_t generation)
+{
+    char query[32];
+    char since[12];
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) return false;
+    if (httpd_query_key_value(query, "since", since, sizeof(since)) != ESP_OK) return false;
+    return strtoul(since, NULL, 10) == generation;
+}
+/**
+ * @brief get metrics data, the device list is left out when the caller's copy is current
  */ 
 static esp_err_t metrics_get_handler(httpd_req_t *req)
 {
+    trace_record(TRACE_SUBSYS_HTTP, TRACE_HTTP_METRICS, TRACE_NO_DEVICE, req->method, 0);
     system_metrics_t *m = system_metrics_get();
     uint8_t discovered_count = 0U;
     uint8_t conn_count = 0U;
+    uint32_t generation = 0U;
 
     if (httpd_callbacks.ble_get_metrics_cb) {
-        httpd_callbacks.ble_get_metrics_cb( &discovered_count, &conn_count);
+        httpd_callbacks.ble_get_metrics_cb( &discovered_count, &conn_count, &generation);
     }
 
-    uint8_t indexes[discovered_count];
-    const char *names[discovered_count];
-    uint8_t macs[discovered_count * 6];
-    bool connected[discovered_count];
-    uint16_t uuids[discovered_count];
-    int8_t rssis[discovered_count];
+    ble_stats_t stats = {0};
+    if (httpd_callbacks.ble_get_stats_cb) {
+        httpd_callbacks.ble_get_stats_cb(&stats);
+    }
 
-    if (httpd_callbacks.ble_get_devices_cb){
-        httpd_callbacks.ble_get_devices_cb( indexes, names, macs, connected, uuids, rssis);
+    ble_devices_t *devices = NULL;
+    if (httpd_callbacks.ble_get_devices_cb && !metrics_devices_known(req, generation)) {
+        // the table is too big for the httpd task stack
+        devices = malloc(sizeof(*devices));
+        if (!devices) {
+            httpd_resp_send_500(req);
+            return ESP_ERR_NO_MEM;
+        }
+        generation = httpd_callbacks.ble_get_devices_cb(devices);
+        discovered_count = devices->count;
+        conn_count = devices->conn_count;
     }
 
-    char json[1064];
+    config_store_stats_t store = {0};
+    config_store_get_stats(&store);
+
+    char json[1408];
     int written = snprintf(json, sizeof(json),
         "{\"uptime_ms\":%lu,"
         "\"free_heap\":%u,"
@@ -314,41 +349,208 @@ static esp_err_t metrics_get_handler(httpd_req_t *req)
         "\"min_free_heap\":%u,"
         "\"conn_count\":%u,"
         "\"discovered_count\":%u,"
-        "\"devices\":[",
+        "\"pool\":{\"size\":%u,\"in_use\":%u,\"hits\":%lu,\"misses\":%lu,\"evictions\":%lu},"
+        "\"sched\":{\"queued\":%u,\"peak\":%u,\"command\":%lu,\"warmup\":%lu,\"background\":%lu},"
+        "\"reconnect\":{\"timeouts\":%lu,\"retries\":%lu,\"breaker_trips\":%lu,\"fast_fails\":%lu,"
+        "\"unreachable\":%u},"
+        "\"writes\":{\"credits\":%u,\"waiting\":%u,\"in_flight\":%u,\"completed\":%lu,\"superseded\":%lu,"
+        "\"overflows\":%lu,\"retries\":%lu,\"congestions\":%lu,\"timeouts\":%lu},"
+        "\"scan\":{\"profile\":\"%s\",\"backoff\":%u,\"paused\":%s,\"pauses\":%lu,\"yields\":%lu,\"held_ms\":%lu,"
+        "\"whitelist\":%s,\"whitelist_size\":%u},"
+        "\"reject_cache\":{\"hits\":%lu,\"lookups\":%lu,\"entries\":%u},"
+        "\"actor\":{\"queue_len\":%u,\"depth\":%u,\"peak\":%u,\"processed\":%lu,\"dropped\":%lu,"
+        "\"wait_avg_us\":%lu,\"wait_max_us\":%lu,\"service_avg_us\":%lu,\"service_max_us\":%lu},"
+        "\"config\":{\"requests\":%lu,\"commits\":%lu,\"avoided\":%lu,\"failures\":%lu,\"pending\":%lu},"
+        "\"generation\":%lu",
         m->uptime_ms, m->free_heap, m->total_heap, m->used_percent,
-        m->min_free_heap, conn_count, discovered_count);
-
-        for (uint8_t i = 0U; i < discovered_count; ++i) {
-        int len = snprintf(json + written, sizeof(json) - (size_t)written,
-            "{\"index\":%u,"
-            "\"name\":\"%s\","
-            "\"mac\":\"%02X:%02X:%02X:%02X:%02X:%02X\","
-            "\"connected\":%s,"
-            "\"uuid\":\"%04X\","
-            "\"rssi\":%d}%s",
-            indexes[i],
-            names[i] != NULL ? names[i] : "",
-            macs[i*6 + 0], macs[i*6 + 1], macs[i*6 + 2],
-            macs[i*6 + 3], macs[i*6 + 4], macs[i*6 + 5],
-            connected[i] ? "\"Connected\"" : "\"Disconnected\"",  
-            uuids[i],
-            rssis[i],
-            (i + 1U < discovered_count) ? "," : "");
-
-        if (len < 0) {
-            break; 
+        m->min_free_heap, conn_count, discovered_count,
+        stats.pool_size, stats.pool_in_use, stats.pool_hits, stats.pool_misses, stats.pool_evictions,
+        stats.conn_queued, stats.conn_queue_peak,
+        stats.opens_command, stats.opens_warmup, stats.opens_background,
+        stats.connect_timeouts, stats.connect_retries, stats.breaker_trips, stats.fast_fails,
+        stats.unreachable,
+        stats.write_credits, stats.write_waiting, stats.write_in_flight, stats.write_completed,
+        stats.write_superseded, stats.write_overflows, stats.write_retries, stats.write_congestions,
+        stats.write_timeouts,
+        stats.scan_profile ? stats.scan_profile : "", stats.scan_backoff,
+        stats.scan_paused ? "true" : "false", stats.scan_pauses, stats.scan_yields, stats.scan_held_ms,
+        stats.scan_whitelist ? "true" : "false", stats.whitelist_size,
+        stats.reject_hits, stats.reject_lookups, stats.reject_entries,
+        stats.actor_queue_len, stats.actor_queue_depth, stats.actor_queue_peak,
+        stats.actor_processed, stats.actor_dropped,
+        stats.actor_wait_avg_us, stats.actor_wait_max_us,
+        stats.actor_service_avg_us, stats.actor_service_max_us,
+        store.requests, store.commits, store.avoided, store.failures, store.pending,
+        (unsigned long)generation);
+
+    if (written < 0 || (size_t)written + 16U >= sizeof(json)) {
+        free(devices);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "application/json");
+
+    if (devices) {
+        written += snprintf(json + written, sizeof(json) - (size_t)written, ",\"devices\":[");
+
+        // rows are streamed in chunks, the table can hold up to 255 devices
+        uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+        for (uint8_t i = 0U; i < devices->count; ++i) {
+            const ble_device_record_t *dev = &devices->devices[i];
+            const ble_link_stats_t *link = &dev->link;
+            char row[544];
+            int len = snprintf(row, sizeof(row),
+                "{\"index\":%u,"
+                "\"name\":\"%s\","
+                "\"mac\":\"%02X:%02X:%02X:%02X:%02X:%02X\","
+                "\"connected\":%s,"
+                "\"state\":\"%s\","
+                "\"available\":%s,"
+                "\"conn\":{\"mode\":\"%s\",\"interval_us\":%lu,\"latency\":%u,\"timeout_ms\":%lu,"
+                "\"updates\":%u,\"refusals\":%u},"
+                "\"uuid\":\"%04X\","
+                "\"rssi\":%d,"
+                "\"link\":{\"connects\":%u,\"connect_failures\":%u,\"connect_avg_ms\":%u,"
+                "\"writes\":%u,\"write_failures\":%u,\"notifies\":%u,"
+                "\"disc_timeout\":%u,\"disc_remote\":%u,\"disc_local\":%u,\"disc_other\":%u,"
+                "\"last_reason\":%u,\"seen_ago_ms\":%lu}}%s",
+                dev->index,
+                dev->name,
+                dev->mac[0], dev->mac[1], dev->mac[2],
+                dev->mac[3], dev->mac[4], dev->mac[5],
+                dev->connected ? "\"Connected\"" : "\"Disconnected\"",  
+                reconnect_state_name((reconnect_state_t)dev->conn_state),
+                dev->available ? "true" : "false",
+                conn_params_mode_name((conn_params_mode_t)dev->conn_mode), (unsigned long)dev->conn_interval * 1250,
+                dev->conn_latency, (unsigned long)dev->conn_timeout * 10, dev->conn_updates, dev->conn_refusals,
+                dev->uuid,
+                dev->rssi,
+                link->connects, link->connect_failures, link->connect_avg_ms,
+                link->writes, link->write_failures, link->notifies,
+                link->disc_timeout, link->disc_remote, link->disc_local, link->disc_other,
+                link->last_reason, (unsigned long)(now_ms - link->last_seen_ms),
+                (i + 1U < devices->count) ? "," : "");
+
+            if (len < 0 || (size_t)len >= sizeof(row)) {
+                continue;
+            }
+            if ((size_t)(written + len) >= sizeof(json)) {
+                httpd_resp_send_chunk(req, json, written);
+                written = 0;
+            }
+            memcpy(json + written, row, (size_t)len);
+            written += len;
         }
-        written += len;
-        if ((size_t)written >= sizeof(json)) {
-            break;
+        free(devices);
+
+        if ((size_t)written + 2U >= sizeof(json)) {
+            httpd_resp_send_chunk(req, json, written);
+            written = 0;
         }
+        json[written++] = ']';
     }
-    if ((size_t)written < sizeof(json)) {
-        (void)snprintf(json + written, sizeof(json) - (size_t)written, "]}");
+    json[written++] = '}';
+
+    httpd_resp_send_chunk(req, json, written);
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+/**
+ * @brief append one histogram list to the response buffer, flushing full chunks
+ */
+static void latency_send_stages(httpd_req_t *req, int slot, char *buf, size_t size, size_t *written)
+{
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++) {
+        latency_hist_t hist;
+        latency_get(stage, slot, &hist);
+
+        char row[320];
+        size_t len = latency_hist_json(stage, &hist, true, row, sizeof(row) - 1);
+        if (len == 0) continue;
+        if (stage + 1 < LATENCY_STAGE_COUNT) row[len++] = ',';
+
+        if (*written + len >= size) {
+            httpd_resp_send_chunk(req, buf, *written);
+            *written = 0;
+        }
+        memcpy(buf + *written, row, len);
+        *written += len;
     }
+}
+/**
+ * @brief command latency histograms, hub-wide and per device
+ */
+static esp_err_t latency_get_handler(httpd_req_t *req)
+{
+    trace_record(TRACE_SUBSYS_HTTP, TRACE_HTTP_LATENCY, TRACE_NO_DEVICE, req->method, 0);
+    char json[1024];
+    size_t written = 0;
 
     httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+
+    written += snprintf(json, sizeof(json), "{\"bounds_us\":[");
+    for (int i = 0; i < LATENCY_BUCKETS - 1; i++) {
+        written += snprintf(json + written, sizeof(json) - written, "%lu%s",
+                            (unsigned long)latency_bucket_bound_us(i), i + 2 < LATENCY_BUCKETS ? "," : "");
+    }
+    written += snprintf(json + written, sizeof(json) - written, "],\"stages\":[");
+    latency_send_stages(req, -1, json, sizeof(json), &written);
+
+    int devices = latency_device_count();
+    for (int slot = 0; slot < devices; slot++) {
+        uint8_t mac[6];
+        if (!latency_device_mac(slot, mac)) continue;
+
+        char head[64];
+        int len = snprintf(head, sizeof(head), "%s{\"mac\":\"%02X:%02X:%02X:%02X:%02X:%02X\",\"stages\":[",
+                           slot == 0 ? "],\"devices\":[" : "]},",
+                           mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+        if (written + (size_t)len >= sizeof(json)) {
+            httpd_resp_send_chunk(req, json, written);
+            written = 0;
+        }
+        memcpy(json + written, head, (size_t)len);
+        written += (size_t)len;
+        latency_send_stages(req, slot, json, sizeof(json), &written);
+    }
+
+    if (written + 8 >= sizeof(json)) {
+        httpd_resp_send_chunk(req, json, written);
+        written = 0;
+    }
+    written += snprintf(json + written, sizeof(json) - written, devices > 0 ? "]}]}" : "],\"devices\":[]}");
+
+    httpd_resp_send_chunk(req, json, written);
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+/**
+ * @brief download the event trace ring, decode with tools/trace_decode.py
+ */
+static esp_err_t trace_get_handler(httpd_req_t *req)
+{
+    trace_record(TRACE_SUBSYS_HTTP, TRACE_HTTP_TRACE, TRACE_NO_DEVICE, req->method, 0);
+    size_t capacity = trace_capacity();
+    trace_record_t *records = NULL;
+    if (capacity > 0) {
+        // copy first so the download is consistent while recording goes on
+        records = malloc(capacity * sizeof(*records));
+        if (!records) {
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No memory for trace copy");
+            return ESP_FAIL;
+        }
+    }
+    trace_header_t hdr;
+    size_t count = trace_snapshot(&hdr, records, capacity);
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"bthub.trace\"");
+    httpd_resp_send_chunk(req, (const char *)&hdr, sizeof(hdr));
+    if (count > 0) {
+        httpd_resp_send_chunk(req, (const char *)records, count * sizeof(*records));
+    }
+    httpd_resp_send_chunk(req, NULL, 0);
+    free(records);
     return ESP_OK;
 }
 /**
@@ -369,18 +571,26 @@ static bool is_public_asset(const char *uri) {
  */
 static esp_err_t index_json_handler(httpd_req_t *req)
 {
+    trace_record(TRACE_SUBSYS_HTTP, TRACE_HTTP_INDEX_JSON, TRACE_NO_DEVICE, req->method, 0);
     httpd_resp_set_type(req, "application/json");
 
-    char device_name[32] ={0};
     uint8_t tx_power = 0;
     uint8_t interval= 0;
     uint8_t duration = 0;
     uint16_t mtu = 0;
     bool by_name = false;
     bool by_uuid = false;
-    uint16_t uuid = 0;
+    // pattern lists are too big for the httpd task stack
+    char *device_names = calloc(3, ADV_FILTER_TEXT_MAX);
+    if (!device_names) {
+        httpd_resp_send_500(req);
+        return ESP_ERR_NO_MEM;
+    }
+    char *uuids = device_names + ADV_FILTER_TEXT_MAX;
+    char *company_ids = uuids + ADV_FILTER_TEXT_MAX;
     if (httpd_callbacks.ble_get_config_cb) {
-        httpd_callbacks.ble_get_config_cb( &by_name, device_name, &by_uuid, &uuid, &tx_power, &interval, &duration, &mtu);
+        httpd_callbacks.ble_get_config_cb( &by_name, device_names, &by_uuid, uuids, company_ids,
+                                           &tx_power, &interval, &duration, &mtu);
     }
 
     char broker[64] ={0};
@@ -391,44 +601,34 @@ static esp_err_t index_json_handler(httpd_req_t *req)
         httpd_callbacks.mqtt_get_config_cb( broker, prefix , &user, &pass);
     }
 
-    char resp[512];
-    int len = snprintf(resp, sizeof(resp),
-        "{"
-            "\"broker\":\"%s\","
-            "\"prefix\":\"%s\","
-            "\"user\":%d,"
-            "\"pass\":%d,"
-            "\"device_name\":\"%s\","
-            "\"tx_power\":%d,"
-            "\"interval\":%d,"
-            "\"duration\":%d,"
-            "\"mtu\":%d,"
-            "\"by_name\":%d,"
-            "\"by_uuid\":%d,"
-            "\"uuid\":\"%04X\""
-        "}",
-        broker,
-        prefix,
-        (uint8_t)user,
-        (uint8_t)pass,
-        device_name,
-        (uint8_t)tx_power,
-        (uint8_t)interval,
-        (uint8_t)duration,
-        (uint16_t)mtu,
-        (uint8_t)by_name,
-        (uint8_t)by_uuid,
-        (uint16_t)uuid
-    );
-
-    if (len < 0 || len >= sizeof(resp)) {
+    // names are user input, let cJSON do the escaping
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "broker", broker);
+    cJSON_AddStringToObject(json, "prefix", prefix);
+    cJSON_AddNumberToObject(json, "user", user);
+    cJSON_AddNumberToObject(json, "pass", pass);
+    cJSON_AddStringToObject(json, "device_name", device_names);
+    cJSON_AddNumberToObject(json, "tx_power", tx_power);
+    cJSON_AddNumberToObject(json, "interval", interval);
+    cJSON_AddNumberToObject(json, "duration", duration);
+    cJSON_AddNumberToObject(json, "mtu", mtu);
+    cJSON_AddNumberToObject(json, "by_name", by_name);
+    cJSON_AddNumberToObject(json, "by_uuid", by_uuid);
+    cJSON_AddStringToObject(json, "uuid", uuids);
+    cJSON_AddStringToObject(json, "company_ids", company_ids);
+    free(device_names);
+
+    char *resp = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    if (!resp) {
         ESP_LOGE(TAG, "JSON error");
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "JSON build error");
         return ESP_FAIL;
     }
 
     ESP_LOGI(TAG, "Served /index.json");
-    httpd_resp_send(req, resp, len);
+    httpd_resp_sendstr(req, resp);
+    free(resp);
     return ESP_OK;
 }
 /**
@@ -436,6 +636,7 @@ static esp_err_t index_json_handler(httpd_req_t *req)
  */ 
 static esp_err_t littlefs_handler(httpd_req_t *req)
 {
+    trace_record(TRACE_SUBSYS_HTTP, TRACE_HTTP_FILE, TRACE_NO_DEVICE, req->method, 0);
     // If login required, redirect
     if (!check_session(req) && !is_public_asset(req->uri)) {
         httpd_resp_set_status(req, "302 Found");
@@ -476,6 +677,7 @@ static esp_err_t littlefs_handler(httpd_req_t *req)
  */ 
 static esp_err_t set_login_post_handler(httpd_req_t *req)
 {
+    trace_record(TRACE_SUBSYS_HTTP, TRACE_HTTP_SET_LOGIN, TRACE_NO_DEVICE, req->method, 0);
     char buf[64];
     int ret = httpd_req_recv(req, buf, sizeof(buf) - 1);
     if (ret <= 0) {
@@ -515,6 +717,7 @@ static esp_err_t set_login_post_handler(httpd_req_t *req)
  */ 
 static esp_err_t mqtt_submit_post(httpd_req_t *req)
 {
+    trace_record(TRACE_SUBSYS_HTTP, TRACE_HTTP_MQTT_SUBMIT, TRACE_NO_DEVICE, req->method, 0);
     char buf[192];
     int ret = httpd_req_recv(req, buf, sizeof(buf) - 1);
     
@@ -550,33 +753,60 @@ static esp_err_t mqtt_submit_post(httpd_req_t *req)
  */ 
 static esp_err_t ble_submit_post(httpd_req_t *req)
 {
-    char buf[128];
-    int ret = httpd_req_recv(req, buf, sizeof(buf) - 1);
-    
-    if (ret <= 0) {
-        httpd_resp_send_500(req);
+    trace_record(TRACE_SUBSYS_HTTP, TRACE_HTTP_BLE_SUBMIT, TRACE_NO_DEVICE, req->method, 0);
+    // three pattern lists plus the scalar fields
+    const size_t max_len = 4 * ADV_FILTER_TEXT_MAX;
+    if (req->content_len == 0 || req->content_len >= max_len) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid request size");
         return ESP_FAIL;
     }
-    buf[ret] = '\0';
+    char *buf = malloc(req->content_len + 1);
+    if (!buf) {
+        httpd_resp_send_500(req);
+        return ESP_ERR_NO_MEM;
+    }
+    size_t received = 0;
+    while (received < req->content_len) {
+        int ret = httpd_req_recv(req, buf + received, req->content_len - received);
+        if (ret <= 0) {
+            free(buf);
+            httpd_resp_send_500(req);
+            return ESP_FAIL;
+        }
+        received += (size_t)ret;
+    }
+    buf[received] = '\0';
     cJSON *json = cJSON_Parse(buf);
+    free(buf);
     if (!json) {
         httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
         return ESP_FAIL;
     }
 
-    const char *ble_name = cJSON_GetStringValue(cJSON_GetObjectItem(json, "device_name"));
+    const char *ble_names = cJSON_GetStringValue(cJSON_GetObjectItem(json, "device_name"));
+    const char *company_ids = cJSON_GetStringValue(cJSON_GetObjectItem(json, "company_ids"));
     uint8_t tx_power = (uint8_t)cJSON_GetNumberValue(cJSON_GetObjectItem(json, "tx_power"));
     uint8_t interval = (uint8_t)cJSON_GetNumberValue(cJSON_GetObjectItem(json, "interval"));
     uint8_t duration = (uint8_t)cJSON_GetNumberValue(cJSON_GetObjectItem(json, "duration"));
     uint16_t mtu = (uint16_t)cJSON_GetNumberValue(cJSON_GetObjectItem(json, "mtu"));
     bool by_name = cJSON_IsTrue(cJSON_GetObjectItem(json, "by_name"));
     bool by_uuid = cJSON_IsTrue(cJSON_GetObjectItem(json, "by_uuid"));
-    uint16_t uuid = (uint16_t)cJSON_GetNumberValue(cJSON_GetObjectItem(json, "uuid"));
 
-    ESP_LOGI(TAG, "ble config received: by_name=%d, device_name=%s, by_uuid=%d, UUID=0x%04X, tx_power=%d, interval=%d, duration=%d, mtu=%d",
-                by_name, ble_name, by_uuid, uuid , (int)tx_power, (int)interval, (int)duration, (int)mtu);
+    // older pages send a single 16-bit uuid as a number
+    cJSON *uuid_item = cJSON_GetObjectItem(json, "uuid");
+    char uuid_num[8] = {0};
+    const char *uuids = cJSON_GetStringValue(uuid_item);
+    if (!uuids && cJSON_IsNumber(uuid_item)) {
+        snprintf(uuid_num, sizeof(uuid_num), "%04X", (uint16_t)cJSON_GetNumberValue(uuid_item));
+        uuids = uuid_num;
+    }
+
+    ESP_LOGI(TAG, "ble config received: by_name=%d, device_name=%s, by_uuid=%d, UUID=%s, company_ids=%s, tx_power=%d, interval=%d, duration=%d, mtu=%d",
+                by_name, ble_names ? ble_names : "", by_uuid, uuids ? uuids : "", company_ids ? company_ids : "",
+                (int)tx_power, (int)interval, (int)duration, (int)mtu);
 
-    httpd_callbacks.ble_config_cb( &by_name, ble_name ? ble_name : "", &by_uuid, &uuid, &tx_power, &interval, &duration, &mtu);
+    httpd_callbacks.ble_config_cb( &by_name, ble_names ? ble_names : "", &by_uuid, uuids ? uuids : "",
+                                   company_ids ? company_ids : "", &tx_power, &interval, &duration, &mtu);
 
     cJSON_Delete(json);
 
@@ -589,6 +819,7 @@ static esp_err_t ble_submit_post(httpd_req_t *req)
  */ 
 static esp_err_t ble_reset_post(httpd_req_t *req)
 {
+    trace_record(TRACE_SUBSYS_HTTP, TRACE_HTTP_BLE_RESET, TRACE_NO_DEVICE, req->method, 0);
     char buf[32];
     while (httpd_req_recv(req, buf, sizeof(buf)) > 0) {}
 
@@ -621,6 +852,7 @@ void httpd_manager_start(bool captive_portal)
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.server_port = 80;
     config.max_open_sockets = 7;
+    config.max_uri_handlers = 12; // default 8 is already used up by the normal mode pages
     config.lru_purge_enable = true;
     config.uri_match_fn = httpd_uri_match_wildcard;
     // Start the server
@@ -706,6 +938,22 @@ void httpd_manager_start(bool captive_portal)
         };
         httpd_register_uri_handler(server, &metrics_uri);
 
+        httpd_uri_t latency_uri = {
+            .uri       = "/latency",
+            .method    = HTTP_GET,
+            .handler   = latency_get_handler,
+            .user_ctx  = NULL
+        };
+        httpd_register_uri_handler(server, &latency_uri);
+
+        httpd_uri_t trace_uri = {
+            .uri       = "/trace",
+            .method    = HTTP_GET,
+            .handler   = trace_get_handler,
+            .user_ctx  = NULL
+        };
+        httpd_register_uri_handler(server, &trace_uri);
+
         httpd_uri_t index_json_uri = {
             .uri      = "/index.json",
             .method   = HTTP_GET,
@@ -771,6 +1019,7 @@ void httpd_manager_set_callbacks(
     ble_config_cb_t ble_config,
     ble_get_config_cb_t ble_get_config,
     ble_get_metrics_cb_t ble_get_metrics,
+    ble_get_stats_cb_t ble_get_stats,
     ble_get_devices_cb_t ble_get_devices,
     ble_reset_devices_cb_t ble_reset_devices)
 {
@@ -780,6 +1029,7 @@ void httpd_manager_set_callbacks(
     if (ble_config) httpd_callbacks.ble_config_cb = ble_config;
     if (ble_get_config) httpd_callbacks.ble_get_config_cb = ble_get_config;
     if (ble_get_metrics) httpd_callbacks.ble_get_metrics_cb = ble_get_metrics;
+    if (ble_get_stats) httpd_callbacks.ble_get_stats_cb = ble_get_stats;
     if (ble_get_devices) httpd_callbacks.ble_get_devices_cb = ble_get_devices;
     if (ble_reset_devices) httpd_callbacks.ble_reset_devices_cb = ble_reset_devices;
 }
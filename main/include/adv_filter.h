@@ -0,0 +1,103 @@
+#ifndef adv_filter_H
+#define adv_filter_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "adv_parser.h"
+
+#define ADV_FILTER_MAX_PATTERNS 32  // per kind
+#define ADV_FILTER_SLOTS        64  // hash slots per kind, power of two, load <= 0.5
+#define ADV_FILTER_TEXT_MAX     512 // comma separated pattern list exchanged with the web ui
+#define ADV_FILTER_BLOB_MAX     (5 + ADV_FILTER_MAX_PATTERNS * (1 + ADV_NAME_MAX + 2 + 16 + 2)) // with 128-bit UUIDs of older firmware
+
+/**
+ * @brief hashed set over the patterns of one kind
+ */
+typedef struct {
+    uint8_t count;
+    uint8_t slots[ADV_FILTER_SLOTS]; // pattern index + 1, 0 when empty
+} adv_pattern_set_t;
+
+/**
+ * @brief Discovery filter compiled from the user config. Names, 16-bit
+ * service UUIDs and manufacturer company ids are each kept in a hashed set,
+ * so matching cost does not grow with the number of patterns.
+ *
+ * An advert passes when every enabled kind matches:
+ *  - by_name: its name equals one of the names
+ *  - by_uuid: one of its 16-bit service UUIDs is in the list
+ *  - company ids (enabled when the list is not empty): its manufacturer
+ *    data starts with one of the company ids
+ *
+ * 128-bit service UUIDs are not accepted as patterns: a lamp is driven
+ * through the characteristics at its 16-bit service UUID + 1 (write) and
+ * + 2 (notify), a lamp found by a 128-bit UUID alone could be listed but
+ * never controlled.
+ */
+typedef struct {
+    bool by_name;
+    bool by_uuid;
+
+    adv_pattern_set_t name_set;
+    char names[ADV_FILTER_MAX_PATTERNS][ADV_NAME_MAX + 1];
+    uint8_t name_lens[ADV_FILTER_MAX_PATTERNS]; // cached so matching never calls strlen
+    uint32_t name_len_mask;                     // bit n set when a name has n characters
+
+    adv_pattern_set_t uuid16_set;
+    uint8_t uuid16[ADV_FILTER_MAX_PATTERNS][2];     // little endian, as advertised
+
+    adv_pattern_set_t company_set;
+    uint8_t company[ADV_FILTER_MAX_PATTERNS][2];    // little endian, as advertised
+} adv_filter_t;
+
+/**
+ * @brief drop all patterns, by_name/by_uuid are kept
+ */
+void adv_filter_clear(adv_filter_t *filter);
+/**
+ * @brief replace the name patterns
+ * @param text comma separated names, e.g. "ELK-BLEDOM, Triones"
+ * @return ESP_ERR_INVALID_ARG on a name that is too long, ESP_ERR_NO_MEM on too many names
+ */
+esp_err_t adv_filter_set_names(adv_filter_t *filter, const char *text);
+/**
+ * @brief replace the service UUID patterns
+ * @param text comma separated 4 hex digit 16-bit UUIDs
+ * @return ESP_ERR_NOT_SUPPORTED on a 128-bit UUID, ESP_ERR_INVALID_ARG on anything else
+ */
+esp_err_t adv_filter_set_uuids(adv_filter_t *filter, const char *text);
+/**
+ * @brief replace the manufacturer company id patterns
+ * @param text comma separated 4 hex digit company ids, empty disables the check
+ */
+esp_err_t adv_filter_set_companies(adv_filter_t *filter, const char *text);
+/**
+ * @brief format patterns back into the comma separated form
+ */
+void adv_filter_get_names(const adv_filter_t *filter, char *buf, size_t len);
+void adv_filter_get_uuids(const adv_filter_t *filter, char *buf, size_t len);
+void adv_filter_get_companies(const adv_filter_t *filter, char *buf, size_t len);
+/**
+ * @brief check a parsed advertisement against the filter
+ * @param uuid16 set on a match: the 16-bit service UUID that matched, else the
+ * first advertised one, 0 if none. NULL if not needed
+ */
+bool adv_filter_match(const adv_filter_t *filter, const adv_fields_t *fields, uint16_t *uuid16);
+/**
+ * @brief patterns in their compact on-flash form (flags are not included)
+ * @param buf output, ADV_FILTER_BLOB_MAX bytes are always enough
+ * @return number of bytes written, 0 if buf is too small
+ */
+size_t adv_filter_serialize(const adv_filter_t *filter, uint8_t *buf, size_t len);
+/**
+ * @brief restore patterns written by adv_filter_serialize, 128-bit UUIDs
+ * stored by older firmware are skipped
+ */
+esp_err_t adv_filter_deserialize(adv_filter_t *filter, const uint8_t *buf, size_t len);
+/**
+ * @brief compare the patterns of two filters
+ */
+bool adv_filter_same_patterns(const adv_filter_t *a, const adv_filter_t *b);
+#endif // adv_filter_H
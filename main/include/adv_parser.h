@@ -0,0 +1,48 @@
+#ifndef adv_parser_H
+#define adv_parser_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ADV_NAME_MAX 31
+
+/* AD types (Bluetooth Core Supplement, part A, 1) */
+#define ADV_TYPE_FLAGS          0x01
+#define ADV_TYPE_UUID16_INCMPL  0x02
+#define ADV_TYPE_UUID16_CMPL    0x03
+#define ADV_TYPE_UUID128_INCMPL 0x06
+#define ADV_TYPE_UUID128_CMPL   0x07
+#define ADV_TYPE_NAME_SHORT     0x08
+#define ADV_TYPE_NAME_CMPL      0x09
+#define ADV_TYPE_MANUFACTURER   0xFF
+
+/**
+ * @brief fields of one advertisement (adv data + scan response).
+ * Pointers refer into the caller's buffer, nothing is copied.
+ */
+typedef struct {
+    const uint8_t *name;        // complete name, shortened name as fallback
+    uint8_t name_len;
+    const uint8_t *uuid16;      // little endian list, 2 bytes per uuid
+    uint8_t uuid16_len;
+    const uint8_t *uuid128;     // little endian list, 16 bytes per uuid
+    uint8_t uuid128_len;
+    const uint8_t *mfg_data;    // starts with the 16-bit company id
+    uint8_t mfg_len;
+    uint8_t flags;
+    bool has_flags;
+} adv_fields_t;
+
+/**
+ * @brief walk the AD structures once and collect the fields we use
+ * @param data raw adv data followed by scan response
+ * @param len total length
+ * @param fields output
+ * @return false if the data is malformed (fields parsed so far are kept)
+ */
+bool adv_parse(const uint8_t *data, uint16_t len, adv_fields_t *fields);
+/**
+ * @brief first 16-bit service UUID of an advertisement, 0 if none
+ */
+uint16_t adv_first_uuid16(const adv_fields_t *fields);
+#endif // adv_parser_H
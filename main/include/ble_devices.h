@@ -0,0 +1,59 @@
+#ifndef ble_devices_H
+#define ble_devices_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+
+#define BLE_DEVICES_MAX CONFIG_BTHUB_MAX_DEVICES
+
+/**
+ * @brief link counters of one device, kept since it was discovered
+ */
+typedef struct {
+    uint16_t connects;          // links opened
+    uint16_t connect_failures;  // opens that failed
+    uint16_t connect_avg_ms;    // connect start to ESP_GATTC_OPEN_EVT
+    uint16_t writes;            // frames handed to the stack
+    uint16_t write_failures;    // rejected by the stack or reported failed
+    uint16_t notifies;          // notifications received
+    uint16_t disc_timeout;      // supervision timeout (0x08)
+    uint16_t disc_remote;       // closed by the lamp (0x13)
+    uint16_t disc_local;        // closed by the hub (0x16)
+    uint16_t disc_other;        // any other reason
+    uint8_t last_reason;        // reason of the last disconnect
+    uint32_t last_seen_ms;      // uptime of the last advert, link event or notification
+} ble_link_stats_t;
+
+/**
+ * @brief one discovered device as seen by the getters
+ */
+typedef struct {
+    uint8_t mac[6];
+    uint8_t index;          // device app id
+    bool connected;
+    uint16_t uuid;          // advertised 16-bit service uuid
+    int8_t rssi;
+    bool available;         // false while the reconnect breaker reports it unreachable
+    uint8_t conn_state;     // reconnect_state_t
+    uint8_t conn_mode;      // conn_params_mode_t, parameters below are 0 while not connected
+    uint16_t conn_interval; // connection interval in effect, 1.25 ms units
+    uint16_t conn_latency;  // slave latency in effect
+    uint16_t conn_timeout;  // supervision timeout in effect, 10 ms units
+    uint16_t conn_updates;  // parameter updates that took effect
+    uint16_t conn_refusals; // parameter updates refused
+    char name[32];
+    ble_link_stats_t link;
+} ble_device_record_t;
+
+/**
+ * @brief copy of the device table, published by the device manager
+ */
+typedef struct {
+    uint32_t generation;    // changes when a count or a record changed, not on counters and RSSI jitter alone
+    uint8_t count;          // discovered devices, valid records
+    uint8_t conn_count;     // connected devices
+    ble_device_record_t devices[BLE_DEVICES_MAX];
+} ble_devices_t;
+
+#endif // ble_devices_H
@@ -0,0 +1,70 @@
+#ifndef ble_stats_H
+#define ble_stats_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief BLE runtime counters, filled by the device manager and shown on /metrics
+ */
+typedef struct {
+    // connection pool
+    uint8_t pool_size;          // max concurrent links (CONFIG_BTHUB_MAX_CONNECTIONS)
+    uint8_t pool_in_use;        // links open or being opened
+    uint32_t pool_hits;         // command found its device already connected
+    uint32_t pool_misses;       // command had to open a link first
+    uint32_t pool_evictions;    // idle links closed to make room
+
+    // connection scheduler, one open at a time
+    uint8_t conn_queued;        // devices waiting for their open
+    uint8_t conn_queue_peak;
+    uint32_t opens_command;     // opens started for queued commands
+    uint32_t opens_warmup;      // for recently used lamps that lost their link
+    uint32_t opens_background;  // to resolve GATT handles ahead of use
+
+    // reconnect policy
+    uint32_t connect_timeouts;  // attempts cut off at CONFIG_BTHUB_CONNECT_TIMEOUT_MS
+    uint32_t connect_retries;   // failed attempts retried after a backoff
+    uint32_t breaker_trips;     // devices declared unreachable
+    uint32_t fast_fails;        // commands failed at once for an unreachable device
+    uint8_t unreachable;        // devices reported unavailable now
+
+    // write pipelines
+    uint8_t write_credits;      // writes in flight allowed per link
+    uint16_t write_waiting;     // frames waiting for a credit, all links
+    uint16_t write_in_flight;   // writes handed to the stack, all links
+    uint32_t write_completed;   // completion events
+    uint32_t write_superseded;  // waiting frames replaced by a newer value
+    uint32_t write_overflows;   // waiting frames dropped, pipeline full
+    uint32_t write_retries;     // writes sent again after congestion
+    uint32_t write_congestions; // congestion reports
+    uint32_t write_timeouts;    // writes given up without completion
+
+    // scan scheduler
+    const char *scan_profile;   // profile used for the next scan
+    uint8_t scan_backoff;       // rest between scans is interval << backoff
+    bool scan_paused;           // waiting for GATT traffic to settle
+    uint32_t scan_pauses;       // scans postponed for GATT traffic
+    uint32_t scan_yields;       // running scans stopped for GATT traffic
+    uint32_t scan_held_ms;      // time scanning was held back for GATT traffic
+    bool scan_whitelist;        // last scan used the controller accept list
+    uint8_t whitelist_size;     // devices in the accept list
+
+    // advert reject cache
+    uint32_t reject_hits;       // adverts dropped without parsing
+    uint32_t reject_lookups;    // adverts from unknown devices
+    uint16_t reject_entries;    // cached macs
+
+    // device actor
+    uint8_t actor_queue_len;    // queue capacity
+    uint8_t actor_queue_depth;  // messages waiting now
+    uint8_t actor_queue_peak;   // most messages ever waiting
+    uint32_t actor_processed;   // messages handled
+    uint32_t actor_dropped;     // events lost to a full queue
+    uint32_t actor_wait_avg_us; // post to start of handling
+    uint32_t actor_wait_max_us;
+    uint32_t actor_service_avg_us; // handler run time
+    uint32_t actor_service_max_us;
+} ble_stats_t;
+
+#endif // ble_stats_H
@@ -0,0 +1,68 @@
+#ifndef config_store_H
+#define config_store_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef struct {
+    uint32_t requests;  // deferred saves requested
+    uint32_t commits;   // blobs written to flash
+    uint32_t avoided;   // saves replaced by a newer copy before they were written
+    uint32_t failures;  // deferred writes that failed, retried a few times
+    uint32_t pending;   // blobs waiting for the quiet period
+} config_store_stats_t;
+
+/**
+ * @brief bring a config written by an older schema up to date
+ * @param version schema found on flash, 0 when only the old one-key-per-setting layout exists
+ * @param old stored payload, NULL for version 0
+ * @param old_len payload size
+ * @param data current struct, holds the defaults on entry
+ * @param len in: size of data, out: bytes to persist
+ * @return ESP_OK to keep the result, it is saved under the current version
+ */
+typedef esp_err_t (*config_store_migrate_cb_t)(uint8_t version, const uint8_t *old, size_t old_len,
+                                               void *data, size_t *len);
+
+/**
+ * @brief load the config blob of a subsystem, one NVS read per boot
+ * @param ns NVS namespace of the subsystem
+ * @param version current schema version
+ * @param data config struct, holds the defaults on entry
+ * @param len in: size of data, out: payload bytes loaded
+ * @param migrate called for missing or older blobs, NULL to refuse them
+ * @return ESP_OK when data holds the stored or migrated config,
+ * ESP_ERR_INVALID_VERSION for a blob from newer firmware
+ */
+esp_err_t config_store_load(const char *ns, uint8_t version, void *data, size_t *len,
+                            config_store_migrate_cb_t migrate);
+/**
+ * @brief persist the config blob of a subsystem with a single commit
+ * @param ns NVS namespace of the subsystem
+ * @param version current schema version
+ * @param data config payload
+ * @param len payload size
+ */
+esp_err_t config_store_save(const char *ns, uint8_t version, const void *data, size_t len);
+/**
+ * @brief start the deferred writer task and flush it on restart, call after nvs_flash_init
+ */
+esp_err_t config_store_init(void);
+/**
+ * @brief queue the config blob of a subsystem for writing after a quiet period,
+ * a newer save of the same namespace replaces the pending copy
+ * @param data copied, the caller may reuse it right away
+ * @note writes through when called before config_store_init
+ */
+esp_err_t config_store_save_deferred(const char *ns, uint8_t version, const void *data, size_t len);
+/**
+ * @brief write all pending blobs now, a failed write stays pending and is
+ * retried a few times by the flush task
+ */
+void config_store_flush(void);
+/**
+ * @brief deferred writer counters
+ */
+void config_store_get_stats(config_store_stats_t *stats);
+#endif // config_store_H
@@ -0,0 +1,75 @@
+#ifndef conn_params_H
+#define conn_params_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_gap_ble_api.h"
+
+/**
+ * @brief Per-link connection parameter policy. A lamp receiving commands
+ * (slider drag, transition) gets a short connection interval so each write
+ * goes out on the next connection event. Once no command arrived for
+ * CONFIG_BTHUB_CONN_IDLE_AFTER_MS the link drops back to a long interval with
+ * slave latency. A lamp that refuses an update isn't asked again for
+ * CONN_PARAMS_RETRY_MS. Plain state, owned by the device actor.
+ */
+
+typedef enum {
+    CONN_PARAMS_DEFAULT,    // as negotiated at connect, nothing requested yet
+    CONN_PARAMS_FAST,       // short interval, no latency
+    CONN_PARAMS_IDLE,       // long interval with slave latency
+    CONN_PARAMS_MODE_COUNT
+} conn_params_mode_t;
+
+typedef struct {
+    uint8_t mode;           // conn_params_mode_t in effect
+    uint8_t requested;      // mode of the outstanding update, mode if none
+    uint8_t wanted;         // mode the traffic asks for
+    uint16_t interval;      // in effect, 1.25 ms units
+    uint16_t latency;       // connection events the lamp may skip
+    uint16_t timeout;       // supervision timeout, 10 ms units
+    int64_t active_us;      // last command for the lamp
+    int64_t refused_us;     // last update the lamp or the stack refused, 0 if none
+    uint16_t updates;       // updates that took effect
+    uint16_t refusals;
+} conn_params_t;
+
+/**
+ * @brief mode name for /metrics
+ */
+const char *conn_params_mode_name(conn_params_mode_t mode);
+/**
+ * @brief link opened with the parameters the stack negotiated
+ * @param interval 1.25 ms units
+ * @param timeout 10 ms units
+ */
+void conn_params_opened(conn_params_t *cp, uint16_t interval, uint16_t latency, uint16_t timeout, int64_t now_us);
+/**
+ * @brief a command is on its way to the lamp
+ * @return CONN_PARAMS_FAST if that update should be requested now, else CONN_PARAMS_MODE_COUNT
+ */
+conn_params_mode_t conn_params_activity(conn_params_t *cp, int64_t now_us);
+/**
+ * @brief time the link should go idle, 0 if nothing is due
+ */
+int64_t conn_params_due_us(const conn_params_t *cp);
+/**
+ * @brief the idle time passed
+ * @return CONN_PARAMS_IDLE if that update should be requested now, else CONN_PARAMS_MODE_COUNT
+ */
+conn_params_mode_t conn_params_service(conn_params_t *cp, int64_t now_us);
+/**
+ * @brief an update was handed to the stack
+ */
+void conn_params_requested(conn_params_t *cp, conn_params_mode_t mode);
+/**
+ * @brief ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT or a request the stack rejected
+ * @param ok update took effect, the values are the ones in effect
+ */
+void conn_params_updated(conn_params_t *cp, bool ok, uint16_t interval, uint16_t latency, uint16_t timeout,
+                         int64_t now_us);
+/**
+ * @brief fill the update request of a mode, bda is left to the caller
+ */
+void conn_params_fill(conn_params_mode_t mode, esp_ble_conn_update_params_t *params);
+#endif // conn_params_H
@@ -0,0 +1,93 @@
+#ifndef conn_sched_H
+#define conn_sched_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef CONN_SCHED_MAX_DEVICES
+#include "sdkconfig.h"
+#define CONN_SCHED_MAX_DEVICES CONFIG_BTHUB_MAX_DEVICES
+#endif
+
+/**
+ * @brief Connection scheduler. Bluedroid handles one esp_ble_gattc_open at a
+ * time, so opens are queued and started one by one: devices with queued
+ * commands first, then warm-up (links of recently used lamps that dropped),
+ * then background (handle prefetch), first come first served within a class.
+ * The caller starts the next open as soon as the OPEN event of the current
+ * one arrives. Plain state without locking, owned by the device actor (and
+ * used as is by tools/conn_sched_sim.c).
+ */
+
+typedef enum {
+    CONN_PRIO_COMMAND,      // commands wait for the link
+    CONN_PRIO_WARMUP,       // recently used lamp lost its link
+    CONN_PRIO_BACKGROUND,   // nothing waits, e.g. resolve GATT handles early
+    CONN_PRIO_COUNT
+} conn_prio_t;
+
+#define CONN_PRIO_NONE CONN_PRIO_COUNT // not queued
+#define CONN_SCHED_DROPPED -2           // opening: the device left the table, its open is still outstanding
+
+typedef struct {
+    uint8_t prio[CONN_SCHED_MAX_DEVICES];   // conn_prio_t or CONN_PRIO_NONE
+    uint32_t order[CONN_SCHED_MAX_DEVICES]; // request sequence, FIFO within a class
+    uint32_t seq;
+    int16_t opening;                        // device with the outstanding open, -1 if none, or CONN_SCHED_DROPPED
+    uint8_t queued;                         // devices waiting
+    uint8_t queued_peak;
+    uint32_t opens[CONN_PRIO_COUNT];        // opens started per class
+} conn_sched_t;
+
+/**
+ * @brief may a device open now, checked in priority order
+ * @param ctx caller context of conn_sched_next
+ */
+typedef bool (*conn_sched_ready_fn)(int device, conn_prio_t prio, void *ctx);
+
+/**
+ * @brief empty queue, no open outstanding
+ */
+void conn_sched_init(conn_sched_t *sched);
+/**
+ * @brief queue a device, a queued device keeps its place and takes the
+ * higher of both classes
+ */
+void conn_sched_request(conn_sched_t *sched, int device, conn_prio_t prio);
+/**
+ * @brief take a device out of the queue
+ */
+void conn_sched_cancel(conn_sched_t *sched, int device);
+/**
+ * @brief class a device is queued in, CONN_PRIO_NONE if not queued
+ */
+conn_prio_t conn_sched_priority(const conn_sched_t *sched, int device);
+/**
+ * @brief whether an open is outstanding
+ */
+bool conn_sched_busy(const conn_sched_t *sched);
+/**
+ * @brief device to open next: highest class, oldest request, ready
+ * @param count devices in the table
+ * @return device index, -1 if an open is outstanding or none is ready
+ */
+int conn_sched_next(const conn_sched_t *sched, int count, conn_sched_ready_fn ready, void *ctx);
+/**
+ * @brief the open of a device was started, dequeues it
+ */
+void conn_sched_opening(conn_sched_t *sched, int device);
+/**
+ * @brief the open of a device finished (OPEN event or given up), the next may start
+ */
+void conn_sched_opened(conn_sched_t *sched, int device);
+/**
+ * @brief a device leaves the table: it is dequeued, and an open of it that is
+ * still outstanding keeps the scheduler busy until
+ * conn_sched_opened(sched, CONN_SCHED_DROPPED)
+ */
+void conn_sched_drop(conn_sched_t *sched, int device);
+/**
+ * @brief a device moved to another slot of the table, the old slot is freed
+ */
+void conn_sched_move(conn_sched_t *sched, int from, int to);
+#endif // conn_sched_H
@@ -2,6 +2,8 @@
 #define device_manager_H
 
 #include <stdint.h>
+#include "ble_stats.h"
+#include "ble_devices.h"
 
 // Callback function types
 typedef void (*device_found_cb_t)(const uint8_t *mac, const char *name);
@@ -9,6 +11,7 @@ typedef void (*all_devices_found_cb_t)(void);
 typedef void (*device_connected_cb_t)(int device_index);
 typedef void (*device_disconnected_cb_t)(int device_index);
 typedef void (*device_power_state_cb_t)(bool power_state, uint8_t *mac);
+typedef void (*device_availability_cb_t)(const uint8_t *mac, bool available);
 
 /**
  * @brief device manager initialization 
@@ -22,61 +25,80 @@ void device_manager_set_callbacks(
     all_devices_found_cb_t all_found,
     device_connected_cb_t device_connected,
     device_disconnected_cb_t device_disconnected,
-    device_power_state_cb_t device_power_state);
+    device_power_state_cb_t device_power_state,
+    device_availability_cb_t device_availability);
 
 /**
- * @brief connect to device
+ * @brief connect to device, device actor only
  * @param device_index device app id
  */
 bool connect_to_device(int device_index);
 /**
- * @brief turn ble device on/off
+ * @brief close the link to a device, device actor only
+ * @param device_index device app id
+ */
+bool disconnect_from_device(int device_index);
+/**
+ * @brief turn ble device on/off, queued to the device actor
  * @param mac address of device
  * @param power on/off
+ * @param rx_us esp_timer time the command was received, 0 if unknown (latency stats)
+ * @return false if the actor queue stayed full
  */
-bool device_set_power(const uint8_t *mac, const bool power);
+bool device_set_power(const uint8_t *mac, const bool power, int64_t rx_us);
 /**
- * @brief device_set_brightness set brightness of bluetooth light
+ * @brief device_set_brightness set brightness of bluetooth light, queued to the device actor
  * @param mac address of device
  * @param brightness brightness (in hex)
+ * @param rx_us esp_timer time the command was received, 0 if unknown
  */
-bool device_set_brightness(const uint8_t *mac, uint8_t brightness);
+bool device_set_brightness(const uint8_t *mac, uint8_t brightness, int64_t rx_us);
 /**
- * @brief set color of bluetooth light
+ * @brief set color of bluetooth light, queued to the device actor
  * @param mac address of device
  * @param r red (in hex)
  * @param g greeb (in hex)
  * @param b blue (in hex)
+ * @param rx_us esp_timer time the command was received, 0 if unknown
  */
-bool device_set_color(const uint8_t *mac, uint8_t r, uint8_t g ,uint8_t b);
+bool device_set_color(const uint8_t *mac, uint8_t r, uint8_t g ,uint8_t b, int64_t rx_us);
 /**
- * @brief reset device list
+ * @brief reset device list, waits for the device actor
  */
 bool ble_reset_devices(void);
 /**
- * @brief set device config 
+ * @brief set device config, applied live: a filter change only drops the
+ * devices that no longer match, connected lamps that still match stay up
  * @param by_name enable filter by name?
- * @param device_name new device name filter
+ * @param device_names comma separated device names
  * @param by_uuid enable filter by UUID?
- * @param uuid new uuid filter
+ * @param uuids comma separated 16-bit service UUIDs (4 hex digits), 128-bit UUIDs are refused
+ * @param company_ids comma separated manufacturer company ids (4 hex digits), empty to disable
  * @param tx_power ble power level
  * @param interval time between scans in s
  * @param druation scan duration
  * @param mtu mtu size
  */
-void ble_update_config( const bool *by_name, const char *device_name, const bool *by_uuid, const uint16_t *uuid,
-                        const uint8_t *tx_power, const uint8_t *interval, const uint8_t *duration, const uint16_t *mtu);
+void ble_update_config( const bool *by_name, const char *device_names, const bool *by_uuid, const char *uuids,
+                        const char *company_ids, const uint8_t *tx_power, const uint8_t *interval, const uint8_t *duration, const uint16_t *mtu);
 /**
- * @brief getter for current config
+ * @brief getter for current config, pattern lists need ADV_FILTER_TEXT_MAX bytes each
  */
-void ble_get_config(bool *by_name, char *device_name, bool *by_uuid, uint16_t *uuid, 
+void ble_get_config(bool *by_name, char *device_names, bool *by_uuid, char *uuids, char *company_ids,
                     uint8_t *tx_power, uint8_t *interval, uint8_t *duration, uint16_t *mtu);
 /**
- * @brief getter for general ble metrics
+ * @brief getter for general ble metrics, never blocks the device actor
+ * @param generation device table generation, NULL if not needed
+ */
+void ble_get_metrics(uint8_t *discovered_count, uint8_t *conn_count, uint32_t *generation);
+/**
+ * @brief getter for ble runtime counters
  */
-void ble_get_metrics(uint8_t *discovered_count, uint8_t *conn_count);
+void ble_get_stats(ble_stats_t *stats);
 /**
- * @brief getter for ble devices
+ * @brief copy of the device table, never blocks the device actor
+ * @param devices filled with a consistent copy
+ * @return generation of the copy, unchanged generation means unchanged table
  */
-void ble_get_devices(uint8_t *indexes,const char **names, uint8_t *macs, bool *connected, uint16_t *uuids, int8_t *rssi);
+uint32_t ble_get_devices(ble_devices_t *devices);
 #endif // device_manager_H
@@ -0,0 +1,47 @@
+#ifndef device_registry_H
+#define device_registry_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Hashed lookup tables mapping MAC address and connection id to a
+ * device table index. All lookups are O(1) on average. Notify handles are
+ * not indexed: lamps of one model share their handle values.
+ */
+
+/**
+ * @brief clear all lookup tables
+ */
+void device_registry_reset(void);
+/**
+ * @brief register a device mac address
+ * @param mac address of device
+ * @param index device table index
+ * @return false if the table is full or the mac is already registered
+ */
+bool device_registry_add(const uint8_t *mac, int index);
+/**
+ * @brief find device index by mac address
+ * @param mac address of device
+ * @return device index or -1 if not found
+ */
+int device_registry_find_mac(const uint8_t *mac);
+/**
+ * @brief bind a connection id to a device
+ * @param conn_id connection id from ESP_GATTC_OPEN_EVT
+ * @param index device table index
+ */
+void device_registry_set_conn(uint16_t conn_id, int index);
+/**
+ * @brief drop a connection id binding
+ * @param conn_id connection id
+ */
+void device_registry_clear_conn(uint16_t conn_id);
+/**
+ * @brief find device index by connection id
+ * @param conn_id connection id
+ * @return device index or -1 if not found
+ */
+int device_registry_find_conn(uint16_t conn_id);
+#endif // device_registry_H
@@ -0,0 +1,38 @@
+#ifndef gatt_cache_H
+#define gatt_cache_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * @brief resolved GATT handles of a lamp, persisted per MAC so reconnects
+ * can skip service discovery
+ */
+typedef struct {
+    uint16_t service_uuid;          // cache is only valid for this service
+    uint16_t service_start_handle;
+    uint16_t service_end_handle;
+    uint16_t write_char_handle;
+    uint16_t char_handle;           // notify characteristic
+    uint16_t cccd_handle;           // client characteristic configuration descriptor
+} gatt_cache_entry_t;
+
+/**
+ * @brief load cached handles for a device
+ * @param mac address of device
+ * @param entry output
+ * @return ESP_OK, ESP_ERR_NVS_NOT_FOUND or ESP_ERR_INVALID_VERSION for stale entries
+ */
+esp_err_t gatt_cache_load(const uint8_t *mac, gatt_cache_entry_t *entry);
+/**
+ * @brief persist resolved handles for a device
+ * @param mac address of device
+ * @param entry handles to store
+ */
+esp_err_t gatt_cache_store(const uint8_t *mac, const gatt_cache_entry_t *entry);
+/**
+ * @brief drop cached handles for a device (e.g. after a failed write)
+ * @param mac address of device
+ */
+esp_err_t gatt_cache_erase(const uint8_t *mac);
+#endif // gatt_cache_H
@@ -2,6 +2,8 @@
 #define httpd_manager_H
 
 #include <stdint.h>
+#include "ble_stats.h"
+#include "ble_devices.h"
 
 /**
  * @brief Type for Wi-Fi credential save callback
@@ -18,21 +20,25 @@ typedef void (*mqtt_get_config_cb_t)(char *broker, char *prefix, bool *user, boo
 /**
  * @brief Type for ble(gatt) config save callback
  */
-typedef void (*ble_config_cb_t)(const bool *by_name, const char *device_name, const bool *by_uuid, const uint16_t *uuid,
-                                const uint8_t *tx_power, const uint8_t *interval, const uint8_t *duration, const uint16_t *mtu);
+typedef void (*ble_config_cb_t)(const bool *by_name, const char *device_names, const bool *by_uuid, const char *uuids,
+                                const char *company_ids, const uint8_t *tx_power, const uint8_t *interval, const uint8_t *duration, const uint16_t *mtu);
 /**
- * @brief Getter callback for BLE config
+ * @brief Getter callback for BLE config, pattern lists need ADV_FILTER_TEXT_MAX bytes each
  */
-typedef void (*ble_get_config_cb_t)(bool *by_name, char *device_name, bool *by_uuid, uint16_t *uuid, 
+typedef void (*ble_get_config_cb_t)(bool *by_name, char *device_names, bool *by_uuid, char *uuids, char *company_ids,
                                     uint8_t *tx_power, uint8_t *interval, uint8_t *duration, uint16_t *mtu);
 /**
  * @brief Getter callback for BLE metrics
  */
-typedef void (*ble_get_metrics_cb_t)(uint8_t *discovered_count, uint8_t *conn_count);
+typedef void (*ble_get_metrics_cb_t)(uint8_t *discovered_count, uint8_t *conn_count, uint32_t *generation);
 /**
- * @brief Getter callback for BLE devices
+ * @brief Getter callback for BLE runtime counters
  */
-typedef void (*ble_get_devices_cb_t)(uint8_t *indexes,const char **names, uint8_t *macs, bool *connected, uint16_t *uuids, int8_t *rssis);
+typedef void (*ble_get_stats_cb_t)(ble_stats_t *stats);
+/**
+ * @brief Getter callback for BLE devices, returns the table generation
+ */
+typedef uint32_t (*ble_get_devices_cb_t)(ble_devices_t *devices);
 /**
  * @brief callback to reset BLE devices
  */
@@ -52,6 +58,7 @@ void httpd_manager_set_callbacks(
     ble_config_cb_t ble_config,
     ble_get_config_cb_t ble_get_config,
     ble_get_metrics_cb_t ble_get_metrics,
+    ble_get_stats_cb_t ble_get_stats,
     ble_get_devices_cb_t ble_get_devices,
     ble_reset_devices_cb_t ble_reset_devices);
 #endif //httpd_manager_H
\ No newline at end of file
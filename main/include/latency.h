@@ -0,0 +1,78 @@
+#ifndef latency_H
+#define latency_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Fixed-bucket latency histograms for the command path, from the MQTT
+ * message to the lamp's notification. Each stage is kept once for the whole
+ * hub and once per device (for the first CONFIG_BTHUB_LATENCY_DEVICES lamps).
+ * Recording costs one bucket search and a short critical section, so it is
+ * always on. Any task may read.
+ */
+
+#define LATENCY_BUCKETS 16 // the last one catches everything above 5 s
+
+typedef enum {
+    LATENCY_STAGE_PARSE,        // MQTT_EVENT_DATA → command parsed and posted
+    LATENCY_STAGE_QUEUE,        // posted → picked up by the device actor
+    LATENCY_STAGE_CONNECT,      // connect started → ESP_GATTC_OPEN_EVT
+    LATENCY_STAGE_DISCOVERY,    // OPEN → handles ready (discovery or cache)
+    LATENCY_STAGE_WRITE,        // picked up → write issued
+    LATENCY_STAGE_NOTIFY,       // write issued → notification received
+    LATENCY_STAGE_TOTAL,        // MQTT_EVENT_DATA → notification received
+    LATENCY_STAGE_COUNT
+} latency_stage_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t buckets[LATENCY_BUCKETS];
+} latency_hist_t;
+
+/**
+ * @brief short stage name for reports
+ */
+const char *latency_stage_name(latency_stage_t stage);
+/**
+ * @brief upper bound of a bucket in us, UINT32_MAX for the last one
+ */
+uint32_t latency_bucket_bound_us(int bucket);
+/**
+ * @brief per-device histogram slot of a mac, claims a free one for a new mac
+ * @return slot or -1 when all slots are taken
+ */
+int latency_device_slot(const uint8_t *mac);
+/**
+ * @brief number of per-device slots in use
+ */
+int latency_device_count(void);
+/**
+ * @brief mac owning a per-device slot
+ * @return false if the slot is unused
+ */
+bool latency_device_mac(int slot, uint8_t *mac);
+/**
+ * @brief add one sample, ignored when start_us is 0 or after end_us
+ * @param slot per-device slot or -1 for the hub-wide histogram only
+ */
+void latency_record(latency_stage_t stage, int slot, int64_t start_us, int64_t end_us);
+/**
+ * @brief copy a histogram
+ * @param slot per-device slot or -1 for the hub-wide histogram
+ */
+void latency_get(latency_stage_t stage, int slot, latency_hist_t *hist);
+/**
+ * @brief bucket bound at or below which pct percent of the samples fall
+ */
+uint32_t latency_percentile_us(const latency_hist_t *hist, unsigned pct);
+/**
+ * @brief format a histogram as a JSON object
+ * @param buckets include the bucket counts
+ * @return length written, 0 if buf is too small
+ */
+size_t latency_hist_json(latency_stage_t stage, const latency_hist_t *hist, bool buckets, char *buf, size_t len);
+#endif // latency_H
@@ -0,0 +1,57 @@
+#ifndef light_cmd_H
+#define light_cmd_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LIGHT_CMD_MAX_LEN 12 // header(3) + payload + crc(2)
+#define LIGHT_CMD_PAYLOAD_MAX (LIGHT_CMD_MAX_LEN - 5)
+
+/* opcodes */
+#define LIGHT_OP_POWER      0x11
+#define LIGHT_OP_BRIGHTNESS 0x13
+#define LIGHT_OP_COLOR      0x17
+
+/**
+ * @brief a command before framing
+ */
+typedef struct {
+    uint8_t opcode;
+    uint8_t payload_len;
+    uint8_t payload[LIGHT_CMD_PAYLOAD_MAX];
+} light_op_t;
+
+/**
+ * @brief a framed command ready to be written
+ */
+typedef struct {
+    uint8_t data[LIGHT_CMD_MAX_LEN];
+    uint8_t len;
+} light_frame_t;
+
+/**
+ * @brief Modbus CRC16 used by the lamp protocol
+ * @param data buffer
+ * @param len size of the buffer
+ */
+uint16_t light_cmd_crc16(const uint8_t *data, size_t len);
+/**
+ * @brief build a command frame into a caller supplied buffer (reentrant)
+ * @param buf output buffer
+ * @param buf_len size of the output buffer
+ * @param opcode the command type (0x11 = on/off, 0x13 = brightness 0x17 rbg)
+ * @param payload data
+ * @param payload_len size of the payload data only not the whole frame
+ * @return total frame length or 0 if it doesn't fit
+ */
+size_t light_cmd_build(uint8_t *buf, size_t buf_len, uint8_t opcode, const uint8_t *payload, size_t payload_len);
+/**
+ * @brief build frames for many ops in one call, e.g. the pending ops of a
+ * device. They are already coalesced per opcode, so each one is framed
+ * @param ops ops to encode
+ * @param count number of ops
+ * @param frames output, one frame per op (len 0 if the op is invalid)
+ * @return number of valid frames
+ */
+size_t light_cmd_build_batch(const light_op_t *ops, size_t count, light_frame_t *frames);
+#endif // light_cmd_H
@@ -2,6 +2,7 @@
 #define mqtt_manager_H
 
 #include <stdint.h>
+#include "ble_devices.h"
 
 /**
  * @brief MQTT initilization
@@ -20,6 +21,12 @@ void mqtt_device_found(const uint8_t *mac, const char *name);
  * @param mac address of new device
  */
 void mqtt_device_state(bool power_state, uint8_t *mac);
+/**
+ * @brief report a lamp as (un)reachable, retained on esp32/<MAC>/availability
+ * @param mac address of the device
+ * @param available false once the reconnect breaker gave up on it
+ */
+void mqtt_device_availability(const uint8_t *mac, bool available);
 /**
  * @brief set mqtt config from http
  * @param *broker adress of the broker
@@ -36,35 +43,34 @@ void mqtt_get_config(char *broker, char *prefix, bool *user, bool *pass);
  * @brief callback to turn ble device on/off
  * @param mac address of device
  * @param power on/off
+ * @param rx_us esp_timer time of MQTT_EVENT_DATA
  */
-typedef bool (*device_set_power_cb_t)(const uint8_t *mac, const bool power);
+typedef bool (*device_set_power_cb_t)(const uint8_t *mac, const bool power, int64_t rx_us);
 /**
  * @brief callback to set ble device brightness
  * @param mac address of device
  * @param brightness 
+ * @param rx_us esp_timer time of MQTT_EVENT_DATA
  */
-typedef bool (*device_set_brightness_cb_t)(const uint8_t *mac, const uint8_t brightness);
+typedef bool (*device_set_brightness_cb_t)(const uint8_t *mac, const uint8_t brightness, int64_t rx_us);
 /**
  * @brief callback to set ble device color
  * @param mac address of device
  * @param r red
  * @param g green
  * @param b blue
+ * @param rx_us esp_timer time of MQTT_EVENT_DATA
  */
 typedef bool (*device_set_color_cb_t)(const uint8_t *mac, const uint8_t r,const uint8_t g,
-                const uint8_t b);
-/**
- * @brief getter callback for general ble metrics
- */
-typedef void (*ble_get_metrics_cb_t)(uint8_t *discovered_count, uint8_t *conn_count);
+                const uint8_t b, int64_t rx_us);
 /**
- * @brief getter callcack for ble devices
+ * @brief getter callcack for ble devices, returns the table generation
  */
-typedef void (*ble_get_devices_cb_t)(uint8_t *indexes,const char **names, uint8_t *macs, bool *connected, uint16_t *uuids, int8_t *rssis);
+typedef uint32_t (*ble_get_devices_cb_t)(ble_devices_t *devices);
 /**
  * @brief set mqtt callbacks
  */
 void mqtt_set_callbacks(device_set_power_cb_t device_set_power, device_set_brightness_cb_t device_set_brightness,
-                        device_set_color_cb_t device_set_color, ble_get_metrics_cb_t ble_get_metrics, ble_get_devices_cb_t ble_get_devices);
+                        device_set_color_cb_t device_set_color, ble_get_devices_cb_t ble_get_devices);
 
 #endif // mqtt_manager_H
\ No newline at end of file
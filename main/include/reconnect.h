@@ -0,0 +1,75 @@
+#ifndef reconnect_H
+#define reconnect_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Per-device connect policy. A connect attempt gets a short deadline
+ * (CONFIG_BTHUB_CONNECT_TIMEOUT_MS) instead of the stack's 30 s, failed
+ * attempts are retried after an exponential backoff with jitter, and after
+ * CONFIG_BTHUB_BREAKER_FAILURES failures in a row the breaker opens: commands
+ * fail at once until the cooldown ends or the lamp advertises again, then
+ * one probe attempt decides. Plain state, owned by the device actor.
+ */
+
+typedef enum {
+    RECONNECT_IDLE,         // no link, may connect
+    RECONNECT_CONNECTING,   // open requested, deadline running
+    RECONNECT_CONNECTED,
+    RECONNECT_BACKOFF,      // last attempt failed, waits for the retry time
+    RECONNECT_BREAKER_OPEN, // unreachable, commands fail fast
+    RECONNECT_STATE_COUNT
+} reconnect_state_t;
+
+typedef struct {
+    uint8_t state;          // reconnect_state_t
+    uint8_t failures;       // failed attempts in a row
+    int64_t at_us;          // connect deadline, retry time or end of the cooldown
+} reconnect_t;
+
+/**
+ * @brief state name for /metrics
+ */
+const char *reconnect_state_name(reconnect_state_t state);
+/**
+ * @brief whether a connect attempt may start now, moves a finished backoff or
+ * cooldown back to idle (the breaker lets one probe through)
+ */
+bool reconnect_may_connect(reconnect_t *rc, int64_t now_us);
+/**
+ * @brief whether commands should fail without trying to connect
+ */
+bool reconnect_fast_fail(reconnect_t *rc, int64_t now_us);
+/**
+ * @brief an attempt started, arms the connect deadline
+ */
+void reconnect_connecting(reconnect_t *rc, int64_t now_us);
+/**
+ * @brief the attempt ran past its deadline
+ */
+bool reconnect_timed_out(const reconnect_t *rc, int64_t now_us);
+/**
+ * @brief the link is up, clears the failure history
+ */
+void reconnect_connected(reconnect_t *rc);
+/**
+ * @brief an established link went down, the next attempt may start at once
+ */
+void reconnect_disconnected(reconnect_t *rc);
+/**
+ * @brief an attempt failed or timed out, schedules the retry
+ * @return true if this failure opened the breaker
+ */
+bool reconnect_failed(reconnect_t *rc, int64_t now_us);
+/**
+ * @brief the device advertised, an open breaker allows a probe right away
+ * @return true if the breaker was open
+ */
+bool reconnect_seen(reconnect_t *rc);
+/**
+ * @brief time the actor has to act: connect deadline or retry time
+ * @return 0 if nothing is scheduled
+ */
+int64_t reconnect_next_us(const reconnect_t *rc);
+#endif // reconnect_H
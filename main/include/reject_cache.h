@@ -0,0 +1,37 @@
+#ifndef reject_cache_H
+#define reject_cache_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Fixed-size set of recently rejected advertiser MACs. Adverts from
+ * these addresses are dropped before any AD parsing. Entries age out so a
+ * device that changes its advertisement is looked at again.
+ */
+
+/**
+ * @brief drop all entries (filters changed), counters are kept
+ */
+void reject_cache_reset(void);
+/**
+ * @brief check whether a mac was rejected recently
+ * @param mac advertiser address
+ * @param now_ms current time in ms
+ * @return true if the advert can be skipped
+ */
+bool reject_cache_contains(const uint8_t *mac, uint32_t now_ms);
+/**
+ * @brief remember a rejected mac, replaces the oldest entry of its bucket
+ * @param mac advertiser address
+ * @param now_ms current time in ms
+ */
+void reject_cache_add(const uint8_t *mac, uint32_t now_ms);
+/**
+ * @brief lookup counters
+ * @param hits lookups answered from the cache
+ * @param lookups total lookups
+ * @param entries live entries
+ */
+void reject_cache_get_stats(uint32_t *hits, uint32_t *lookups, uint16_t *entries);
+#endif // reject_cache_H
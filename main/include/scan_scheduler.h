@@ -0,0 +1,54 @@
+#ifndef scan_scheduler_H
+#define scan_scheduler_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_gap_ble_api.h"
+
+/**
+ * @brief Scan profiles. The adaptive scheduler starts with aggressive
+ * discovery, backs off to maintenance scans once discovery stops finding
+ * devices and switches to passive scans when the device table is full.
+ */
+typedef enum {
+    SCAN_PROFILE_AGGRESSIVE,    // active, high duty cycle, used while discovering
+    SCAN_PROFILE_MAINTENANCE,   // active, low duty cycle
+    SCAN_PROFILE_PASSIVE,       // passive, lowest duty cycle, only keeps rssi fresh
+    SCAN_PROFILE_COUNT
+} scan_profile_id_t;
+
+typedef struct {
+    const char *name;
+    esp_ble_scan_params_t params;
+} scan_profile_t;
+
+/**
+ * @brief get profile definition
+ * @param id profile id
+ */
+const scan_profile_t *scan_scheduler_profile(scan_profile_id_t id);
+/**
+ * @brief go back to aggressive discovery (device list reset, filter change)
+ */
+void scan_scheduler_reset(void);
+/**
+ * @brief profile for the next scan
+ */
+scan_profile_id_t scan_scheduler_current(void);
+/**
+ * @brief feed the result of a finished scan, adjusts profile and backoff
+ * @param found_new scan found at least one new device
+ * @param all_found device table is full
+ */
+void scan_scheduler_scan_done(bool found_new, bool all_found);
+/**
+ * @brief pause before the next scan
+ * @param base_interval_s configured scan interval in s
+ * @return delay in ms
+ */
+uint32_t scan_scheduler_rest_ms(uint8_t base_interval_s);
+/**
+ * @brief current backoff level (0 = no backoff)
+ */
+uint8_t scan_scheduler_backoff(void);
+#endif // scan_scheduler_H
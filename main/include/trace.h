@@ -0,0 +1,98 @@
+#ifndef trace_H
+#define trace_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+
+/**
+ * @brief Fixed-size RAM ring of compact binary event records for post-mortem
+ * debugging without turning on debug logs. A record is a slot claim with one
+ * atomic add, a timestamp read and four stores, so it is cheap enough to call
+ * from the Bluedroid callbacks. The oldest records are overwritten.
+ * GET /trace downloads the ring, tools/trace_decode.py turns it into a
+ * Chrome trace (chrome://tracing, Perfetto).
+ */
+
+#define TRACE_MAGIC      0x52545442u // "BTTR" little endian
+#define TRACE_VERSION    1
+#define TRACE_NO_DEVICE  0xFF
+
+typedef enum {
+    TRACE_SUBSYS_GAP,       // GAP callback, event = esp_gap_ble_cb_event_t
+    TRACE_SUBSYS_GATTC,     // GATTC callback, event = esp_gattc_cb_event_t
+    TRACE_SUBSYS_DEVICE,    // device actor, event = trace_device_event_t
+    TRACE_SUBSYS_MQTT,      // MQTT handler, event = esp_mqtt_event_id_t
+    TRACE_SUBSYS_HTTP,      // httpd handlers, event = trace_http_event_t
+} trace_subsys_t;
+
+typedef enum {
+    TRACE_DEV_ADDED,        // arg0 = rssi
+    TRACE_DEV_REMOVED,
+    TRACE_DEV_GATTC,        // arg0 = GATTC event handled by the actor
+    TRACE_DEV_COMMAND,      // arg0 = opcode, arg1 = us since the MQTT message
+    TRACE_DEV_CONNECT,      // arg0 = connect started
+    TRACE_DEV_DISCONNECT,   // arg0 = reason
+    TRACE_DEV_WRITE,        // arg0 = opcode, arg1 = esp_gatt_status_t
+    TRACE_DEV_SCAN_YIELD,   // arg0 = s of the scan left
+    TRACE_DEV_SCAN_RESUME,  // arg0 = s the resumed scan runs
+} trace_device_event_t;
+
+typedef enum {
+    TRACE_HTTP_CAPTIVE,
+    TRACE_HTTP_METRICS,
+    TRACE_HTTP_LATENCY,
+    TRACE_HTTP_TRACE,
+    TRACE_HTTP_INDEX_JSON,
+    TRACE_HTTP_FILE,
+    TRACE_HTTP_LOGIN,
+    TRACE_HTTP_SET_LOGIN,
+    TRACE_HTTP_MQTT_SUBMIT,
+    TRACE_HTTP_BLE_SUBMIT,
+    TRACE_HTTP_BLE_RESET,
+    TRACE_HTTP_WIFI_SUBMIT,
+} trace_http_event_t;
+
+typedef struct {
+    uint32_t ts_us;     // low 32 bits of esp_timer_get_time()
+    uint8_t subsys;     // trace_subsys_t
+    uint8_t event;
+    uint8_t device;     // device index or TRACE_NO_DEVICE
+    uint8_t core;       // CPU that recorded it
+    uint32_t arg0;
+    uint32_t arg1;
+} trace_record_t;
+
+/* header of the GET /trace download, followed by count records oldest first */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t capacity;
+    uint32_t count;
+    uint32_t written;   // records ever written, written - count were overwritten
+    uint64_t now_us;    // esp_timer time of the download, dates the 32-bit stamps
+} trace_header_t;
+
+#if CONFIG_BTHUB_TRACE_RECORDS > 0
+/**
+ * @brief append a record, safe from any task or core
+ */
+void trace_record(trace_subsys_t subsys, uint8_t event, uint8_t device, uint32_t arg0, uint32_t arg1);
+#else
+static inline void trace_record(trace_subsys_t subsys, uint8_t event, uint8_t device, uint32_t arg0, uint32_t arg1)
+{
+    (void)subsys; (void)event; (void)device; (void)arg0; (void)arg1;
+}
+#endif
+/**
+ * @brief number of records the ring holds
+ */
+size_t trace_capacity(void);
+/**
+ * @brief copy the ring oldest first, recording continues meanwhile
+ * @param records room for max records
+ * @return number of records copied, also stored in hdr->count
+ */
+size_t trace_snapshot(trace_header_t *hdr, trace_record_t *records, size_t max);
+#endif // trace_H
@@ -0,0 +1,90 @@
+#ifndef write_pipe_H
+#define write_pipe_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "light_cmd.h"
+#include "sdkconfig.h"
+
+#define WRITE_PIPE_DEPTH    6                           // frames waiting per link
+#define WRITE_PIPE_CREDITS  CONFIG_BTHUB_WRITE_CREDITS  // writes handed to the stack per link
+
+/**
+ * @brief Per-link write pipeline. Frames wait here until the link has a
+ * credit: every write handed to the stack takes one and its
+ * ESP_GATTC_WRITE_CHAR_EVT gives it back, so a burst never overruns the
+ * stack's buffers. ESP_GATTC_CONGEST_EVT pauses the link until it reports
+ * uncongested, and a write that came back ESP_GATT_CONGESTED is sent again.
+ * A waiting frame that may be superseded is replaced by a newer frame with
+ * the same opcode, so a color stream sends the latest color, not a backlog.
+ * Plain state, owned by the device actor.
+ */
+
+typedef struct {
+    light_frame_t frame;
+    bool supersede;         // a newer frame with the same opcode replaces it while it waits
+} write_pipe_entry_t;
+
+typedef struct {
+    write_pipe_entry_t waiting[WRITE_PIPE_DEPTH];
+    write_pipe_entry_t flight[WRITE_PIPE_CREDITS];  // handed to the stack, completed in order
+    uint8_t wait_head;
+    uint8_t wait_count;
+    uint8_t flight_head;
+    uint8_t in_flight;
+    bool congested;         // paused until the stack reports uncongested
+    int64_t issued_us;      // oldest write in flight was handed to the stack
+} write_pipe_t;
+
+typedef enum {
+    WRITE_PIPE_QUEUED,
+    WRITE_PIPE_SUPERSEDED,  // replaced a waiting frame with the same opcode
+    WRITE_PIPE_OVERFLOW,    // pipeline full, the oldest waiting frame was dropped
+} write_pipe_result_t;
+
+/**
+ * @brief empty pipeline, all credits available, not congested
+ */
+void write_pipe_reset(write_pipe_t *pipe);
+/**
+ * @brief queue a frame
+ * @param supersede fire-and-forget frame, only the newest per opcode matters
+ */
+write_pipe_result_t write_pipe_submit(write_pipe_t *pipe, const light_frame_t *frame, bool supersede);
+/**
+ * @brief next frame to hand to the stack, takes a credit
+ * @return false while congested, out of credits or empty
+ */
+bool write_pipe_take(write_pipe_t *pipe, int64_t now_us, light_frame_t *frame);
+/**
+ * @brief the frame just taken wasn't accepted by the stack, returns its credit
+ */
+void write_pipe_untake(write_pipe_t *pipe);
+/**
+ * @brief the oldest write in flight completed, returns its credit
+ * @param retry the stack was congested, send the frame again
+ * @return false if nothing was in flight
+ */
+bool write_pipe_completed(write_pipe_t *pipe, bool retry, int64_t now_us);
+/**
+ * @brief ESP_GATTC_CONGEST_EVT
+ */
+void write_pipe_congested(write_pipe_t *pipe, bool congested);
+/**
+ * @brief time the writes in flight are given up on, 0 if none
+ */
+int64_t write_pipe_due_us(const write_pipe_t *pipe);
+/**
+ * @brief give up on writes whose completion never came
+ * @return credits reclaimed
+ */
+uint8_t write_pipe_expire(write_pipe_t *pipe, int64_t now_us);
+/**
+ * @brief take the oldest waiting frame out, e.g. to keep it across a reconnect
+ */
+bool write_pipe_pop(write_pipe_t *pipe, light_frame_t *frame);
+/**
+ * @brief frames waiting or in flight
+ */
+bool write_pipe_busy(const write_pipe_t *pipe);
+#endif // write_pipe_H
@@ -0,0 +1,190 @@
+#include "latency.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#define LATENCY_DEVICE_SLOTS CONFIG_BTHUB_LATENCY_DEVICES
+#define MAC_LEN 6
+
+/* upper bounds, roughly 1-2.5-5 per decade from 100 us to 5 s */
+static const uint32_t bucket_bounds_us[LATENCY_BUCKETS - 1] = {
+    100, 250, 500,
+    1000, 2500, 5000,
+    10000, 25000, 50000,
+    100000, 250000, 500000,
+    1000000, 2500000, 5000000,
+};
+
+static const char *const stage_names[LATENCY_STAGE_COUNT] = {
+    [LATENCY_STAGE_PARSE] = "parse",
+    [LATENCY_STAGE_QUEUE] = "queue",
+    [LATENCY_STAGE_CONNECT] = "connect",
+    [LATENCY_STAGE_DISCOVERY] = "discovery",
+    [LATENCY_STAGE_WRITE] = "write",
+    [LATENCY_STAGE_NOTIFY] = "notify",
+    [LATENCY_STAGE_TOTAL] = "total",
+};
+
+typedef struct {
+    bool used;
+    uint8_t mac[MAC_LEN];
+    latency_hist_t stages[LATENCY_STAGE_COUNT];
+} latency_device_t;
+
+static struct {
+    portMUX_TYPE lock;  // samples come from the actor, readers from httpd and MQTT
+    latency_hist_t stages[LATENCY_STAGE_COUNT];
+#if LATENCY_DEVICE_SLOTS > 0
+    latency_device_t devices[LATENCY_DEVICE_SLOTS];
+#endif
+} latency = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+static int bucket_of(uint32_t us)
+{
+    int i = 0;
+    while (i < LATENCY_BUCKETS - 1 && us > bucket_bounds_us[i]) i++;
+    return i;
+}
+
+static void hist_add(latency_hist_t *hist, int bucket, uint32_t us)
+{
+    hist->count++;
+    hist->sum_us += us;
+    if (us > hist->max_us) hist->max_us = us;
+    hist->buckets[bucket]++;
+}
+
+const char *latency_stage_name(latency_stage_t stage)
+{
+    return stage < LATENCY_STAGE_COUNT ? stage_names[stage] : "?";
+}
+
+uint32_t latency_bucket_bound_us(int bucket)
+{
+    return bucket < LATENCY_BUCKETS - 1 ? bucket_bounds_us[bucket] : UINT32_MAX;
+}
+
+int latency_device_slot(const uint8_t *mac)
+{
+    int slot = -1;
+#if LATENCY_DEVICE_SLOTS > 0
+    taskENTER_CRITICAL(&latency.lock);
+    for (int i = 0; i < LATENCY_DEVICE_SLOTS; i++) {
+        latency_device_t *dev = &latency.devices[i];
+        if (dev->used && memcmp(dev->mac, mac, MAC_LEN) == 0) {
+            slot = i;
+            break;
+        }
+        if (!dev->used && slot < 0) slot = i;
+    }
+    if (slot >= 0 && !latency.devices[slot].used) {
+        latency.devices[slot].used = true;
+        memcpy(latency.devices[slot].mac, mac, MAC_LEN);
+    }
+    taskEXIT_CRITICAL(&latency.lock);
+#endif
+    return slot;
+}
+
+int latency_device_count(void)
+{
+    int count = 0;
+#if LATENCY_DEVICE_SLOTS > 0
+    for (int i = 0; i < LATENCY_DEVICE_SLOTS; i++) {
+        if (latency.devices[i].used) count = i + 1; // slots are claimed in order and never freed
+    }
+#endif
+    return count;
+}
+
+bool latency_device_mac(int slot, uint8_t *mac)
+{
+#if LATENCY_DEVICE_SLOTS > 0
+    if (slot < 0 || slot >= LATENCY_DEVICE_SLOTS || !latency.devices[slot].used) return false;
+    memcpy(mac, latency.devices[slot].mac, MAC_LEN);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void latency_record(latency_stage_t stage, int slot, int64_t start_us, int64_t end_us)
+{
+    if (stage >= LATENCY_STAGE_COUNT || start_us <= 0 || end_us < start_us) return;
+
+    int64_t delta = end_us - start_us;
+    uint32_t us = delta > UINT32_MAX ? UINT32_MAX : (uint32_t)delta;
+    int bucket = bucket_of(us);
+
+    taskENTER_CRITICAL(&latency.lock);
+    hist_add(&latency.stages[stage], bucket, us);
+#if LATENCY_DEVICE_SLOTS > 0
+    if (slot >= 0 && slot < LATENCY_DEVICE_SLOTS) {
+        hist_add(&latency.devices[slot].stages[stage], bucket, us);
+    }
+#endif
+    taskEXIT_CRITICAL(&latency.lock);
+}
+
+void latency_get(latency_stage_t stage, int slot, latency_hist_t *hist)
+{
+    memset(hist, 0, sizeof(*hist));
+    if (stage >= LATENCY_STAGE_COUNT) return;
+
+    taskENTER_CRITICAL(&latency.lock);
+    if (slot < 0) {
+        *hist = latency.stages[stage];
+    }
+#if LATENCY_DEVICE_SLOTS > 0
+    else if (slot < LATENCY_DEVICE_SLOTS) {
+        *hist = latency.devices[slot].stages[stage];
+    }
+#endif
+    taskEXIT_CRITICAL(&latency.lock);
+}
+
+uint32_t latency_percentile_us(const latency_hist_t *hist, unsigned pct)
+{
+    if (hist->count == 0) return 0;
+
+    uint64_t target = ((uint64_t)hist->count * pct + 99) / 100;
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS - 1; i++) {
+        seen += hist->buckets[i];
+        if (seen >= target) {
+            // the bucket bound overstates a sample that is the maximum
+            return bucket_bounds_us[i] < hist->max_us ? bucket_bounds_us[i] : hist->max_us;
+        }
+    }
+    return hist->max_us;
+}
+
+size_t latency_hist_json(latency_stage_t stage, const latency_hist_t *hist, bool buckets, char *buf, size_t len)
+{
+    int written = snprintf(buf, len,
+        "{\"stage\":\"%s\",\"count\":%lu,\"avg_us\":%lu,\"p50_us\":%lu,\"p95_us\":%lu,\"max_us\":%lu",
+        latency_stage_name(stage), (unsigned long)hist->count,
+        (unsigned long)(hist->count ? hist->sum_us / hist->count : 0),
+        (unsigned long)latency_percentile_us(hist, 50), (unsigned long)latency_percentile_us(hist, 95),
+        (unsigned long)hist->max_us);
+
+    if (buckets) {
+        for (int i = 0; i < LATENCY_BUCKETS && written >= 0 && (size_t)written < len; i++) {
+            written += snprintf(buf + written, len - (size_t)written, "%s%lu",
+                                i == 0 ? ",\"buckets\":[" : ",", (unsigned long)hist->buckets[i]);
+        }
+        if (written >= 0 && (size_t)written < len) {
+            written += snprintf(buf + written, len - (size_t)written, "]");
+        }
+    }
+    if (written >= 0 && (size_t)written < len) {
+        written += snprintf(buf + written, len - (size_t)written, "}");
+    }
+    if (written < 0 || (size_t)written >= len) return 0;
+    return (size_t)written;
+}
@@ -1,72 +1,115 @@
 #include "mqtt_manager.h"
+#include "config_store.h"
+#include "latency.h"
+#include "trace.h"
 
 #include "esp_mac.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
 #include "mqtt_client.h"
 #include "cJSON.h"
 #include "nvs.h"
 
 #define MQTT_NAMESPACE "mqtt"
+#define MQTT_CONFIG_VERSION 1
 
 static const char *TAG = "MQTT";
 
 static esp_mqtt_client_handle_t s_mqtt_client = NULL;
-static char mqtt_prefix[32] = {0}; // mqtt discovery prefix
+static esp_timer_handle_t s_latency_timer = NULL; // periodic latency report, CONFIG_BTHUB_LATENCY_MQTT_PERIOD_S
+static esp_timer_handle_t s_diag_timer = NULL;    // periodic link diagnostics, CONFIG_BTHUB_DIAG_MQTT_PERIOD_S
+
+/* mqtt settings as persisted, loaded once so reads never touch flash */
+typedef struct {
+    char broker[64];
+    char prefix[32];    // mqtt discovery prefix
+    char user[32];
+    char pass[32];
+} mqtt_config_t;
+
+static mqtt_config_t mqtt_config = {0};
+static bool mqtt_config_loaded = false;
 
 static struct {
     device_set_power_cb_t device_set_power_cb;
     device_set_brightness_cb_t device_set_brightness_cb;
     device_set_color_cb_t device_set_color_cb;
-    ble_get_metrics_cb_t ble_get_metrics_cb;
     ble_get_devices_cb_t ble_get_devices_cb;
 } mqtt_callbacks = {0};
 
 /**
- * @brief load mqtt config from nvs 
+ * @brief import the settings older firmware kept under one key each
 */
-static esp_err_t mqtt_load_config(
-    char* broker, size_t broker_len,
-    char* prefix, size_t prefix_len,
-    char* user, size_t user_len,
-    char* pass, size_t pass_len)
+static esp_err_t mqtt_config_migrate(uint8_t version, const uint8_t *old, size_t old_len, void *data, size_t *len)
 {
+    if (version != 0) return ESP_ERR_INVALID_VERSION; // no older blob schema yet
+
+    mqtt_config_t *config = data;
     nvs_handle_t handle;
     esp_err_t err = nvs_open(MQTT_NAMESPACE, NVS_READONLY, &handle);
     if (err != ESP_OK) return err;
 
-    err = nvs_get_str(handle, "broker", broker, &broker_len);
-    if (err != ESP_OK) { nvs_close(handle); return err; }
-
-    if (prefix != NULL) {
-        err = nvs_get_str(handle, "prefix", prefix, &prefix_len);
-        if (err != ESP_OK) { nvs_close(handle); return err; }
+    size_t broker_len = sizeof(config->broker);
+    err = nvs_get_str(handle, "broker", config->broker, &broker_len);
+    if (err == ESP_OK) {
+        size_t prefix_len = sizeof(config->prefix);
+        size_t user_len = sizeof(config->user);
+        size_t pass_len = sizeof(config->pass);
+        nvs_get_str(handle, "prefix", config->prefix, &prefix_len);
+        nvs_get_str(handle, "user", config->user, &user_len);
+        nvs_get_str(handle, "pass", config->pass, &pass_len);
+        *len = sizeof(*config);
     }
-    err = nvs_get_str(handle, "user", user, &user_len);
-    if (err != ESP_OK) { nvs_close(handle); return err; }
-
-    err = nvs_get_str(handle, "pass", pass, &pass_len);
     nvs_close(handle);
     return err;
 }
 /**
- * @brief save mqtt config to nvs 
+ * @brief load mqtt config from nvs, only the first call reads flash
 */
-static esp_err_t mqtt_save_config(const char* broker, const char* prefix, const char* user, const char* pass)
+static esp_err_t mqtt_load_config(void)
 {
-    nvs_handle_t handle;
-    esp_err_t err = nvs_open(MQTT_NAMESPACE, NVS_READWRITE, &handle);
+    if (mqtt_config_loaded) return ESP_OK;
+
+    mqtt_config_t config = {0};
+    size_t len = sizeof(config);
+    esp_err_t err = config_store_load(MQTT_NAMESPACE, MQTT_CONFIG_VERSION, &config, &len, mqtt_config_migrate);
     if (err != ESP_OK) return err;
 
-    nvs_set_str(handle, "broker", broker);
-    nvs_set_str(handle, "prefix", prefix);
-    nvs_set_str(handle, "user", user);
-    nvs_set_str(handle, "pass", pass);
-    nvs_commit(handle);
-    nvs_close(handle);
+    // strings are stored with their terminator, make sure of it anyway
+    config.broker[sizeof(config.broker) - 1] = '\0';
+    config.prefix[sizeof(config.prefix) - 1] = '\0';
+    config.user[sizeof(config.user) - 1] = '\0';
+    config.pass[sizeof(config.pass) - 1] = '\0';
+    mqtt_config = config;
+    mqtt_config_loaded = true;
     return ESP_OK;
 }
+/**
+ * @brief save mqtt config to nvs once edits settle
+*/
+static esp_err_t mqtt_save_config(void)
+{
+    return config_store_save_deferred(MQTT_NAMESPACE, MQTT_CONFIG_VERSION, &mqtt_config,
+                                      sizeof(mqtt_config));
+}
+
+/**
+ * @brief retained availability of a lamp, the light entity goes unavailable on "offline"
+ */
+static void mqtt_publish_availability(const uint8_t *mac, bool available)
+{
+    esp_mqtt_client_handle_t client = s_mqtt_client;
+    if (!client) return;
+
+    char topic[40];
+    snprintf(topic, sizeof(topic), "esp32/%02X%02X%02X%02X%02X%02X/availability",
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    // enqueued, the device actor must not wait for the broker
+    esp_mqtt_client_enqueue(client, topic, available ? "online" : "offline", 0, 1, 1, true);
+}
 
-static void mqtt_discovery(const uint8_t *mac, const char *name)
+static void mqtt_discovery(const uint8_t *mac, const char *name, bool available)
 {
     if (s_mqtt_client == NULL) {
         ESP_LOGE(TAG, "client not initialized");
@@ -84,12 +127,12 @@ static void mqtt_discovery(const uint8_t *mac, const char *name)
     snprintf(dev_mac_str, sizeof(dev_mac_str), "%02X%02X%02X%02X%02X%02X", // Remove colons for cleaner ID
              mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
 
-    char discovery_topic[72];
+    char discovery_topic[96];
     snprintf(discovery_topic, sizeof(discovery_topic), 
              "%s/light/esp32_sub_%s/config", 
-             mqtt_prefix, dev_mac_str);
+             mqtt_config.prefix, dev_mac_str);
 
-    char discovery_payload[512];
+    char discovery_payload[640];
     snprintf(discovery_payload, sizeof(discovery_payload),
         "{"
         "\"name\":\"%s %s\","
@@ -97,6 +140,7 @@ static void mqtt_discovery(const uint8_t *mac, const char *name)
         "\"schema\":\"json\","
         "\"command_topic\":\"esp32/%s/set\","
         "\"state_topic\":\"esp32/%s/state\","
+        "\"availability_topic\":\"esp32/%s/availability\","
         "\"brightness\":true,"
         "\"brightness_scale\":100,"
         "\"supported_color_modes\":[\"rgb\"],"
@@ -118,14 +162,148 @@ static void mqtt_discovery(const uint8_t *mac, const char *name)
         dev_mac_str,
         dev_mac_str,
         dev_mac_str,
-        esp_mac_str); // 6 arguments
+        dev_mac_str,
+        esp_mac_str); // 7 arguments
 
     int msg_id = esp_mqtt_client_publish(s_mqtt_client, discovery_topic, discovery_payload, 0, 1, 1);
     ESP_LOGI(TAG, "Published discovery for device %s, msg_id=%d", dev_mac_str, msg_id);
     ESP_LOGI(TAG, "Topic: %s", discovery_topic);
+    mqtt_publish_availability(mac, available);
+
+#if CONFIG_BTHUB_DIAG_MQTT_PERIOD_S > 0
+    // diagnostic sensor: average connect time, the other link counters as attributes
+    snprintf(discovery_topic, sizeof(discovery_topic),
+             "%s/sensor/esp32_sub_%s_link/config",
+             mqtt_config.prefix, dev_mac_str);
+    snprintf(discovery_payload, sizeof(discovery_payload),
+        "{"
+        "\"name\":\"%s %s link\","
+        "\"unique_id\":\"esp32_sub_%s_link\","
+        "\"state_topic\":\"esp32/%s/diag\","
+        "\"value_template\":\"{{ value_json.connect_avg_ms }}\","
+        "\"json_attributes_topic\":\"esp32/%s/diag\","
+        "\"unit_of_measurement\":\"ms\","
+        "\"entity_category\":\"diagnostic\","
+        "\"device\":{"
+            "\"identifiers\":[\"esp32_%s\"]"
+        "}"
+        "}",
+        name, dev_mac_str,
+        dev_mac_str,
+        dev_mac_str,
+        dev_mac_str,
+        esp_mac_str);
+    esp_mqtt_client_publish(s_mqtt_client, discovery_topic, discovery_payload, 0, 1, 1);
+#endif
+}
+
+/**
+ * @brief publish the hub-wide command latency summary, runs on the esp_timer task
+ */
+static void mqtt_publish_latency(void *arg)
+{
+    static char payload[1024]; // only this callback uses it, keeps the timer task stack small
+    esp_mqtt_client_handle_t client = s_mqtt_client;
+    if (!client) return;
+
+    size_t written = (size_t)snprintf(payload, sizeof(payload), "{\"stages\":[");
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++) {
+        latency_hist_t hist;
+        latency_get(stage, -1, &hist);
+        if (stage > 0) payload[written++] = ',';
+        // leaves room for the closing brackets
+        size_t len = latency_hist_json(stage, &hist, false, payload + written, sizeof(payload) - written - 2);
+        if (len == 0) {
+            written -= (stage > 0);
+            break;
+        }
+        written += len;
+    }
+    payload[written++] = ']';
+    payload[written++] = '}';
+
+    uint8_t mac[6];
+    esp_efuse_mac_get_default(mac);
+    char topic[48];
+    snprintf(topic, sizeof(topic), "esp32/bt_hub_%02x%02x%02x/latency", mac[3], mac[4], mac[5]);
+
+    // enqueue never waits for the network, the MQTT task sends it
+    esp_mqtt_client_enqueue(client, topic, payload, (int)written, 0, 0, true);
+}
+
+/**
+ * @brief publish the link counters of every device, runs on the esp_timer task
+ */
+static void mqtt_publish_diag(void *arg)
+{
+    esp_mqtt_client_handle_t client = s_mqtt_client;
+    if (!client || !mqtt_callbacks.ble_get_devices_cb) return;
+
+    ble_devices_t *devices = malloc(sizeof(*devices)); // too big for the timer task stack
+    if (!devices) return;
+    mqtt_callbacks.ble_get_devices_cb(devices);
+
+    uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    for (int i = 0; i < devices->count; i++) {
+        const ble_device_record_t *dev = &devices->devices[i];
+        const ble_link_stats_t *link = &dev->link;
+
+        char topic[32];
+        snprintf(topic, sizeof(topic), "esp32/%02X%02X%02X%02X%02X%02X/diag",
+                 dev->mac[0], dev->mac[1], dev->mac[2], dev->mac[3], dev->mac[4], dev->mac[5]);
+
+        char payload[320];
+        int len = snprintf(payload, sizeof(payload),
+            "{\"connected\":%s,\"rssi\":%d,"
+            "\"connects\":%u,\"connect_failures\":%u,\"connect_avg_ms\":%u,"
+            "\"writes\":%u,\"write_failures\":%u,\"notifies\":%u,"
+            "\"disc_timeout\":%u,\"disc_remote\":%u,\"disc_local\":%u,\"disc_other\":%u,"
+            "\"last_reason\":%u,\"seen_ago_s\":%lu}",
+            dev->connected ? "true" : "false", dev->rssi,
+            link->connects, link->connect_failures, link->connect_avg_ms,
+            link->writes, link->write_failures, link->notifies,
+            link->disc_timeout, link->disc_remote, link->disc_local, link->disc_other,
+            link->last_reason, (unsigned long)((now_ms - link->last_seen_ms) / 1000));
+        if (len > 0 && (size_t)len < sizeof(payload)) {
+            esp_mqtt_client_enqueue(client, topic, payload, len, 0, 0, true);
+        }
+    }
+    free(devices);
+}
+/**
+ * @brief (re)start a periodic report, a period of 0 disables it
+ */
+static void mqtt_report_start(esp_timer_handle_t *timer, esp_timer_cb_t cb, const char *name, uint32_t period_s)
+{
+    if (period_s == 0) return;
+
+    if (!*timer) {
+        const esp_timer_create_args_t args = {
+            .callback = cb,
+            .name = name,
+        };
+        if (esp_timer_create(&args, timer) != ESP_OK) {
+            ESP_LOGW(TAG, "Report timer %s not created", name);
+            return;
+        }
+    }
+    esp_timer_stop(*timer); // not running is fine
+    esp_timer_start_periodic(*timer, (uint64_t)period_s * 1000000ULL);
+}
+
+static void mqtt_reports_start(void)
+{
+    mqtt_report_start(&s_latency_timer, mqtt_publish_latency, "mqtt_latency", CONFIG_BTHUB_LATENCY_MQTT_PERIOD_S);
+    mqtt_report_start(&s_diag_timer, mqtt_publish_diag, "mqtt_diag", CONFIG_BTHUB_DIAG_MQTT_PERIOD_S);
+}
+
+static void mqtt_reports_stop(void)
+{
+    if (s_latency_timer) esp_timer_stop(s_latency_timer);
+    if (s_diag_timer) esp_timer_stop(s_diag_timer);
 }
 
-static void mqtt_handle_command(const char* topic, int topic_len, const char* data, int data_len)
+static void mqtt_handle_command(const char* topic, int topic_len, const char* data, int data_len, int64_t rx_us)
 {
     char topic_str[topic_len + 1];
     char data_str[data_len + 1];
@@ -195,7 +373,7 @@ static void mqtt_handle_command(const char* topic, int topic_len, const char* da
         uint8_t brightness = brightness_item->valueint;
         ESP_LOGI(TAG, "Set brightness %d for device %s", brightness, mac_fragment);
         if (mqtt_callbacks.device_set_brightness_cb){
-            mqtt_callbacks.device_set_brightness_cb(mac_addr, (uint8_t)brightness);
+            mqtt_callbacks.device_set_brightness_cb(mac_addr, (uint8_t)brightness, rx_us);
         }
     } else if (color_item && cJSON_IsObject(color_item)) {
         // Extract RGB values from the color object
@@ -213,7 +391,7 @@ static void mqtt_handle_command(const char* topic, int topic_len, const char* da
         
             ESP_LOGI(TAG, "Set color R:%d G:%d B:%d for device %s", red, green, blue, mac_fragment);
             if (mqtt_callbacks.device_set_color_cb){
-                mqtt_callbacks.device_set_color_cb(mac_addr, (uint8_t)red, (uint8_t)green, (uint8_t)blue);
+                mqtt_callbacks.device_set_color_cb(mac_addr, (uint8_t)red, (uint8_t)green, (uint8_t)blue, rx_us);
             }
         }
     } else if (state_item && cJSON_IsString(state_item)) {
@@ -221,7 +399,7 @@ static void mqtt_handle_command(const char* topic, int topic_len, const char* da
                          strcmp(state_item->valuestring, "1") == 0);
         ESP_LOGI(TAG, "Set power=%s for MAC=%s", power_on ? "ON" : "OFF", mac_fragment);
         if (mqtt_callbacks.device_set_power_cb){
-            mqtt_callbacks.device_set_power_cb(mac_addr, power_on);
+            mqtt_callbacks.device_set_power_cb(mac_addr, power_on, rx_us);
         }
     }
     cJSON_Delete(json);
@@ -231,42 +409,41 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
 {
     ESP_LOGD(TAG, "Event dispatched from event loop base=%s, event_id=%d", base, event_id);
     esp_mqtt_event_handle_t event = event_data;
+    trace_record(TRACE_SUBSYS_MQTT, (uint8_t)event_id, TRACE_NO_DEVICE, event->msg_id, event->data_len);
     
     switch ((esp_mqtt_event_id_t)event_id) {
     case MQTT_EVENT_CONNECTED:{
         ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
 
-        uint8_t discovered_count = 0U;
-
-        if (mqtt_callbacks.ble_get_metrics_cb) {
-            mqtt_callbacks.ble_get_metrics_cb(&discovered_count, NULL);
-        }
-        
-        if (discovered_count == 0) break; // no devices to process
+        // the table is too big for the MQTT task stack
+        ble_devices_t *devices = malloc(sizeof(*devices));
+        if (devices && mqtt_callbacks.ble_get_devices_cb) {
+            mqtt_callbacks.ble_get_devices_cb(devices);
 
-        const char *names[discovered_count];       // array of string pointers
-        uint8_t macs[discovered_count * 6]; 
+            // Publish discovery for all discovered devices
+            for (int i = 0; i < devices->count; i++) {
 
-        if (mqtt_callbacks.ble_get_devices_cb) {
-            mqtt_callbacks.ble_get_devices_cb(NULL, names, macs, NULL, NULL, NULL);
+                mqtt_discovery(devices->devices[i].mac, devices->devices[i].name, devices->devices[i].available);
+                vTaskDelay(pdMS_TO_TICKS(100)); 
+            }
+        } else if (!devices) {
+            ESP_LOGE(TAG, "No memory for device table, discovery skipped");
         }
+        free(devices);
 
-         // Publish discovery for all discovered devices
-        for (int i = 0; i < discovered_count; i++) {
-
-            mqtt_discovery(&macs[i*6], names[i] );
-            vTaskDelay(pdMS_TO_TICKS(100)); 
-        }
          // Subscribe to wildcard command topic so incoming commands reach MQTT_EVENT_DATA
         int sub_id = esp_mqtt_client_subscribe(s_mqtt_client, "esp32/+/set", 1);
         ESP_LOGI(TAG, "Subscribed to commands wildcard, sub_id=%d", sub_id);
 
         int sub_id2 = esp_mqtt_client_subscribe(s_mqtt_client, "esp32/+/brightness/set", 1);
         ESP_LOGI(TAG, "Subscribed to brightness wildcard, sub_id=%d", sub_id2);
+
+        mqtt_reports_start();
         break;
     }   
     case MQTT_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "EVENT_DISCONNECTED");
+        mqtt_reports_stop();
         break;
     case MQTT_EVENT_SUBSCRIBED:
         ESP_LOGI(TAG, "EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
@@ -277,12 +454,14 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     case MQTT_EVENT_PUBLISHED:
         ESP_LOGI(TAG, "EVENT_PUBLISHED, msg_id=%d", event->msg_id);
         break;
-    case MQTT_EVENT_DATA:
+    case MQTT_EVENT_DATA: {
+        int64_t rx_us = esp_timer_get_time(); // start of the command latency trace
         ESP_LOGI(TAG, "EVENT_DATA");
         printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
         printf("DATA=%.*s\r\n", event->data_len, event->data);
-        mqtt_handle_command(event->topic, event->topic_len, event->data, event->data_len);
+        mqtt_handle_command(event->topic, event->topic_len, event->data, event->data_len, rx_us);
         break;
+    }
     case MQTT_EVENT_ERROR:
         ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
         if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
@@ -305,11 +484,8 @@ void mqtt_start(void)
 {
     char client_id[32];
     uint8_t mac[6];
-    char broker[64] = {0};
-    char user[32] = {0};
-    char pass[32] = {0};
     
-    esp_err_t err = mqtt_load_config(broker, sizeof(broker), mqtt_prefix, sizeof(mqtt_prefix), user, sizeof(user), pass, sizeof(pass));
+    esp_err_t err = mqtt_load_config();
     if (err != ESP_OK) {
         ESP_LOGW(TAG, "Failed to load config from NVS (%s)", esp_err_to_name(err));
         return;
@@ -319,9 +495,9 @@ void mqtt_start(void)
     snprintf(client_id, sizeof(client_id), "esp32_bt_hub_%02x%02x%02x", mac[3], mac[4], mac[5]);
 
     esp_mqtt_client_config_t mqtt_cfg = {
-        .broker.address.uri = broker,
-        .credentials.username = user,
-        .credentials.authentication.password = pass,
+        .broker.address.uri = mqtt_config.broker,
+        .credentials.username = mqtt_config.user,
+        .credentials.authentication.password = mqtt_config.pass,
         .credentials.client_id = client_id,
     };
 
@@ -329,12 +505,19 @@ void mqtt_start(void)
     esp_mqtt_client_register_event(s_mqtt_client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
     esp_mqtt_client_start(s_mqtt_client);
 
-    ESP_LOGI(TAG, "MQTT client started with broker %s, prefix %s", broker, mqtt_prefix);
+    ESP_LOGI(TAG, "MQTT client started with broker %s, prefix %s", mqtt_config.broker, mqtt_config.prefix);
 }
 
 void mqtt_device_found(const uint8_t *mac, const char *name) 
 { 
-    mqtt_discovery(mac , name); 
+    mqtt_discovery(mac , name, true); 
+}
+
+void mqtt_device_availability(const uint8_t *mac, bool available)
+{
+    ESP_LOGI(TAG, "Device %02X%02X%02X%02X%02X%02X %s", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+             available ? "reachable again" : "unreachable");
+    mqtt_publish_availability(mac, available);
 }
 
 void mqtt_device_state(bool power_state, uint8_t *mac){
@@ -379,7 +562,13 @@ void mqtt_update_config(const char *broker, const char *prefix, const char *user
 
     ESP_LOGI(TAG, "Updating mqtt config");
 
-    esp_err_t err = mqtt_save_config(broker, prefix, user, pass);
+    snprintf(mqtt_config.broker, sizeof(mqtt_config.broker), "%s", broker);
+    snprintf(mqtt_config.prefix, sizeof(mqtt_config.prefix), "%s", prefix);
+    snprintf(mqtt_config.user, sizeof(mqtt_config.user), "%s", user);
+    snprintf(mqtt_config.pass, sizeof(mqtt_config.pass), "%s", pass);
+    mqtt_config_loaded = true;
+
+    esp_err_t err = mqtt_save_config();
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to save config to NVS (%s)", esp_err_to_name(err));
         return;
@@ -387,6 +576,7 @@ void mqtt_update_config(const char *broker, const char *prefix, const char *user
 
     if (s_mqtt_client) {
         ESP_LOGI(TAG, "Stopping previous MQTT client");
+        mqtt_reports_stop();
         esp_mqtt_client_stop(s_mqtt_client);
         esp_mqtt_client_destroy(s_mqtt_client);
         s_mqtt_client = NULL;
@@ -396,43 +586,34 @@ void mqtt_update_config(const char *broker, const char *prefix, const char *user
 
 void mqtt_get_config(char *broker, char *prefix, bool *user, bool *pass){
   
-    char tmp_broker[64] = {0};
-    char tmp_user[32] = {0};
-    char tmp_pass[32] = {0};
-
-    esp_err_t err = mqtt_load_config(tmp_broker, sizeof(tmp_broker), NULL, 0, tmp_user, sizeof(tmp_user),
-                                     tmp_pass, sizeof(tmp_pass));
-    if (err != ESP_OK) {
-        ESP_LOGW(TAG, "Failed to load config from NVS (%s)", esp_err_to_name(err));
-        return;
+    if (mqtt_load_config() != ESP_OK) {
+        return; // nothing configured yet
     }
 
-    if (broker && tmp_broker[0] != '\0') {
-        strncpy(broker, tmp_broker, 63);
+    if (broker && mqtt_config.broker[0] != '\0') {
+        strncpy(broker, mqtt_config.broker, 63);
         broker[63] = '\0';
     }
 
-    if (prefix && mqtt_prefix[0] != '\0' ){
-        strncpy(prefix, mqtt_prefix, sizeof(mqtt_prefix) - 1);
+    if (prefix && mqtt_config.prefix[0] != '\0' ){
+        strncpy(prefix, mqtt_config.prefix, sizeof(mqtt_config.prefix) - 1);
     }
     
     if (user) {
-       *user = (tmp_user[0] != '\0');
+       *user = (mqtt_config.user[0] != '\0');
     }
 
     if (pass) {
-        *pass = (tmp_pass[0] != '\0');
+        *pass = (mqtt_config.pass[0] != '\0');
     }
 
 }
 
 void mqtt_set_callbacks(device_set_power_cb_t device_set_power, device_set_brightness_cb_t device_set_brightness,
-                        device_set_color_cb_t device_set_color, ble_get_metrics_cb_t ble_get_metrics,
-                        ble_get_devices_cb_t ble_get_devices)
+                        device_set_color_cb_t device_set_color, ble_get_devices_cb_t ble_get_devices)
 {
     if(device_set_power) mqtt_callbacks.device_set_power_cb = device_set_power;
     if(device_set_brightness) mqtt_callbacks.device_set_brightness_cb = device_set_brightness;
     if(device_set_color) mqtt_callbacks.device_set_color_cb = device_set_color;
-    if(ble_get_metrics) mqtt_callbacks.ble_get_metrics_cb = ble_get_metrics;
     if(ble_get_devices) mqtt_callbacks.ble_get_devices_cb = ble_get_devices;
 }
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include "reconnect.h"
+
+#include "esp_random.h"
+#include "sdkconfig.h"
+
+#define CONNECT_TIMEOUT_US  ((int64_t)CONFIG_BTHUB_CONNECT_TIMEOUT_MS * 1000)
+#define BACKOFF_BASE_MS     CONFIG_BTHUB_RECONNECT_BASE_MS
+#define BACKOFF_MAX_MS      CONFIG_BTHUB_RECONNECT_MAX_MS
+#define BREAKER_FAILURES    CONFIG_BTHUB_BREAKER_FAILURES
+#define BREAKER_COOLDOWN_US ((int64_t)CONFIG_BTHUB_BREAKER_COOLDOWN_S * 1000 * 1000)
+
+static const char *const state_names[RECONNECT_STATE_COUNT] = {
+    [RECONNECT_IDLE] = "idle",
+    [RECONNECT_CONNECTING] = "connecting",
+    [RECONNECT_CONNECTED] = "connected",
+    [RECONNECT_BACKOFF] = "backoff",
+    [RECONNECT_BREAKER_OPEN] = "unreachable",
+};
+
+/**
+ * @brief base << (failures - 1) capped at the maximum, half of it random so
+ * lamps that dropped together don't retry together
+ */
+static uint32_t backoff_ms(uint8_t failures)
+{
+    uint32_t delay = BACKOFF_BASE_MS;
+    for (uint8_t i = 1; i < failures && delay < BACKOFF_MAX_MS; i++) {
+        delay *= 2;
+    }
+    if (delay > BACKOFF_MAX_MS) delay = BACKOFF_MAX_MS;
+    return delay / 2 + esp_random() % (delay / 2 + 1);
+}
+
+const char *reconnect_state_name(reconnect_state_t state)
+{
+    return state < RECONNECT_STATE_COUNT ? state_names[state] : "?";
+}
+
+bool reconnect_may_connect(reconnect_t *rc, int64_t now_us)
+{
+    switch (rc->state) {
+    case RECONNECT_IDLE:
+        return true;
+    case RECONNECT_BACKOFF:
+        if (now_us < rc->at_us) return false;
+        rc->state = RECONNECT_IDLE;
+        return true;
+    case RECONNECT_BREAKER_OPEN:
+        if (now_us < rc->at_us) return false;
+        // half open: one probe, its failure opens the breaker again
+        rc->state = RECONNECT_IDLE;
+        rc->failures = BREAKER_FAILURES - 1;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool reconnect_fast_fail(reconnect_t *rc, int64_t now_us)
+{
+    return rc->state == RECONNECT_BREAKER_OPEN && now_us < rc->at_us;
+}
+
+void reconnect_connecting(reconnect_t *rc, int64_t now_us)
+{
+    rc->state = RECONNECT_CONNECTING;
+    rc->at_us = now_us + CONNECT_TIMEOUT_US;
+}
+
+bool reconnect_timed_out(const reconnect_t *rc, int64_t now_us)
+{
+    return rc->state == RECONNECT_CONNECTING && now_us >= rc->at_us;
+}
+
+void reconnect_connected(reconnect_t *rc)
+{
+    rc->state = RECONNECT_CONNECTED;
+    rc->failures = 0;
+    rc->at_us = 0;
+}
+
+void reconnect_disconnected(reconnect_t *rc)
+{
+    if (rc->state != RECONNECT_CONNECTED) return; // failed opens go through reconnect_failed
+    rc->state = RECONNECT_IDLE;
+    rc->at_us = 0;
+}
+
+bool reconnect_failed(reconnect_t *rc, int64_t now_us)
+{
+    if (rc->failures < UINT8_MAX) rc->failures++;
+
+    if (rc->failures >= BREAKER_FAILURES) {
+        rc->state = RECONNECT_BREAKER_OPEN;
+        rc->at_us = now_us + BREAKER_COOLDOWN_US;
+        return true;
+    }
+    rc->state = RECONNECT_BACKOFF;
+    rc->at_us = now_us + (int64_t)backoff_ms(rc->failures) * 1000;
+    return false;
+}
+
+bool reconnect_seen(reconnect_t *rc)
+{
+    switch (rc->state) {
+    case RECONNECT_BREAKER_OPEN:
+        rc->state = RECONNECT_IDLE;
+        rc->failures = BREAKER_FAILURES - 1;
+        rc->at_us = 0;
+        return true;
+    case RECONNECT_BACKOFF:
+        rc->state = RECONNECT_IDLE; // it is in range now, no reason to wait
+        rc->at_us = 0;
+        return false;
+    default:
+        return false;
+    }
+}
+
+int64_t reconnect_next_us(const reconnect_t *rc)
+{
+    if (rc->state == RECONNECT_CONNECTING || rc->state == RECONNECT_BACKOFF) return rc->at_us;
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include "reject_cache.h"
+
+#include <string.h>
+#include "sdkconfig.h"
+
+#define REJECT_SLOTS    CONFIG_BTHUB_REJECT_CACHE_SIZE
+#define REJECT_WAYS     4   // slots probed per mac
+#define REJECT_AGE_MS   ((uint32_t)CONFIG_BTHUB_REJECT_CACHE_AGE_S * 1000U)
+#define MAC_LEN         6
+
+_Static_assert((REJECT_SLOTS & (REJECT_SLOTS - 1)) == 0, "reject cache size must be a power of two");
+
+typedef struct {
+    uint8_t mac[MAC_LEN];
+    bool used;
+    uint32_t added_ms;
+} reject_slot_t;
+
+static struct {
+    reject_slot_t slots[REJECT_SLOTS];
+    uint32_t hits;
+    uint32_t lookups;
+} reject_cache = {0};
+
+/**
+ * @brief FNV-1a over the mac, the low bytes carry most of the entropy
+ */
+static uint32_t mac_hash(const uint8_t *mac)
+{
+    uint32_t h = 2166136261u;
+    for (int i = MAC_LEN - 1; i >= 0; --i) {
+        h ^= mac[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static bool slot_expired(const reject_slot_t *slot, uint32_t now_ms)
+{
+    return (uint32_t)(now_ms - slot->added_ms) >= REJECT_AGE_MS;
+}
+
+void reject_cache_reset(void)
+{
+    memset(reject_cache.slots, 0, sizeof(reject_cache.slots));
+}
+
+bool reject_cache_contains(const uint8_t *mac, uint32_t now_ms)
+{
+    reject_cache.lookups++;
+
+    uint32_t pos = mac_hash(mac);
+    for (int n = 0; n < REJECT_WAYS; n++) {
+        reject_slot_t *slot = &reject_cache.slots[(pos + n) & (REJECT_SLOTS - 1)];
+        if (!slot->used || memcmp(slot->mac, mac, MAC_LEN) != 0) continue;
+
+        if (slot_expired(slot, now_ms)) {
+            slot->used = false;
+            return false;
+        }
+        reject_cache.hits++;
+        return true;
+    }
+    return false;
+}
+
+void reject_cache_add(const uint8_t *mac, uint32_t now_ms)
+{
+    uint32_t pos = mac_hash(mac);
+    reject_slot_t *victim = NULL;
+
+    for (int n = 0; n < REJECT_WAYS; n++) {
+        reject_slot_t *slot = &reject_cache.slots[(pos + n) & (REJECT_SLOTS - 1)];
+        if (!slot->used || slot_expired(slot, now_ms) || memcmp(slot->mac, mac, MAC_LEN) == 0) {
+            victim = slot;
+            break;
+        }
+        // otherwise replace the oldest entry of the bucket
+        if (!victim || (int32_t)(slot->added_ms - victim->added_ms) < 0) {
+            victim = slot;
+        }
+    }
+
+    memcpy(victim->mac, mac, MAC_LEN);
+    victim->used = true;
+    victim->added_ms = now_ms;
+}
+
+void reject_cache_get_stats(uint32_t *hits, uint32_t *lookups, uint16_t *entries)
+{
+    if (hits) *hits = reject_cache.hits;
+    if (lookups) *lookups = reject_cache.lookups;
+    if (entries) {
+        uint16_t used = 0;
+        for (int i = 0; i < REJECT_SLOTS; i++) {
+            if (reject_cache.slots[i].used) used++;
+        }
+        *entries = used;
+    }
+}
@@ -0,0 +1,134 @@
+#include "scan_scheduler.h"
+
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#define SCAN_BACKOFF_MAX            5       // rest doubles up to 32x the configured interval
+#define SCAN_MAINTENANCE_AFTER      2       // empty scans before leaving aggressive discovery
+#define SCAN_REST_MAX_MS            (10 * 60 * 1000)
+
+static const char *TAG = "SCAN_SCHED";
+
+/* interval/window are in 0.625 ms units */
+static const scan_profile_t scan_profiles[SCAN_PROFILE_COUNT] = {
+    [SCAN_PROFILE_AGGRESSIVE] = {
+        .name = "aggressive",
+        .params = {
+            .scan_type = BLE_SCAN_TYPE_ACTIVE,
+            .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
+            .scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ALL,
+            .scan_interval = 0x50,  // 50 ms
+            .scan_window = 0x30,    // 30 ms, 60% duty
+            .scan_duplicate = BLE_SCAN_DUPLICATE_DISABLE
+        }
+    },
+    [SCAN_PROFILE_MAINTENANCE] = {
+        .name = "maintenance",
+        .params = {
+            .scan_type = BLE_SCAN_TYPE_ACTIVE,
+            .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
+            .scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ALL,
+            .scan_interval = 0x320, // 500 ms
+            .scan_window = 0x50,    // 50 ms, 10% duty
+            .scan_duplicate = BLE_SCAN_DUPLICATE_DISABLE
+        }
+    },
+    [SCAN_PROFILE_PASSIVE] = {
+        .name = "passive",
+        .params = {
+            .scan_type = BLE_SCAN_TYPE_PASSIVE,
+            .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
+            .scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ALL,
+            .scan_interval = 0x640, // 1 s
+            .scan_window = 0x50,    // 50 ms, 5% duty
+            .scan_duplicate = BLE_SCAN_DUPLICATE_DISABLE
+        }
+    },
+};
+
+static struct {
+    scan_profile_id_t profile;
+    uint8_t backoff;
+    uint8_t empty_scans;
+} scheduler = {
+    .profile = SCAN_PROFILE_AGGRESSIVE,
+    .backoff = 0,
+    .empty_scans = 0
+};
+
+/**
+ * @brief profile pinned in menuconfig, SCAN_PROFILE_COUNT when adaptive
+ */
+static scan_profile_id_t pinned_profile(void)
+{
+#if defined(CONFIG_BTHUB_SCAN_MODE_AGGRESSIVE)
+    return SCAN_PROFILE_AGGRESSIVE;
+#elif defined(CONFIG_BTHUB_SCAN_MODE_MAINTENANCE)
+    return SCAN_PROFILE_MAINTENANCE;
+#elif defined(CONFIG_BTHUB_SCAN_MODE_PASSIVE)
+    return SCAN_PROFILE_PASSIVE;
+#else
+    return SCAN_PROFILE_COUNT;
+#endif
+}
+
+const scan_profile_t *scan_scheduler_profile(scan_profile_id_t id)
+{
+    if (id >= SCAN_PROFILE_COUNT) id = SCAN_PROFILE_AGGRESSIVE;
+    return &scan_profiles[id];
+}
+
+void scan_scheduler_reset(void)
+{
+    scheduler.profile = SCAN_PROFILE_AGGRESSIVE;
+    scheduler.backoff = 0;
+    scheduler.empty_scans = 0;
+}
+
+scan_profile_id_t scan_scheduler_current(void)
+{
+    scan_profile_id_t pinned = pinned_profile();
+    return pinned < SCAN_PROFILE_COUNT ? pinned : scheduler.profile;
+}
+
+void scan_scheduler_scan_done(bool found_new, bool all_found)
+{
+    scan_profile_id_t prev = scheduler.profile;
+
+    if (all_found) {
+        // nothing left to discover, only rssi updates
+        scheduler.profile = SCAN_PROFILE_PASSIVE;
+        scheduler.backoff = SCAN_BACKOFF_MAX;
+    } else if (found_new) {
+        // more devices may still be around, keep discovering at full rate
+        scheduler.profile = SCAN_PROFILE_AGGRESSIVE;
+        scheduler.backoff = 0;
+        scheduler.empty_scans = 0;
+    } else {
+        if (scheduler.empty_scans < UINT8_MAX) scheduler.empty_scans++;
+        if (scheduler.backoff < SCAN_BACKOFF_MAX) scheduler.backoff++;
+        if (scheduler.empty_scans >= SCAN_MAINTENANCE_AFTER) {
+            scheduler.profile = SCAN_PROFILE_MAINTENANCE;
+        }
+    }
+
+    if (prev != scheduler.profile) {
+        ESP_LOGI(TAG, "Scan profile %s -> %s", scan_profiles[prev].name, scan_profiles[scheduler.profile].name);
+    }
+}
+
+uint32_t scan_scheduler_rest_ms(uint8_t base_interval_s)
+{
+    uint32_t rest = (uint32_t)base_interval_s * 1000U;
+    if (pinned_profile() == SCAN_PROFILE_COUNT) {
+        rest <<= scheduler.backoff;
+    }
+    if (rest > SCAN_REST_MAX_MS) rest = SCAN_REST_MAX_MS;
+    if (rest == 0) rest = 1000U;
+    return rest;
+}
+
+uint8_t scan_scheduler_backoff(void)
+{
+    return scheduler.backoff;
+}
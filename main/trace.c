@@ -0,0 +1,88 @@
+#include "trace.h"
+
+#include <stdatomic.h>
+#include <string.h>
+#include "esp_cpu.h"
+#include "esp_timer.h"
+
+#define TRACE_RECORDS CONFIG_BTHUB_TRACE_RECORDS
+
+#if TRACE_RECORDS > 0
+
+_Static_assert((TRACE_RECORDS & (TRACE_RECORDS - 1)) == 0, "BTHUB_TRACE_RECORDS must be a power of two");
+_Static_assert(sizeof(trace_record_t) == 16, "trace record layout is read by tools/trace_decode.py");
+
+static struct {
+    _Atomic uint32_t head;  // records ever claimed, the slot is head % TRACE_RECORDS
+    trace_record_t records[TRACE_RECORDS];
+} trace;
+
+void trace_record(trace_subsys_t subsys, uint8_t event, uint8_t device, uint32_t arg0, uint32_t arg1)
+{
+    uint32_t index = atomic_fetch_add_explicit(&trace.head, 1, memory_order_relaxed);
+    trace_record_t *rec = &trace.records[index & (TRACE_RECORDS - 1)];
+
+    rec->ts_us = (uint32_t)esp_timer_get_time();
+    rec->subsys = (uint8_t)subsys;
+    rec->event = event;
+    rec->device = device;
+    rec->core = (uint8_t)esp_cpu_get_core_id();
+    rec->arg0 = arg0;
+    rec->arg1 = arg1;
+}
+
+size_t trace_capacity(void)
+{
+    return TRACE_RECORDS;
+}
+
+size_t trace_snapshot(trace_header_t *hdr, trace_record_t *records, size_t max)
+{
+    uint32_t head = atomic_load_explicit(&trace.head, memory_order_acquire);
+    uint32_t count = head < TRACE_RECORDS ? head : TRACE_RECORDS;
+    if (count > max) count = (uint32_t)max;
+
+    uint32_t first = head - count;
+    for (uint32_t i = 0; i < count; i++) {
+        records[i] = trace.records[(first + i) & (TRACE_RECORDS - 1)];
+    }
+
+    // writers kept going while copying, the oldest slots may hold newer records now
+    uint32_t now = atomic_load_explicit(&trace.head, memory_order_acquire);
+    uint32_t overwritten = now - first > TRACE_RECORDS ? now - first - TRACE_RECORDS : 0;
+    if (overwritten >= count) {
+        count = 0;
+    } else if (overwritten > 0) {
+        count -= overwritten;
+        memmove(records, records + overwritten, count * sizeof(*records));
+    }
+
+    hdr->magic = TRACE_MAGIC;
+    hdr->version = TRACE_VERSION;
+    hdr->record_size = sizeof(trace_record_t);
+    hdr->capacity = TRACE_RECORDS;
+    hdr->count = count;
+    hdr->written = head;
+    hdr->now_us = (uint64_t)esp_timer_get_time();
+    return count;
+}
+
+#else // tracing disabled
+
+size_t trace_capacity(void)
+{
+    return 0;
+}
+
+size_t trace_snapshot(trace_header_t *hdr, trace_record_t *records, size_t max)
+{
+    (void)records; (void)max;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = TRACE_MAGIC;
+    hdr->version = TRACE_VERSION;
+    hdr->record_size = sizeof(trace_record_t);
+    hdr->now_us = (uint64_t)esp_timer_get_time();
+    return 0;
+}
+
+#endif
@@ -1,4 +1,5 @@
 let metricsInterval = null;
+let devicesGeneration = null; // device table generation shown in the table
 document.addEventListener("DOMContentLoaded", async () => {
     const tabButtons = document.querySelectorAll('.tab-button');
     const tabContents = document.querySelectorAll('.tab-content');
@@ -53,6 +54,7 @@ document.addEventListener("DOMContentLoaded", async () => {
             document.getElementById("by_name").checked = data.by_name ?? false;
             document.getElementById("by_uuid").checked = data.by_uuid ?? false;
             document.getElementById("uuid").value = data.uuid ?? "";
+            document.getElementById("company_ids").value = data.company_ids ?? "";
         }
     } catch (err) {
         console.log("No existing config found");
@@ -112,7 +114,8 @@ document.addEventListener("DOMContentLoaded", async () => {
             mtu: parseInt(ble_form.mtu.value, 10),
             by_name: ble_form.by_name.checked,
             by_uuid: ble_form.by_uuid.checked,
-            uuid: parseInt(ble_form.uuid.value, 16)
+            uuid: ble_form.uuid.value,
+            company_ids: ble_form.company_ids.value
         };
         const res = await fetch("/ble_submit", {
             method: "POST",
@@ -219,7 +222,8 @@ function stopMetricsPolling() {
 
 async function updateMetrics() {
   try {
-    const res = await fetch('/metrics');
+    // the device list is only sent when it changed since our copy
+    const res = await fetch(devicesGeneration === null ? '/metrics' : `/metrics?since=${devicesGeneration}`);
     const data = await res.json();
     const usedPercent = data.used_percent.toFixed(1);
     const free = data.free_heap;
@@ -249,11 +253,18 @@ async function updateMetrics() {
       freeText.style.transform = 'translateY(-50%)';
       freeText.style.color = '#333';
     }
+    if (!data.devices) return;
+    devicesGeneration = data.generation;
     const table = document.getElementById('devices-table-body');
     table.innerHTML = '';
     for (const dev of data.devices) {
       const row = document.createElement('tr');
-      row.innerHTML = `<td>${dev.index}</td><td>${dev.name}</td><td>${dev.mac}</td><td>${dev.uuid}</td><td>${dev.connected}</td><td>${dev.rssi}</td>`;
+      const link = dev.link;
+      const status = dev.available === false ? 'Unreachable' : dev.connected;
+      const conn = dev.conn && dev.conn.interval_us ? `${dev.conn.interval_us / 1000} (${dev.conn.mode})` : '-';
+      row.innerHTML = `<td>${dev.index}</td><td>${dev.name}</td><td>${dev.mac}</td><td>${dev.uuid}</td><td>${status}</td><td>${dev.rssi}</td><td>${conn}</td>` +
+        `<td>${link.connects} (${link.connect_failures})</td><td>${link.connect_avg_ms}</td>` +
+        `<td>${link.writes} (${link.write_failures})</td><td>${link.notifies}</td>`;
       table.appendChild(row);
     }
   } catch (err) {
@@ -0,0 +1,131 @@
+#include "write_pipe.h"
+
+#include <string.h>
+
+#define WRITE_PIPE_TIMEOUT_US (1000 * 1000) // a write without completion event stops holding its credit
+
+static write_pipe_entry_t *waiting_at(write_pipe_t *pipe, uint8_t i)
+{
+    return &pipe->waiting[(pipe->wait_head + i) % WRITE_PIPE_DEPTH];
+}
+
+/**
+ * @brief drop waiting entry i, keep the order of the rest
+ */
+static void waiting_remove(write_pipe_t *pipe, uint8_t i)
+{
+    for (; i + 1 < pipe->wait_count; i++) {
+        *waiting_at(pipe, i) = *waiting_at(pipe, i + 1);
+    }
+    pipe->wait_count--;
+}
+
+/**
+ * @brief waiting frame a newer frame with this opcode replaces, -1 if none
+ */
+static int superseded_by(write_pipe_t *pipe, const light_frame_t *frame)
+{
+    for (uint8_t i = 0; i < pipe->wait_count; i++) {
+        const write_pipe_entry_t *entry = waiting_at(pipe, i);
+        if (entry->supersede && entry->frame.data[1] == frame->data[1]) return i;
+    }
+    return -1;
+}
+
+void write_pipe_reset(write_pipe_t *pipe)
+{
+    memset(pipe, 0, sizeof(*pipe));
+}
+
+write_pipe_result_t write_pipe_submit(write_pipe_t *pipe, const light_frame_t *frame, bool supersede)
+{
+    write_pipe_result_t result = WRITE_PIPE_QUEUED;
+
+    int old = supersede ? superseded_by(pipe, frame) : -1;
+    if (old >= 0) {
+        // the newer value goes behind the frames queued in between, like queue_pending_op
+        waiting_remove(pipe, (uint8_t)old);
+        result = WRITE_PIPE_SUPERSEDED;
+    } else if (pipe->wait_count == WRITE_PIPE_DEPTH) {
+        pipe->wait_head = (pipe->wait_head + 1) % WRITE_PIPE_DEPTH;
+        pipe->wait_count--;
+        result = WRITE_PIPE_OVERFLOW;
+    }
+    write_pipe_entry_t *entry = waiting_at(pipe, pipe->wait_count++);
+    entry->frame = *frame;
+    entry->supersede = supersede;
+    return result;
+}
+
+bool write_pipe_take(write_pipe_t *pipe, int64_t now_us, light_frame_t *frame)
+{
+    if (pipe->congested || pipe->in_flight >= WRITE_PIPE_CREDITS || pipe->wait_count == 0) return false;
+
+    write_pipe_entry_t *entry = waiting_at(pipe, 0);
+    pipe->wait_head = (pipe->wait_head + 1) % WRITE_PIPE_DEPTH;
+    pipe->wait_count--;
+
+    if (pipe->in_flight == 0) pipe->issued_us = now_us;
+    pipe->flight[(pipe->flight_head + pipe->in_flight) % WRITE_PIPE_CREDITS] = *entry;
+    pipe->in_flight++;
+    *frame = entry->frame;
+    return true;
+}
+
+void write_pipe_untake(write_pipe_t *pipe)
+{
+    if (pipe->in_flight) pipe->in_flight--;
+}
+
+bool write_pipe_completed(write_pipe_t *pipe, bool retry, int64_t now_us)
+{
+    if (pipe->in_flight == 0) return false;
+
+    write_pipe_entry_t entry = pipe->flight[pipe->flight_head];
+    pipe->flight_head = (pipe->flight_head + 1) % WRITE_PIPE_CREDITS;
+    pipe->in_flight--;
+    pipe->issued_us = now_us; // the next one in flight gets a full timeout
+
+    // send again first, unless a newer value already waits or there is no room
+    if (retry && !(entry.supersede && superseded_by(pipe, &entry.frame) >= 0) &&
+        pipe->wait_count < WRITE_PIPE_DEPTH) {
+        pipe->wait_head = (pipe->wait_head + WRITE_PIPE_DEPTH - 1) % WRITE_PIPE_DEPTH;
+        pipe->wait_count++;
+        *waiting_at(pipe, 0) = entry;
+    }
+    return true;
+}
+
+void write_pipe_congested(write_pipe_t *pipe, bool congested)
+{
+    pipe->congested = congested;
+}
+
+int64_t write_pipe_due_us(const write_pipe_t *pipe)
+{
+    return pipe->in_flight ? pipe->issued_us + WRITE_PIPE_TIMEOUT_US : 0;
+}
+
+uint8_t write_pipe_expire(write_pipe_t *pipe, int64_t now_us)
+{
+    int64_t due_us = write_pipe_due_us(pipe);
+    if (due_us == 0 || now_us < due_us) return 0;
+
+    uint8_t expired = pipe->in_flight;
+    pipe->in_flight = 0;
+    return expired;
+}
+
+bool write_pipe_pop(write_pipe_t *pipe, light_frame_t *frame)
+{
+    if (pipe->wait_count == 0) return false;
+    *frame = waiting_at(pipe, 0)->frame;
+    pipe->wait_head = (pipe->wait_head + 1) % WRITE_PIPE_DEPTH;
+    pipe->wait_count--;
+    return true;
+}
+
+bool write_pipe_busy(const write_pipe_t *pipe)
+{
+    return pipe->wait_count || pipe->in_flight;
+}
@@ -0,0 +1,332 @@
+/*
+ * Host simulation of the connection scheduler (main/conn_sched.c) against a
+ * model of the Bluedroid open path: N lamps commanded at the same instant,
+ * a pool of P links and a stack that handles one esp_ble_gattc_open at a
+ * time, a second open while one is outstanding fails.
+ *
+ *   cc -O2 -DCONN_SCHED_MAX_DEVICES=64 -Imain/include -o conn_sched_sim \
+ *      tools/conn_sched_sim.c main/conn_sched.c
+ *   ./conn_sched_sim [-n lamps] [-p pool] [-u unreachable] [-r runs]
+ *
+ * Modes:
+ *   parallel    every free link opens at once (the pool before the scheduler),
+ *               collisions retry after the reconnect backoff
+ *   serialized  one open at a time, the next one after the previous command
+ *               finished (no pipelining)
+ *   pipelined   one open at a time, the next one at the OPEN event
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "conn_sched.h"
+
+#define MAX_LAMPS CONN_SCHED_MAX_DEVICES
+#define MAX_EVENTS (8 * MAX_LAMPS)
+
+/* timing model in ms, roughly what a lamp with cached handles shows */
+#define CONNECT_MIN_MS      80.0
+#define CONNECT_MAX_MS      250.0
+#define COLLISION_MS        2.0     // a colliding open fails right away
+#define CONNECT_TIMEOUT_MS  5000.0  // CONFIG_BTHUB_CONNECT_TIMEOUT_MS
+#define SETUP_MS            40.0    // notify registration, settle delay
+#define COMMAND_MS          60.0    // write to notification
+#define CLOSE_MS            20.0    // eviction until the link is free
+#define BACKOFF_BASE_MS     500.0   // CONFIG_BTHUB_RECONNECT_BASE_MS
+#define BACKOFF_MAX_MS      30000.0
+#define BREAKER_FAILURES    4
+
+typedef enum { MODE_PARALLEL, MODE_SERIALIZED, MODE_PIPELINED, MODE_COUNT } mode_t_;
+static const char *const mode_names[MODE_COUNT] = { "parallel", "serialized", "pipelined" };
+
+typedef enum { EV_OPEN_DONE, EV_OPEN_FAIL, EV_COMMAND_DONE, EV_CLOSED, EV_RETRY } event_type_t;
+
+typedef struct {
+    double t;
+    event_type_t type;
+    int lamp;
+} event_t;
+
+typedef enum { LAMP_WAITING, LAMP_OPENING, LAMP_BUSY, LAMP_IDLE, LAMP_CLOSING, LAMP_CLOSED, LAMP_GAVE_UP } lamp_state_t;
+
+typedef struct {
+    lamp_state_t state;
+    bool unreachable;
+    bool done;
+    int failures;
+    double retry_at;
+    double done_at;
+    double used_at;
+} lamp_t;
+
+typedef struct {
+    mode_t_ mode;
+    int lamps;
+    int pool;
+    double now;
+    lamp_t lamp[MAX_LAMPS];
+    event_t events[MAX_EVENTS];
+    int event_count;
+    conn_sched_t sched;
+    int stack_busy;     // lamp whose open the stack is handling, -1 if none
+    int opens;
+    int collisions;
+} sim_t;
+
+typedef struct {
+    double makespan;
+    double mean;
+    double p50;
+    double p95;
+    double opens;
+    double collisions;
+    double gave_up;
+} result_t;
+
+static uint64_t rng_state = 0x2545F4914F6CDD1Dull;
+
+static double rng_uniform(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (double)(rng_state >> 11) / (double)(1ull << 53);
+}
+
+static void push(sim_t *sim, double t, event_type_t type, int lamp)
+{
+    if (sim->event_count >= MAX_EVENTS) {
+        fprintf(stderr, "event queue full\n");
+        exit(1);
+    }
+    sim->events[sim->event_count++] = (event_t){ .t = t, .type = type, .lamp = lamp };
+}
+
+static bool pop(sim_t *sim, event_t *ev)
+{
+    if (sim->event_count == 0) return false;
+    int best = 0;
+    for (int i = 1; i < sim->event_count; i++) {
+        if (sim->events[i].t < sim->events[best].t) best = i;
+    }
+    *ev = sim->events[best];
+    sim->events[best] = sim->events[--sim->event_count];
+    return true;
+}
+
+static int links_in_use(const sim_t *sim)
+{
+    int used = 0;
+    for (int i = 0; i < sim->lamps; i++) {
+        lamp_state_t s = sim->lamp[i].state;
+        if (s == LAMP_OPENING || s == LAMP_BUSY || s == LAMP_IDLE || s == LAMP_CLOSING) used++;
+    }
+    return used;
+}
+
+static bool waiting_ready(const sim_t *sim, int i)
+{
+    const lamp_t *lamp = &sim->lamp[i];
+    return lamp->state == LAMP_WAITING && lamp->retry_at <= sim->now;
+}
+
+/**
+ * @brief same test as pool_ready: warm-up and background opens leave the
+ * last free link to commands
+ */
+static bool sched_ready(int device, conn_prio_t prio, void *ctx)
+{
+    const sim_t *sim = ctx;
+    int free_links = sim->pool - links_in_use(sim);
+    return waiting_ready(sim, device) && free_links >= (prio == CONN_PRIO_COMMAND ? 1 : 2);
+}
+
+static void start_open(sim_t *sim, int i)
+{
+    lamp_t *lamp = &sim->lamp[i];
+    lamp->state = LAMP_OPENING;
+    sim->opens++;
+
+    if (sim->stack_busy >= 0) {
+        sim->collisions++;
+        push(sim, sim->now + COLLISION_MS, EV_OPEN_FAIL, i);
+        return;
+    }
+    sim->stack_busy = i;
+    if (lamp->unreachable) {
+        push(sim, sim->now + CONNECT_TIMEOUT_MS, EV_OPEN_FAIL, i);
+    } else {
+        double connect = CONNECT_MIN_MS + rng_uniform() * (CONNECT_MAX_MS - CONNECT_MIN_MS);
+        push(sim, sim->now + connect, EV_OPEN_DONE, i);
+    }
+}
+
+/**
+ * @brief same steps as pool_service: evict idle links for waiting lamps,
+ * then start opens
+ */
+static void service(sim_t *sim)
+{
+    int free_links = sim->pool - links_in_use(sim);
+    int closing = 0;
+    for (int i = 0; i < sim->lamps; i++) {
+        if (sim->lamp[i].state == LAMP_CLOSING) closing++;
+    }
+    int missing = -free_links - closing;
+    for (int i = 0; i < sim->lamps; i++) {
+        if (!waiting_ready(sim, i) || ++missing <= 0) continue;
+        int victim = -1;
+        for (int j = 0; j < sim->lamps; j++) {
+            if (sim->lamp[j].state != LAMP_IDLE) continue;
+            if (victim < 0 || sim->lamp[j].used_at < sim->lamp[victim].used_at) victim = j;
+        }
+        if (victim < 0) break;
+        sim->lamp[victim].state = LAMP_CLOSING;
+        push(sim, sim->now + CLOSE_MS, EV_CLOSED, victim);
+    }
+
+    if (sim->mode == MODE_PARALLEL) {
+        for (int i = 0; i < sim->lamps && links_in_use(sim) < sim->pool; i++) {
+            if (waiting_ready(sim, i)) start_open(sim, i);
+        }
+        return;
+    }
+    while (!conn_sched_busy(&sim->sched)) {
+        int next = conn_sched_next(&sim->sched, sim->lamps, sched_ready, sim);
+        if (next < 0) break;
+        conn_sched_opening(&sim->sched, next);
+        start_open(sim, next);
+    }
+}
+
+static void open_failed(sim_t *sim, int i)
+{
+    lamp_t *lamp = &sim->lamp[i];
+    if (sim->stack_busy == i) sim->stack_busy = -1;
+    conn_sched_opened(&sim->sched, i);
+
+    lamp->failures++;
+    if (lamp->failures >= BREAKER_FAILURES) {
+        lamp->state = LAMP_GAVE_UP;
+        lamp->done = true;
+        lamp->done_at = sim->now;
+        return;
+    }
+    double delay = BACKOFF_BASE_MS;
+    for (int k = 1; k < lamp->failures; k++) delay *= 2;
+    if (delay > BACKOFF_MAX_MS) delay = BACKOFF_MAX_MS;
+    delay = delay / 2 + rng_uniform() * delay / 2;
+
+    lamp->state = LAMP_WAITING;
+    lamp->retry_at = sim->now + delay;
+    conn_sched_request(&sim->sched, i, CONN_PRIO_COMMAND);
+    push(sim, lamp->retry_at, EV_RETRY, i);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void run(mode_t_ mode, int lamps, int pool, int unreachable, result_t *res)
+{
+    static sim_t sim;
+    memset(&sim, 0, sizeof(sim));
+    sim.mode = mode;
+    sim.lamps = lamps;
+    sim.pool = pool;
+    sim.stack_busy = -1;
+    conn_sched_init(&sim.sched);
+
+    // everything is commanded at t = 0, in table order
+    for (int i = 0; i < lamps; i++) {
+        sim.lamp[i].unreachable = i >= lamps - unreachable;
+        conn_sched_request(&sim.sched, i, CONN_PRIO_COMMAND);
+    }
+    service(&sim);
+
+    event_t ev;
+    while (pop(&sim, &ev)) {
+        sim.now = ev.t;
+        lamp_t *lamp = &sim.lamp[ev.lamp];
+        switch (ev.type) {
+        case EV_OPEN_DONE:
+            sim.stack_busy = -1;
+            lamp->state = LAMP_BUSY;
+            push(&sim, sim.now + SETUP_MS + COMMAND_MS, EV_COMMAND_DONE, ev.lamp);
+            if (mode == MODE_PIPELINED) conn_sched_opened(&sim.sched, ev.lamp);
+            break;
+        case EV_OPEN_FAIL:
+            open_failed(&sim, ev.lamp);
+            break;
+        case EV_COMMAND_DONE:
+            lamp->state = LAMP_IDLE;
+            lamp->done = true;
+            lamp->done_at = sim.now;
+            lamp->used_at = sim.now;
+            if (mode == MODE_SERIALIZED) conn_sched_opened(&sim.sched, ev.lamp);
+            break;
+        case EV_CLOSED:
+            lamp->state = LAMP_CLOSED;
+            break;
+        case EV_RETRY:
+            break;
+        }
+        service(&sim);
+    }
+
+    double latency[MAX_LAMPS];
+    int n = 0;
+    double sum = 0, makespan = 0;
+    for (int i = 0; i < lamps; i++) {
+        const lamp_t *l = &sim.lamp[i];
+        if (l->state == LAMP_GAVE_UP) {
+            res->gave_up++;
+            continue;
+        }
+        latency[n++] = l->done_at;
+        sum += l->done_at;
+        if (l->done_at > makespan) makespan = l->done_at;
+    }
+    qsort(latency, n, sizeof(double), compare_double);
+    res->makespan += makespan;
+    if (n > 0) {
+        res->mean += sum / n;
+        res->p50 += latency[(n - 1) / 2];
+        res->p95 += latency[(n * 95 + 99) / 100 - 1];
+    }
+    res->opens += sim.opens;
+    res->collisions += sim.collisions;
+}
+
+int main(int argc, char **argv)
+{
+    int lamps = 20, pool = 4, unreachable = 0, runs = 1000;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "-n")) lamps = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "-p")) pool = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "-u")) unreachable = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "-r")) runs = atoi(argv[i + 1]);
+    }
+    if (lamps < 1 || lamps > MAX_LAMPS || pool < 1 || unreachable < 0 || unreachable > lamps || runs < 1) {
+        fprintf(stderr, "usage: %s [-n lamps (1..%d)] [-p pool] [-u unreachable] [-r runs]\n", argv[0], MAX_LAMPS);
+        return 1;
+    }
+
+    printf("%d lamps (%d unreachable) commanded at once, pool of %d links, %d runs\n",
+           lamps, unreachable, pool, runs);
+    printf("%-11s %10s %10s %10s %10s %8s %10s %8s %10s\n",
+           "mode", "all done", "mean", "p50", "p95", "opens", "collisions", "gave up", "cmds/s");
+    for (int mode = 0; mode < MODE_COUNT; mode++) {
+        result_t res = {0};
+        for (int r = 0; r < runs; r++) {
+            run((mode_t_)mode, lamps, pool, unreachable, &res);
+        }
+        double done = lamps - res.gave_up / runs;
+        printf("%-11s %8.0fms %8.0fms %8.0fms %8.0fms %8.1f %10.1f %8.1f %10.1f\n",
+               mode_names[mode], res.makespan / runs, res.mean / runs, res.p50 / runs, res.p95 / runs,
+               res.opens / runs, res.collisions / runs, res.gave_up / runs,
+               res.makespan > 0 ? done / (res.makespan / runs / 1000.0) : 0.0);
+    }
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Host conformance test and benchmark of the lamp protocol CRC16
+ * (light_cmd_crc16 in main/light_cmd.c). The variant is chosen at compile
+ * time like BTHUB_CRC16_* on the target, so build once per variant:
+ *
+ *   for v in BITWISE TABLE SLICE4; do
+ *       cc -O2 -DCONFIG_BTHUB_CRC16_$v -Imain/include -Itools/host -o crc16_$v \
+ *          tools/crc16_bench.c main/light_cmd.c && ./crc16_$v
+ *   done
+ *
+ * Every variant is checked against the bitwise reference on the Modbus check
+ * value and on random buffers of every length up to 64 bytes and every
+ * alignment, then timed on command sized frames and on longer buffers.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "light_cmd.h"
+
+#if defined(CONFIG_BTHUB_CRC16_SLICE4)
+#define VARIANT "slice4"
+#elif defined(CONFIG_BTHUB_CRC16_TABLE)
+#define VARIANT "table"
+#else
+#define VARIANT "bitwise"
+#endif
+
+#define CHECK_ROUNDS    2000
+#define BENCH_BYTES     (64L << 20)
+
+static volatile uint16_t sink; // keep the CRCs from being optimized away
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint16_t reference_crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 0x0001) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+static int conformance(void)
+{
+    static const uint8_t check[] = "123456789";
+    uint16_t crc = light_cmd_crc16(check, 9);
+    if (crc != 0x4B37) {
+        fprintf(stderr, "check value 0x%04x, expected 0x4B37\n", crc);
+        return 0;
+    }
+
+    uint8_t buf[64 + 4];
+    for (int round = 0; round < CHECK_ROUNDS; round++) {
+        for (size_t i = 0; i < sizeof(buf); i++) buf[i] = (uint8_t)rand();
+        for (size_t offset = 0; offset < 4; offset++) {
+            for (size_t len = 0; len <= 64; len++) {
+                uint16_t got = light_cmd_crc16(buf + offset, len);
+                uint16_t want = reference_crc16(buf + offset, len);
+                if (got != want) {
+                    fprintf(stderr, "len %zu offset %zu: 0x%04x, expected 0x%04x\n", len, offset, got, want);
+                    return 0;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief time CRCs over buffers of len bytes
+ * @return ns per buffer
+ */
+static double bench(size_t len)
+{
+    uint8_t buf[256];
+    for (size_t i = 0; i < sizeof(buf); i++) buf[i] = (uint8_t)rand();
+
+    long rounds = BENCH_BYTES / (long)len;
+    uint16_t acc = 0;
+    double start = now_s();
+    for (long n = 0; n < rounds; n++) {
+        buf[0] = (uint8_t)n;
+        acc ^= light_cmd_crc16(buf, len);
+    }
+    double elapsed = now_s() - start;
+    sink = acc;
+    return elapsed * 1e9 / rounds;
+}
+
+int main(void)
+{
+    static const size_t lens[] = { 4, 6, 10, 64, 256 };
+
+    srand(1);
+    if (!conformance()) {
+        printf("%s: FAIL\n", VARIANT);
+        return 1;
+    }
+    printf("%s: matches the bitwise reference\n", VARIANT);
+    printf("%8s %12s %10s\n", "bytes", "ns/crc", "MB/s");
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        double ns = bench(lens[i]);
+        printf("%8zu %12.1f %10.1f\n", lens[i], ns, lens[i] * 1e3 / ns);
+    }
+    return 0;
+}
@@ -0,0 +1,18 @@
+/*
+ * Host stand-in for the ESP-IDF error codes the modules in main/ return.
+ */
+#ifndef esp_err_H
+#define esp_err_H
+
+typedef int esp_err_t;
+
+#define ESP_OK                  0
+#define ESP_FAIL                -1
+#define ESP_ERR_NO_MEM          0x101
+#define ESP_ERR_INVALID_ARG     0x102
+#define ESP_ERR_INVALID_STATE   0x103
+#define ESP_ERR_INVALID_SIZE    0x104
+#define ESP_ERR_NOT_FOUND       0x105
+#define ESP_ERR_NOT_SUPPORTED   0x106
+#define ESP_ERR_INVALID_VERSION 0x10A
+#endif // esp_err_H
@@ -0,0 +1,15 @@
+/*
+ * Host stand-in for the ESP-IDF logger, lets the programs in tools/ build
+ * modules from main/ unchanged: errors go to stderr, the rest is dropped.
+ */
+#ifndef esp_log_H
+#define esp_log_H
+
+#include <stdio.h>
+
+#define ESP_LOGE(tag, fmt, ...) fprintf(stderr, "E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fprintf(stderr, "W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) ((void)(tag))
+#define ESP_LOGD(tag, fmt, ...) ((void)(tag))
+#define ESP_LOG_BUFFER_HEX_LEVEL(tag, buf, len, level) ((void)(tag), (void)(buf))
+#endif // esp_log_H
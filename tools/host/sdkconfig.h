@@ -0,0 +1,4 @@
+/*
+ * Host stand-in for the generated sdkconfig.h. The programs in tools/ pass
+ * the options they depend on with -D, e.g. -DCONFIG_BTHUB_MAX_DEVICES=64.
+ */
@@ -0,0 +1,150 @@
+/*
+ * Host benchmark of the device registry (main/device_registry.c) against the
+ * linear scan over the device table it replaced. The table size is fixed at
+ * compile time like on the target, so build once per size:
+ *
+ *   for n in 8 64 255; do
+ *       cc -O2 -DCONFIG_BTHUB_MAX_DEVICES=$n -Imain/include -Itools/host -o registry_bench_$n \
+ *          tools/registry_bench.c main/device_registry.c && ./registry_bench_$n
+ *   done
+ *
+ * 255 is the largest table BTHUB_MAX_DEVICES allows (indexes are uint8_t,
+ * 0xFF marks an empty slot), it stands in for 256.
+ *
+ * Lookups:
+ *   mac hit     advert from a lamp in the table
+ *   mac miss    advert from anything else, the common case while scanning
+ *   conn        GATTC event resolved by conn_id
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "device_registry.h"
+
+#define MAX_LAMPS   CONFIG_BTHUB_MAX_DEVICES
+#define LOOKUPS     (1 << 22)
+#define KEYS        1024    // lookup keys cycled through, power of two
+#define DEVICE_SIZE 256     // roughly sizeof(ble_device_t), the stride the scan walks
+
+/* the fields the linear scan compared, padded to the size of a device entry */
+typedef struct {
+    uint8_t mac[6];
+    uint16_t conn_id;
+    uint8_t pad[DEVICE_SIZE - 8];
+} device_t;
+
+static device_t devices[MAX_LAMPS];
+static volatile int sink; // keep the lookups from being optimized away
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int linear_find_mac(const uint8_t *mac)
+{
+    for (int i = 0; i < MAX_LAMPS; i++) {
+        if (memcmp(devices[i].mac, mac, 6) == 0) return i;
+    }
+    return -1;
+}
+
+static int linear_find_conn(uint16_t conn_id)
+{
+    for (int i = 0; i < MAX_LAMPS; i++) {
+        if (devices[i].conn_id == conn_id) return i;
+    }
+    return -1;
+}
+
+static void random_mac(uint8_t *mac)
+{
+    // vendor prefix shared by all lamps, like a batch of one model
+    mac[0] = 0xA4;
+    mac[1] = 0xC1;
+    mac[2] = 0x38;
+    for (int i = 3; i < 6; i++) mac[i] = (uint8_t)rand();
+}
+
+typedef int (*mac_lookup_t)(const uint8_t *mac);
+typedef int (*conn_lookup_t)(uint16_t conn_id);
+
+static double bench_mac(mac_lookup_t find, uint8_t keys[KEYS][6])
+{
+    int found = 0;
+    double start = now_s();
+    for (int n = 0; n < LOOKUPS; n++) {
+        found += find(keys[n & (KEYS - 1)]) >= 0;
+    }
+    double elapsed = now_s() - start;
+    sink = found;
+    return elapsed * 1e9 / LOOKUPS;
+}
+
+static double bench_conn(conn_lookup_t find, const uint16_t *keys)
+{
+    int found = 0;
+    double start = now_s();
+    for (int n = 0; n < LOOKUPS; n++) {
+        found += find(keys[n & (KEYS - 1)]) >= 0;
+    }
+    double elapsed = now_s() - start;
+    sink = found;
+    return elapsed * 1e9 / LOOKUPS;
+}
+
+static int check(void)
+{
+    uint8_t mac[6];
+    for (int i = 0; i < MAX_LAMPS; i++) {
+        if (device_registry_find_mac(devices[i].mac) != i) return 0;
+        if (device_registry_find_conn(devices[i].conn_id) != i) return 0;
+    }
+    for (int n = 0; n < KEYS; n++) {
+        random_mac(mac);
+        if (device_registry_find_mac(mac) != linear_find_mac(mac)) return 0;
+    }
+    return 1;
+}
+
+int main(void)
+{
+    static uint8_t hit_keys[KEYS][6];
+    static uint8_t miss_keys[KEYS][6];
+    static uint16_t conn_keys[KEYS];
+
+    srand(1);
+    device_registry_reset();
+    for (int i = 0; i < MAX_LAMPS; i++) {
+        do {
+            random_mac(devices[i].mac);
+        } while (!device_registry_add(devices[i].mac, i));
+        devices[i].conn_id = (uint16_t)i;
+        device_registry_set_conn(devices[i].conn_id, i);
+    }
+    if (!check()) {
+        fprintf(stderr, "registry disagrees with the linear scan\n");
+        return 1;
+    }
+
+    for (int n = 0; n < KEYS; n++) {
+        memcpy(hit_keys[n], devices[rand() % MAX_LAMPS].mac, 6);
+        do {
+            random_mac(miss_keys[n]);
+        } while (linear_find_mac(miss_keys[n]) >= 0);
+        conn_keys[n] = devices[rand() % MAX_LAMPS].conn_id;
+    }
+
+    printf("%d devices, ns per lookup\n", MAX_LAMPS);
+    printf("%-10s %10s %10s\n", "lookup", "linear", "registry");
+    printf("%-10s %10.1f %10.1f\n", "mac hit",
+           bench_mac(linear_find_mac, hit_keys), bench_mac(device_registry_find_mac, hit_keys));
+    printf("%-10s %10.1f %10.1f\n", "mac miss",
+           bench_mac(linear_find_mac, miss_keys), bench_mac(device_registry_find_mac, miss_keys));
+    printf("%-10s %10.1f %10.1f\n", "conn",
+           bench_conn(linear_find_conn, conn_keys), bench_conn(device_registry_find_conn, conn_keys));
+    return 0;
+}
@@ -0,0 +1,172 @@
+#!/usr/bin/env python3
+"""Decode the hub's event trace (GET /trace) into Chrome trace JSON.
+
+    curl -o bthub.trace http://esp32.local/trace
+    python3 tools/trace_decode.py bthub.trace > bthub.json    # chrome://tracing, ui.perfetto.dev
+    python3 tools/trace_decode.py --text bthub.trace          # one line per record
+
+The layout matches main/include/trace.h. Event names follow the ESP-IDF
+headers; ids the tables don't know are printed as numbers.
+"""
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = 0x52545442
+HEADER = struct.Struct("<IHHIIIQ")
+RECORD = struct.Struct("<IBBBBII")
+NO_DEVICE = 0xFF
+
+SUBSYS = ["gap", "gattc", "device", "mqtt", "http"]
+
+GAP_EVENTS = {
+    2: "SCAN_PARAM_SET_COMPLETE",
+    3: "SCAN_RESULT",
+    7: "SCAN_START_COMPLETE",
+    18: "SCAN_STOP_COMPLETE",
+    20: "UPDATE_CONN_PARAMS",
+    27: "UPDATE_WHITELIST_COMPLETE",
+}
+
+GATTC_EVENTS = {
+    0: "REG", 1: "UNREG", 2: "OPEN", 3: "READ_CHAR", 4: "WRITE_CHAR", 5: "CLOSE",
+    6: "SEARCH_CMPL", 7: "SEARCH_RES", 8: "READ_DESCR", 9: "WRITE_DESCR", 10: "NOTIFY",
+    11: "PREP_WRITE", 12: "EXEC", 13: "ACL", 14: "CANCEL_OPEN", 15: "SRVC_CHG",
+    17: "ENC_CMPL_CB", 18: "CFG_MTU", 24: "CONGEST", 38: "REG_FOR_NOTIFY",
+    39: "UNREG_FOR_NOTIFY", 40: "CONNECT", 41: "DISCONNECT", 43: "QUEUE_FULL",
+}
+
+DEVICE_EVENTS = ["added", "removed", "gattc", "command", "connect", "disconnect", "write",
+                 "scan_yield", "scan_resume"]
+
+MQTT_EVENTS = {
+    0: "ERROR", 1: "CONNECTED", 2: "DISCONNECTED", 3: "SUBSCRIBED", 4: "UNSUBSCRIBED",
+    5: "PUBLISHED", 6: "DATA", 7: "BEFORE_CONNECT", 8: "DELETED",
+}
+
+HTTP_EVENTS = [
+    "captive", "metrics", "latency", "trace", "index_json", "file",
+    "login", "set_login", "mqtt_submit", "ble_submit", "ble_reset", "wifi_submit",
+]
+
+HTTP_METHODS = {0: "DELETE", 1: "GET", 2: "HEAD", 3: "POST", 4: "PUT"}
+
+
+def lookup(table, key, prefix):
+    if isinstance(table, dict):
+        name = table.get(key)
+    else:
+        name = table[key] if key < len(table) else None
+    return name if name is not None else "%s_%d" % (prefix, key)
+
+
+def signed32(value):
+    value &= 0xFFFFFFFF
+    return value - (1 << 32) if value & 0x80000000 else value
+
+
+def describe(subsys, event, arg0, arg1):
+    """event name and arguments of one record"""
+    if subsys == 0:
+        return "GAP " + lookup(GAP_EVENTS, event, "evt"), {"status": arg0, "posted": bool(arg1)}
+    if subsys == 1:
+        return "GATTC " + lookup(GATTC_EVENTS, event, "evt"), {"gattc_if": arg0, "posted": bool(arg1)}
+    if subsys == 2:
+        name = lookup(DEVICE_EVENTS, event, "dev")
+        if name == "added":
+            return name, {"rssi": signed32(arg0)}
+        if name == "gattc":
+            return "gattc " + lookup(GATTC_EVENTS, arg0, "evt"), {}
+        if name == "command":
+            return name, {"opcode": "0x%02x" % arg0, "since_mqtt_us": arg1}
+        if name == "connect":
+            return name, {"started": bool(arg0)}
+        if name == "disconnect":
+            return name, {"reason": "0x%02x" % arg0}
+        if name == "write":
+            return name, {"opcode": "0x%02x" % arg0, "status": arg1}
+        if name == "scan_yield":
+            return name, {"left_s": arg0}
+        if name == "scan_resume":
+            return name, {"run_s": arg0}
+        return name, {}
+    if subsys == 3:
+        return "MQTT " + lookup(MQTT_EVENTS, event, "evt"), {"msg_id": signed32(arg0), "data_len": signed32(arg1)}
+    if subsys == 4:
+        return "HTTP " + lookup(HTTP_EVENTS, event, "uri"), {"method": lookup(HTTP_METHODS, arg0, "method")}
+    return "subsys_%d evt_%d" % (subsys, event), {"arg0": arg0, "arg1": arg1}
+
+
+def parse(data):
+    if len(data) < HEADER.size:
+        raise ValueError("file too short")
+    magic, version, record_size, capacity, count, written, now_us = HEADER.unpack_from(data)
+    if magic != MAGIC:
+        raise ValueError("not a hub trace (magic 0x%08x)" % magic)
+    if version != 1 or record_size != RECORD.size:
+        raise ValueError("unsupported trace version %d, record size %d" % (version, record_size))
+    count = min(count, (len(data) - HEADER.size) // RECORD.size)
+    records = [RECORD.unpack_from(data, HEADER.size + i * RECORD.size) for i in range(count)]
+
+    # stamps are the low 32 bits of esp_timer, rebuild them from the download time backwards
+    stamps = [0] * count
+    if count:
+        stamps[-1] = now_us - ((now_us - records[-1][0]) & 0xFFFFFFFF)
+        for i in range(count - 2, -1, -1):
+            stamps[i] = stamps[i + 1] - signed32(records[i + 1][0] - records[i][0])
+
+    header = {"capacity": capacity, "count": count, "written": written, "now_us": now_us}
+    return header, [(stamps[i],) + records[i][1:] for i in range(count)]
+
+
+def to_chrome(header, records):
+    events = []
+    lanes = {}
+    for ts, subsys, event, device, core, arg0, arg1 in records:
+        name, args = describe(subsys, event, arg0, arg1)
+        args["core"] = core
+        if device != NO_DEVICE:
+            tid, lane = 100 + device, "device %d" % device
+        else:
+            tid, lane = subsys, SUBSYS[subsys] if subsys < len(SUBSYS) else "subsys %d" % subsys
+        lanes[tid] = lane
+        events.append({"name": name, "cat": SUBSYS[subsys] if subsys < len(SUBSYS) else "other",
+                       "ph": "i", "s": "t", "ts": ts, "pid": 1, "tid": tid, "args": args})
+    for tid, lane in sorted(lanes.items()):
+        events.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": tid, "args": {"name": lane}})
+    events.append({"name": "process_name", "ph": "M", "pid": 1, "tid": 0, "args": {"name": "bt hub"}})
+    return {"traceEvents": events, "displayTimeUnit": "ms", "otherData": header}
+
+
+def to_text(header, records, out):
+    out.write("# %(count)d records of %(written)d written, ring of %(capacity)d\n" % header)
+    for ts, subsys, event, device, core, arg0, arg1 in records:
+        name, args = describe(subsys, event, arg0, arg1)
+        dev = "-" if device == NO_DEVICE else str(device)
+        fields = " ".join("%s=%s" % item for item in args.items())
+        out.write("%14.6f c%d dev %-2s %-32s %s\n" % (ts / 1e6, core, dev, name, fields))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("trace", help="file downloaded from GET /trace")
+    parser.add_argument("--text", action="store_true", help="print records instead of Chrome trace JSON")
+    opts = parser.parse_args()
+
+    with open(opts.trace, "rb") as f:
+        data = f.read()
+    try:
+        header, records = parse(data)
+    except ValueError as err:
+        sys.exit("%s: %s" % (opts.trace, err))
+
+    if opts.text:
+        to_text(header, records, sys.stdout)
+    else:
+        json.dump(to_chrome(header, records), sys.stdout)
+        sys.stdout.write("\n")
+
+
+if __name__ == "__main__":
+    main()